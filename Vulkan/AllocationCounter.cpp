@@ -0,0 +1,37 @@
+﻿#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+static thread_local uint64_t threadAllocations = 0;
+
+//Every other form of new (arrays, nothrow) ends up in this one, and every delete in the matching one below
+void* operator new(std::size_t size)
+{
+    threadAllocations++;
+    if(void* memory = std::malloc(size > 0 ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+uint64_t AllocationCounter::GetThreadCount()
+{
+    return threadAllocations;
+}
+#else
+uint64_t AllocationCounter::GetThreadCount()
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,11 @@
+﻿#pragma once
+#include <cstdint>
+
+//Debug builds replace the global operator new to count heap allocations, so code that should never
+//allocate (the frame loop once it has warmed up) can check it doesn't. Always 0 in release builds
+class AllocationCounter
+{
+public:
+    //Allocations made by the calling thread since it started, the worker threads' loading doesn't count
+    static uint64_t GetThreadCount();
+};
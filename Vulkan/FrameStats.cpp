@@ -0,0 +1,85 @@
+﻿#include "FrameStats.h"
+
+#include <atomic>
+
+static std::atomic<uint32_t> uploadCount{0};
+static std::atomic<uint64_t> uploadBytes{0};
+static std::atomic<uint32_t> descriptorUpdateCount{0};
+
+void FrameCounters::CountUpload(VkDeviceSize bytes)
+{
+    uploadCount++;
+    uploadBytes += bytes;
+}
+
+void FrameCounters::CountDescriptorUpdates(uint32_t count)
+{
+    descriptorUpdateCount += count;
+}
+
+void FrameCounters::Collect(FrameStats& stats)
+{
+    stats.uploads += uploadCount.exchange(0);
+    stats.uploadBytes += uploadBytes.exchange(0);
+    stats.descriptorUpdates += descriptorUpdateCount.exchange(0);
+}
+
+void CommandRecorder::BindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline)
+{
+    vkCmdBindPipeline(commandBuffer,bindPoint,pipeline);
+    stats.pipelineBinds++;
+}
+
+void CommandRecorder::BindDescriptorSets(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount,
+    const VkDescriptorSet* sets)
+{
+    vkCmdBindDescriptorSets(commandBuffer,bindPoint,layout,firstSet,setCount,sets,0,nullptr);
+    stats.descriptorSetBinds += setCount;
+}
+
+void CommandRecorder::BindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets)
+{
+    vkCmdBindVertexBuffers(commandBuffer,firstBinding,bindingCount,buffers,offsets);
+    stats.vertexBufferBinds += bindingCount;
+}
+
+void CommandRecorder::BindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType)
+{
+    vkCmdBindIndexBuffer(commandBuffer,buffer,offset,indexType);
+    stats.indexBufferBinds++;
+}
+
+void CommandRecorder::PushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void* values)
+{
+    vkCmdPushConstants(commandBuffer,layout,stages,offset,size,values);
+    stats.pushConstants++;
+}
+
+void CommandRecorder::DrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset,
+    uint32_t firstInstance)
+{
+    vkCmdDrawIndexed(commandBuffer,indexCount,instanceCount,firstIndex,vertexOffset,firstInstance);
+    stats.drawCalls++;
+    stats.trianglesSubmitted += static_cast<uint64_t>(indexCount / 3) * instanceCount;
+}
+
+void CommandRecorder::DrawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+{
+    vkCmdDrawIndexedIndirect(commandBuffer,buffer,offset,drawCount,stride);
+    stats.drawCalls++;
+    stats.indirectDrawCommands += drawCount;
+}
+
+void CommandRecorder::DrawIndexedIndirectCount(PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount, VkBuffer buffer,
+    VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride)
+{
+    drawIndexedIndirectCount(commandBuffer,buffer,offset,countBuffer,countOffset,maxDrawCount,stride);
+    stats.drawCalls++;
+    stats.indirectDrawCommands += maxDrawCount;
+}
+
+void CommandRecorder::Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ)
+{
+    vkCmdDispatch(commandBuffer,groupCountX,groupCountY,groupCountZ);
+    stats.dispatches++;
+}
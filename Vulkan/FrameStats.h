@@ -0,0 +1,69 @@
+﻿#pragma once
+#include <cstdint>
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+//What one frame asked of the GPU, to spot batching regressions before they show up as frame time
+struct FrameStats
+{
+    uint32_t drawCalls; //Each vkCmdDraw* call, an indirect draw of many commands counts once
+    uint32_t indirectDrawCommands; //Commands indirect draws can read (the most, a count buffer may stop them earlier)
+    uint32_t dispatches;
+    uint32_t pipelineBinds;
+    uint32_t descriptorSetBinds; //Sets, not calls
+    uint32_t vertexBufferBinds;
+    uint32_t indexBufferBinds;
+    uint32_t pushConstants;
+    uint32_t descriptorUpdates; //Descriptors written with vkUpdateDescriptorSets since the last frame
+    uint64_t trianglesSubmitted; //Of direct draws, what indirect draws end up drawing is in the pipeline statistics
+    uint32_t uploads; //Copies out of staging memory since the last frame
+    uint64_t uploadBytes;
+
+    //Pipeline statistics query of the frame, only valid when the device has them.
+    //Read back once the GPU is done, so they're from a frame or two before the counts above
+    bool pipelineStatisticsValid;
+    uint64_t inputAssemblyPrimitives;
+    uint64_t vertexShaderInvocations;
+    uint64_t clippingInvocations;
+    uint64_t clippingPrimitives;
+    uint64_t fragmentShaderInvocations;
+    uint64_t computeShaderInvocations;
+};
+
+//Uploads and descriptor updates happen in free functions and on loading threads with no renderer to report to,
+//so they add up here for the whole process until the renderer collects them
+class FrameCounters
+{
+public:
+    static void CountUpload(VkDeviceSize bytes);
+    static void CountDescriptorUpdates(uint32_t count);
+    //Adds what was counted since the last call to stats, and starts again from zero
+    static void Collect(FrameStats& stats);
+};
+
+//Records into a command buffer exactly like the vkCmd* calls it wraps, counting them in stats
+class CommandRecorder
+{
+public:
+    CommandRecorder(VkCommandBuffer newCommandBuffer, FrameStats& newStats): commandBuffer(newCommandBuffer), stats(newStats) {}
+
+    VkCommandBuffer GetCommandBuffer() const {return commandBuffer;}
+
+    void BindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline);
+    void BindDescriptorSets(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount,
+        const VkDescriptorSet* sets);
+    void BindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets);
+    void BindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType);
+    void PushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void* values);
+
+    void DrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+    void DrawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+    //vkCmdDrawIndexedIndirectCountKHR, loaded by the renderer
+    void DrawIndexedIndirectCount(PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount, VkBuffer buffer, VkDeviceSize offset,
+        VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride);
+    void Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ);
+
+private:
+    VkCommandBuffer commandBuffer;
+    FrameStats& stats;
+};
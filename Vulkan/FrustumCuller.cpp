@@ -0,0 +1,110 @@
+﻿#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define FRUSTUM_CULLER_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "Utilities.h"
+
+FrustumCuller::FrustumCuller(): count(0)
+{
+}
+
+void FrustumCuller::Resize(size_t newCount)
+{
+    count = newCount;
+    size_t paddedCount = (newCount + 3) & ~size_t(3);
+
+    //Padding lanes get empty bounds, their results are never read
+    for (std::vector<float>* values : {&sphereX,&sphereY,&sphereZ,&sphereRadius,&boxX,&boxY,&boxZ,&extentX,&extentY,&extentZ})
+        values->assign(paddedCount,0.0f);
+}
+
+void FrustumCuller::SetBounds(size_t index, const glm::mat4& model, const glm::vec3& boxMin, const glm::vec3& boxMax,
+    const glm::vec3& sphereCenter, float radius)
+{
+    glm::vec3 worldSphere = glm::vec3(model * glm::vec4(sphereCenter,1.0f));
+    sphereX[index] = worldSphere.x;
+    sphereY[index] = worldSphere.y;
+    sphereZ[index] = worldSphere.z;
+    sphereRadius[index] = radius * GetMaxAxisScale(model);
+
+    //Box that holds the transformed box: centre moves with the matrix, extents through its absolute values
+    glm::vec3 centre = glm::vec3(model * glm::vec4((boxMin + boxMax) * 0.5f,1.0f));
+    glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+    glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(model[0])),glm::abs(glm::vec3(model[1])),glm::abs(glm::vec3(model[2])));
+    glm::vec3 worldExtent = absolute * extent;
+    boxX[index] = centre.x;
+    boxY[index] = centre.y;
+    boxZ[index] = centre.z;
+    extentX[index] = worldExtent.x;
+    extentY[index] = worldExtent.y;
+    extentZ[index] = worldExtent.z;
+}
+
+void FrustumCuller::Cull(const glm::mat4& viewProjection, std::vector<uint8_t>& visible) const
+{
+    glm::vec4 planes[6];
+    ExtractFrustumPlanes(viewProjection,planes);
+
+    visible.resize(count);
+
+#ifdef FRUSTUM_CULLER_SSE
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    for (size_t i = 0; i < count; i += 4)
+    {
+        __m128 sx = _mm_loadu_ps(&sphereX[i]);
+        __m128 sy = _mm_loadu_ps(&sphereY[i]);
+        __m128 sz = _mm_loadu_ps(&sphereZ[i]);
+        __m128 negRadius = _mm_sub_ps(zero,_mm_loadu_ps(&sphereRadius[i]));
+        __m128 bx = _mm_loadu_ps(&boxX[i]);
+        __m128 by = _mm_loadu_ps(&boxY[i]);
+        __m128 bz = _mm_loadu_ps(&boxZ[i]);
+        __m128 ex = _mm_loadu_ps(&extentX[i]);
+        __m128 ey = _mm_loadu_ps(&extentY[i]);
+        __m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+        __m128 inside = _mm_cmpeq_ps(zero,zero);
+        for (const glm::vec4& plane : planes)
+        {
+            __m128 nx = _mm_set1_ps(plane.x);
+            __m128 ny = _mm_set1_ps(plane.y);
+            __m128 nz = _mm_set1_ps(plane.z);
+            __m128 nw = _mm_set1_ps(plane.w);
+
+            //Sphere: signed distance of the centre must be more than -radius
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx,sx),_mm_mul_ps(ny,sy)),_mm_add_ps(_mm_mul_ps(nz,sz),nw));
+            inside = _mm_and_ps(inside,_mm_cmpge_ps(distance,negRadius));
+
+            //Box: same, with the box's extent projected on the plane normal as the radius
+            __m128 boxDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx,bx),_mm_mul_ps(ny,by)),_mm_add_ps(_mm_mul_ps(nz,bz),nw));
+            __m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask,nx),ex),_mm_mul_ps(_mm_andnot_ps(signMask,ny),ey)),
+                                          _mm_mul_ps(_mm_andnot_ps(signMask,nz),ez));
+            inside = _mm_and_ps(inside,_mm_cmpge_ps(boxDistance,_mm_sub_ps(zero,boxRadius)));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (size_t lane = 0; lane < 4 && i + lane < count; ++lane)
+            visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+    }
+#else
+    for (size_t i = 0; i < count; ++i)
+    {
+        bool inside = true;
+        for (const glm::vec4& plane : planes)
+        {
+            float distance = plane.x * sphereX[i] + plane.y * sphereY[i] + plane.z * sphereZ[i] + plane.w;
+            float boxDistance = plane.x * boxX[i] + plane.y * boxY[i] + plane.z * boxZ[i] + plane.w;
+            float boxRadius = std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+            inside = inside && distance >= -sphereRadius[i] && boxDistance >= -boxRadius;
+        }
+        visible[i] = inside ? 1 : 0;
+    }
+#endif
+}
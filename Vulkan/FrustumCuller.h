@@ -0,0 +1,39 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+//World space bounds of every mesh drawn this frame, kept as separate arrays (structure of arrays)
+//so the frustum test can run on four meshes at once with SSE.
+//Each mesh is tested with both its bounding sphere and its bounding box, it's visible only if both pass.
+class FrustumCuller
+{
+public:
+    FrustumCuller();
+
+    void Resize(size_t newCount);
+    size_t GetCount() const {return count;}
+
+    //Model space bounds, moved to world space with the model matrix
+    void SetBounds(size_t index, const glm::mat4& model, const glm::vec3& boxMin, const glm::vec3& boxMax,
+        const glm::vec3& sphereCenter, float radius);
+
+    //visible[i] is 1 if mesh i is at least partly inside the frustum of viewProjection
+    void Cull(const glm::mat4& viewProjection, std::vector<uint8_t>& visible) const;
+
+private:
+    size_t count;
+
+    //Padded to a multiple of 4
+    std::vector<float> sphereX;
+    std::vector<float> sphereY;
+    std::vector<float> sphereZ;
+    std::vector<float> sphereRadius;
+
+    std::vector<float> boxX; //Box centre
+    std::vector<float> boxY;
+    std::vector<float> boxZ;
+    std::vector<float> extentX; //Half size along each world axis
+    std::vector<float> extentY;
+    std::vector<float> extentZ;
+};
@@ -0,0 +1,53 @@
+﻿#include "LinearArena.h"
+
+#include <algorithm>
+
+LinearArena::LinearArena(size_t newBlockSize): blockSize(newBlockSize), offset(0), usedBytes(0)
+{
+}
+
+void* LinearArena::Allocate(size_t size, size_t alignment)
+{
+    if(!blocks.empty())
+    {
+        Block& block = blocks.back();
+        uintptr_t address = reinterpret_cast<uintptr_t>(block.memory.get()) + offset;
+        size_t padding = (alignment - address % alignment) % alignment;
+        if(offset + padding + size <= block.size)
+        {
+            offset += padding + size;
+            usedBytes += padding + size;
+            return reinterpret_cast<void*>(address + padding);
+        }
+    }
+
+    //new[] memory is aligned for anything, so the start of a fresh block needs no padding
+    AddBlock(size);
+    offset = size;
+    usedBytes += size;
+    return blocks.back().memory.get();
+}
+
+void LinearArena::Reset()
+{
+    //Merged into one block the size of all of them, the next time round everything fits without adding any
+    if(blocks.size() > 1)
+    {
+        size_t totalSize = 0;
+        for (const Block& block : blocks)
+            totalSize += block.size;
+        blocks.clear();
+        AddBlock(totalSize);
+    }
+
+    offset = 0;
+    usedBytes = 0;
+}
+
+void LinearArena::AddBlock(size_t minSize)
+{
+    Block block{};
+    block.size = std::max(blockSize,minSize);
+    block.memory = std::make_unique<uint8_t[]>(block.size);
+    blocks.push_back(std::move(block));
+}
@@ -0,0 +1,63 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//Hands out memory by moving a pointer forward, and takes it all back at once with Reset.
+//For data that all dies at the same time, like the lists built while recording a frame or loading a model.
+//When a block runs out another one is added, and Reset merges them into one big enough for all of them,
+//so once it has seen the biggest frame it never goes to the heap again
+class LinearArena
+{
+public:
+    explicit LinearArena(size_t newBlockSize = 64 * 1024);
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment);
+    //Everything allocated so far is free again, nothing may still point into it
+    void Reset();
+
+    size_t GetUsedBytes() const {return usedBytes;}
+
+private:
+    struct Block
+    {
+        std::unique_ptr<uint8_t[]> memory;
+        size_t size;
+    };
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t offset; //Into the last block
+    size_t usedBytes;
+
+    void AddBlock(size_t minSize);
+};
+
+//STL allocator on top of an arena, freeing does nothing (the arena's Reset does)
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(LinearArena& newArena) noexcept: arena(&newArena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept: arena(other.arena) {}
+
+    T* allocate(size_t count) {return static_cast<T*>(arena->Allocate(count * sizeof(T),alignof(T)));}
+    void deallocate(T*, size_t) noexcept {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const noexcept {return arena == other.arena;}
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const noexcept {return arena != other.arena;}
+
+    LinearArena* arena;
+};
+
+//Reserve what it will hold up front, growing leaves the old storage unused in the arena until Reset
+template<typename T>
+using ArenaVector = std::vector<T,ArenaAllocator<T>>;
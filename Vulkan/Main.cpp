@@ -1,5 +1,4 @@
 #define STB_IMAGE_IMPLEMENTATION
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <iostream>
@@ -22,7 +21,8 @@ void InitWindow(std::string wName = "Test Window", const int width = 800, const
 	}
 	//Set GLFW to not work with OpenGL
 	glfwWindowHint(GLFW_CLIENT_API,GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	//The renderer recreates its swapchain when the window is resized
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
 	window = glfwCreateWindow(width,height,wName.c_str(),nullptr,nullptr);
 }
@@ -42,7 +42,8 @@ int main()
 	float dt = 0.0f;
 	float lastTime = 0.0f;
 
-	vulkanRenderer.CreateMeshModel("Models/Cat.obj");
+	//Loads in the background, the window is up (and drawing) while it does
+	int catModel = vulkanRenderer.LoadModelAsync("Models/Cat.obj");
 	
 	
 	//Loop until closed
@@ -63,7 +64,7 @@ int main()
 		model = glm::translate(model,glm::vec3(0.0f,0.0f,1.0f));
 		model = glm::rotate(model,glm::radians(angle),glm::vec3(0.0f,0.0f,1.0f));
 
-		vulkanRenderer.UpdateModel(0,model);
+		vulkanRenderer.UpdateModel(catModel,model);
 		vulkanRenderer.Draw();
 	}
 
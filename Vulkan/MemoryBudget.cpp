@@ -0,0 +1,184 @@
+﻿#include "MemoryBudget.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+struct TrackedAllocation
+{
+    uint32_t heap;
+    VkDeviceSize size;
+};
+
+//Shared by the whole process, buffers are created by free functions with no renderer to report to
+static std::mutex allocationMutex;
+static std::unordered_map<VkDeviceMemory,TrackedAllocation> trackedAllocations;
+static VkDeviceSize allocatedBytes[VK_MAX_MEMORY_HEAPS] = {};
+//Heap of every memory type, read once by Init
+static uint32_t memoryTypeHeaps[VK_MAX_MEMORY_TYPES] = {};
+static bool memoryTypesKnown = false;
+
+//Only one thread reclaims at a time, and the handler's own frees don't start another reclaim
+static std::mutex reclaimMutex;
+static std::function<bool(VkDeviceSize)> reclaimHandler;
+static thread_local bool reclaiming = false;
+
+VkResult MemoryBudget::Allocate(VkPhysicalDevice physicalDevice, VkDevice device, const VkMemoryAllocateInfo& allocateInfo,
+    VkDeviceMemory* memory)
+{
+    VkResult result = vkAllocateMemory(device,&allocateInfo,nullptr,memory);
+
+    //Give the renderer a chance to free memory it can do without, but not from inside its own reclaiming
+    if(result == VK_ERROR_OUT_OF_DEVICE_MEMORY && !reclaiming)
+    {
+        std::lock_guard<std::mutex> lock(reclaimMutex);
+        if(reclaimHandler)
+        {
+            reclaiming = true;
+            bool reclaimed = reclaimHandler(allocateInfo.allocationSize);
+            reclaiming = false;
+
+            if(reclaimed)
+                result = vkAllocateMemory(device,&allocateInfo,nullptr,memory);
+        }
+    }
+
+    if(result != VK_SUCCESS)
+        return result;
+
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    uint32_t heap = 0;
+    if(memoryTypesKnown)
+    {
+        heap = memoryTypeHeaps[allocateInfo.memoryTypeIndex];
+    }
+    else
+    {
+        //Allocated before Init, not worth caching
+        VkPhysicalDeviceMemoryProperties memoryProperties{};
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice,&memoryProperties);
+        heap = memoryProperties.memoryTypes[allocateInfo.memoryTypeIndex].heapIndex;
+    }
+    trackedAllocations[*memory] = {heap,allocateInfo.allocationSize};
+    allocatedBytes[heap] += allocateInfo.allocationSize;
+    return result;
+}
+
+void MemoryBudget::Free(VkDevice device, VkDeviceMemory memory)
+{
+    if(memory == VK_NULL_HANDLE)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(allocationMutex);
+        auto allocation = trackedAllocations.find(memory);
+        if(allocation != trackedAllocations.end())
+        {
+            allocatedBytes[allocation->second.heap] -= allocation->second.size;
+            trackedAllocations.erase(allocation);
+        }
+    }
+
+    vkFreeMemory(device,memory,nullptr);
+}
+
+void MemoryBudget::SetReclaimHandler(std::function<bool(VkDeviceSize)> handler)
+{
+    std::lock_guard<std::mutex> lock(reclaimMutex);
+    reclaimHandler = handler;
+}
+
+MemoryBudget::MemoryBudget(): physicalDevice(nullptr), getMemoryProperties2(nullptr), limit(0)
+{
+}
+
+void MemoryBudget::Init(VkInstance instance, VkPhysicalDevice newPhysicalDevice, bool budgetExtensionEnabled)
+{
+    physicalDevice = newPhysicalDevice;
+    getMemoryProperties2 = nullptr;
+    if(budgetExtensionEnabled)
+    {
+        getMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+            vkGetInstanceProcAddr(instance,"vkGetPhysicalDeviceMemoryProperties2KHR"));
+    }
+
+    //Memory types don't change, so Allocate doesn't have to ask every time
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice,&memoryProperties);
+    {
+        std::lock_guard<std::mutex> lock(allocationMutex);
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+        {
+            memoryTypeHeaps[i] = memoryProperties.memoryTypes[i].heapIndex;
+        }
+        memoryTypesKnown = true;
+    }
+
+    Update();
+}
+
+void MemoryBudget::Update()
+{
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    if(getMemoryProperties2)
+    {
+        VkPhysicalDeviceMemoryProperties2KHR memoryProperties2{};
+        memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        memoryProperties2.pNext = &budgetProperties;
+        getMemoryProperties2(physicalDevice,&memoryProperties2);
+        memoryProperties = memoryProperties2.memoryProperties;
+    }
+    else
+    {
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice,&memoryProperties);
+    }
+
+    std::lock_guard<std::mutex> lock(allocationMutex);
+    heaps.resize(memoryProperties.memoryHeapCount);
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+    {
+        Heap& heap = heaps[i];
+        heap.size = memoryProperties.memoryHeaps[i].size;
+        heap.deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        heap.allocated = allocatedBytes[i];
+
+        if(getMemoryProperties2)
+        {
+            heap.usage = budgetProperties.heapUsage[i];
+            heap.budget = budgetProperties.heapBudget[i];
+        }
+        else
+        {
+            //Without the driver's numbers leave room for the driver's own allocations and other applications
+            heap.usage = heap.allocated;
+            heap.budget = heap.size / 10 * 8;
+        }
+
+        if(limit > 0 && heap.deviceLocal)
+            heap.budget = std::min(heap.budget,limit);
+    }
+}
+
+VkDeviceSize MemoryBudget::GetOverBudgetBytes() const
+{
+    VkDeviceSize overBudget = 0;
+    for (const Heap& heap : heaps)
+    {
+        if(heap.deviceLocal && heap.usage > heap.budget)
+            overBudget += heap.usage - heap.budget;
+    }
+    return overBudget;
+}
+
+VkDeviceSize MemoryBudget::GetHeadroomBytes() const
+{
+    VkDeviceSize headroom = 0;
+    for (const Heap& heap : heaps)
+    {
+        if(heap.deviceLocal && heap.usage < heap.budget)
+            headroom += heap.budget - heap.usage;
+    }
+    return headroom;
+}
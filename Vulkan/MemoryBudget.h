@@ -0,0 +1,51 @@
+﻿#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+//How much device memory we use per heap and how much we may use.
+//Every allocation goes through Allocate/Free so our own usage is always known. With VK_EXT_memory_budget the
+//driver's numbers are polled too, they include what the driver allocates for us and shrink when other applications need memory.
+class MemoryBudget
+{
+public:
+    struct Heap
+    {
+        VkDeviceSize size;
+        VkDeviceSize allocated; //By our own allocations
+        VkDeviceSize usage; //What the driver reports for this process, or allocated without the extension
+        VkDeviceSize budget;
+        bool deviceLocal;
+    };
+
+    //When an allocation runs out of device memory the reclaim handler is asked to free some (it gets the size that failed)
+    //and the allocation is tried again if it returns true. Allocations on any thread can call it, one at a time
+    static VkResult Allocate(VkPhysicalDevice physicalDevice, VkDevice device, const VkMemoryAllocateInfo& allocateInfo,
+        VkDeviceMemory* memory);
+    static void Free(VkDevice device, VkDeviceMemory memory);
+    static void SetReclaimHandler(std::function<bool(VkDeviceSize)> handler);
+
+    MemoryBudget();
+
+    //budgetExtensionEnabled when VK_EXT_memory_budget (and VK_KHR_get_physical_device_properties2) are enabled
+    void Init(VkInstance instance, VkPhysicalDevice newPhysicalDevice, bool budgetExtensionEnabled);
+    //Read the current usage and budget of every heap, once a frame is plenty
+    void Update();
+
+    //Most each device local heap may use, 0 for whatever the driver says is available
+    void SetLimit(VkDeviceSize newLimit) {limit = newLimit;}
+
+    const std::vector<Heap>& GetHeaps() const {return heaps;}
+    //Bytes the device local heaps are over their budget in total, what should be given back
+    VkDeviceSize GetOverBudgetBytes() const;
+    //Bytes the device local heaps that aren't over their budget could still take
+    VkDeviceSize GetHeadroomBytes() const;
+
+private:
+    VkPhysicalDevice physicalDevice;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2;
+    VkDeviceSize limit;
+    std::vector<Heap> heaps;
+};
@@ -1,91 +1,250 @@
 ﻿#include "Mesh.h"
 
-Mesh::Mesh(): model(), vertexCount(0), vertexBuffer(nullptr),
-              vertexBufferMemory(nullptr), indexCount(0),
+#include <algorithm>
+#include <utility>
+
+Mesh::Mesh(): model(), texId(0), boundsCenter(0.0f), boundsRadius(0.0f), boundsMin(0.0f), boundsMax(0.0f), positionTransform(1.0f), vertexCount(0), vertexBuffer(nullptr),
+              vertexBufferMemory(nullptr), indexCount(0), indexType(VK_INDEX_TYPE_UINT32),
               indexBuffer(nullptr), indexBufferMemory(nullptr),
-              physicalDevice(nullptr), device(nullptr)
+              meshletCount(0), meshletBuffer(nullptr), meshletBufferMemory(nullptr), meshletDescriptorPool(nullptr),
+              meshletDescriptorSet(nullptr), physicalDevice(nullptr), device(nullptr)
 {
 }
 
 Mesh::Mesh(const VkPhysicalDevice& newPhysicalDevice, const VkDevice& newDevice,VkQueue transferQueue,
-           VkCommandPool transferCommandPool, const std::vector<Vertex>* vertices, const std::vector<uint32_t>* indices, int newTexID):
-    vertexCount(vertices->size()),
+           VkCommandPool transferCommandPool, const std::vector<Vertex>* vertices, const std::vector<uint32_t>* indices, int newTexID,
+           const VertexLayout& layout, StagingBatch* batch):
+    Mesh(newPhysicalDevice,newDevice,transferQueue,transferCommandPool,vertices->data(),vertices->size(),
+        indices->data(),indices->size(),newTexID,layout,batch)
+{
+}
+
+Mesh::Mesh(const VkPhysicalDevice& newPhysicalDevice, const VkDevice& newDevice, VkQueue transferQueue,
+           VkCommandPool transferCommandPool, const Vertex* vertices, size_t newVertexCount, const uint32_t* indices,
+           size_t newIndexCount, int newTexID, const VertexLayout& layout, StagingBatch* batch):
+    vertexCount(static_cast<int>(newVertexCount)),
+    vertexBuffer(nullptr),
+    vertexBufferMemory(nullptr),
+    indexBuffer(nullptr),
+    indexBufferMemory(nullptr),
     physicalDevice(newPhysicalDevice),
     device(newDevice),
-    indexCount(indices->size()),
+    indexCount(newIndexCount),
+    indexType(newVertexCount <= MAX_SHORT_INDEX_VERTICES ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32),
+    meshletCount(0),
+    meshletBuffer(nullptr),
+    meshletBufferMemory(nullptr),
+    meshletDescriptorPool(nullptr),
+    meshletDescriptorSet(nullptr),
     texId(newTexID)
 {
-    CreateVertexBuffer(transferQueue,transferCommandPool,vertices);
-    CreateIndexBuffer(transferQueue,transferCommandPool,indices);
+    CalculateBounds(vertices);
+    try
+    {
+        if(batch)
+        {
+            CreateVertexBuffer(*batch,vertices,layout);
+            CreateIndexBuffer(*batch,indices);
+        }
+        else
+        {
+            StagingBatch ownBatch(physicalDevice,device);
+            CreateVertexBuffer(ownBatch,vertices,layout);
+            CreateIndexBuffer(ownBatch,indices);
+            ownBatch.Submit(transferQueue,transferCommandPool);
+        }
+    }
+    catch (...)
+    {
+        //No mesh is made, so nobody else would destroy the buffer that did get created
+        DestroyBuffers();
+        throw;
+    }
     model.currentModel = glm::mat4(1.0f);
-}
 
+    //Only the full detail level until told otherwise
+    lods.push_back({0,static_cast<uint32_t>(indexCount),0.0f});
+}
 
-void Mesh::CreateVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool,const std::vector<Vertex>* vertices)
+void Mesh::SetLods(const std::vector<MeshLod>& newLods)
 {
-    VkDeviceSize bufferSize = sizeof(Vertex)* vertices->size();
+    for (const MeshLod& lod : newLods)
+    {
+        if(static_cast<size_t>(lod.indexOffset) + lod.indexCount > indexCount)
+            throw std::runtime_error("Mesh LOD is outside of the index buffer!");
+    }
+
+    if(!newLods.empty())
+        lods = newLods;
+}
 
-    //Temporary buffer to "stage" vertex data before transferring to GPU
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+void Mesh::CalculateBounds(const Vertex* vertices)
+{
+    boundsCenter = glm::vec3(0.0f);
+    boundsRadius = 0.0f;
+    boundsMin = glm::vec3(0.0f);
+    boundsMax = glm::vec3(0.0f);
+    if(vertexCount == 0)
+        return;
+
+    //Sphere around the centre of the bounding box (not the tightest sphere, but cheap and good enough)
+    glm::vec3 minPos = vertices[0].pos;
+    glm::vec3 maxPos = vertices[0].pos;
+    for (int i = 0; i < vertexCount; ++i)
+    {
+        minPos = glm::min(minPos,vertices[i].pos);
+        maxPos = glm::max(maxPos,vertices[i].pos);
+    }
+    boundsMin = minPos;
+    boundsMax = maxPos;
+    boundsCenter = (minPos + maxPos) * 0.5f;
+
+    for (int i = 0; i < vertexCount; ++i)
+        boundsRadius = std::max(boundsRadius,glm::length(vertices[i].pos - boundsCenter));
+}
 
-    //Create staging buffer and allocate memory to it
-    CreateBuffer(physicalDevice,device,bufferSize,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &stagingBuffer,&stagingBufferMemory);
 
-    //map memory to vertex buffer
-    void * data;
-    vkMapMemory(device,stagingBufferMemory,0,bufferSize,0,&data);
-    memcpy(data,vertices->data(),static_cast<size_t>(bufferSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+void Mesh::CreateVertexBuffer(StagingBatch& batch, const Vertex* vertices, const VertexLayout& layout)
+{
+    VkDeviceSize bufferSize = static_cast<VkDeviceSize>(GetVertexStride(layout)) * vertexCount;
 
     //Create buffer with Transfer dst bit to mark as recipient of transfer data (also vertex buffer)
     CreateBuffer(physicalDevice, device,bufferSize,VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,&vertexBuffer,&vertexBufferMemory);
 
-    CopyBuffer(device,transferQueue,transferCommandPool,stagingBuffer,vertexBuffer,bufferSize);
-
-    vkFreeMemory(device,stagingBufferMemory,nullptr);
-    vkDestroyBuffer(device,stagingBuffer,nullptr);
-    
+    //Converted to the (usually much smaller) GPU layout on the way into the staging memory
+    positionTransform = PackVertices(layout,vertices,vertexCount,static_cast<uint8_t*>(batch.Allocate(vertexBuffer,bufferSize)));
 }
 
-void Mesh::CreateIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool,
-    const std::vector<uint32_t>* indices)
+void Mesh::CreateIndexBuffer(StagingBatch& batch, const uint32_t* indices)
 {
-    VkDeviceSize bufferSize = sizeof(uint32_t)* indices->size();
-    
-    //Temporary buffer to "stage" index data before transferring to GPU
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    CreateBuffer(physicalDevice,device,bufferSize,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &stagingBuffer,&stagingBufferMemory);
-
-    //map memory to index buffer
-    void * data;
-    vkMapMemory(device,stagingBufferMemory,0,bufferSize,0,&data);
-    memcpy(data,indices->data(),static_cast<size_t>(bufferSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+    VkDeviceSize bufferSize = (indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)) * indexCount;
 
-    //Create buffer with Transfer dst bit to mark as recipient of transfer data (also vertex buffer)
+    //Create buffer with Transfer dst bit to mark as recipient of transfer data (also index buffer)
     CreateBuffer(physicalDevice, device,bufferSize,VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,&indexBuffer,&indexBufferMemory);
 
-    CopyBuffer(device,transferQueue,transferCommandPool,stagingBuffer,indexBuffer,bufferSize);
+    if(indexType == VK_INDEX_TYPE_UINT16)
+    {
+        //Narrowed on the way into the staging memory, every index is below MAX_SHORT_INDEX_VERTICES
+        uint16_t* shortIndices = static_cast<uint16_t*>(batch.Allocate(indexBuffer,bufferSize));
+        for (size_t i = 0; i < indexCount; ++i)
+            shortIndices[i] = static_cast<uint16_t>(indices[i]);
+    }
+    else
+    {
+        batch.Add(indexBuffer,indices,bufferSize);
+    }
+}
+
+void Mesh::SetMeshlets(VkQueue transferQueue, VkCommandPool transferCommandPool, const Meshlet* meshlets, size_t newMeshletCount,
+    StagingBatch* batch)
+{
+    if(newMeshletCount == 0)
+        return;
+
+    for (size_t i = 0; i < newMeshletCount; ++i)
+    {
+        if(static_cast<size_t>(meshlets[i].indexOffset) + meshlets[i].indexCount > lods[0].indexCount)
+            throw std::runtime_error("Meshlet is outside of the mesh's indices!");
+    }
+
+    meshletCount = static_cast<uint32_t>(newMeshletCount);
+    VkDeviceSize bufferSize = sizeof(Meshlet) * newMeshletCount;
+
+    //Same staging as the vertex data, only read by the culling shader
+    CreateBuffer(physicalDevice, device,bufferSize,VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,&meshletBuffer,&meshletBufferMemory);
+
+    if(batch)
+    {
+        batch->Add(meshletBuffer,meshlets,bufferSize);
+    }
+    else
+    {
+        StagingBatch ownBatch(physicalDevice,device);
+        ownBatch.Add(meshletBuffer,meshlets,bufferSize);
+        ownBatch.Submit(transferQueue,transferCommandPool);
+    }
+}
 
-    vkFreeMemory(device,stagingBufferMemory,nullptr);
-    vkDestroyBuffer(device,stagingBuffer,nullptr);
+Mesh::Mesh(Mesh&& other) noexcept: model(other.model), texId(other.texId), boundsCenter(other.boundsCenter),
+    boundsRadius(other.boundsRadius), boundsMin(other.boundsMin), boundsMax(other.boundsMax), positionTransform(other.positionTransform),
+    lods(std::move(other.lods)), vertexCount(std::exchange(other.vertexCount,0)),
+    vertexBuffer(std::exchange(other.vertexBuffer,nullptr)), vertexBufferMemory(std::exchange(other.vertexBufferMemory,nullptr)),
+    indexCount(std::exchange(other.indexCount,0)), indexType(other.indexType),
+    indexBuffer(std::exchange(other.indexBuffer,nullptr)), indexBufferMemory(std::exchange(other.indexBufferMemory,nullptr)),
+    meshletCount(std::exchange(other.meshletCount,0)), meshletBuffer(std::exchange(other.meshletBuffer,nullptr)),
+    meshletBufferMemory(std::exchange(other.meshletBufferMemory,nullptr)), meshletDescriptorPool(std::exchange(other.meshletDescriptorPool,nullptr)),
+    meshletDescriptorSet(std::exchange(other.meshletDescriptorSet,nullptr)), physicalDevice(other.physicalDevice), device(other.device)
+{
+}
+
+Mesh& Mesh::operator=(Mesh&& other) noexcept
+{
+    if(this == &other)
+        return *this;
+
+    //Whatever this one still owned goes first
+    DestroyBuffers();
+
+    model = other.model;
+    texId = other.texId;
+    boundsCenter = other.boundsCenter;
+    boundsRadius = other.boundsRadius;
+    boundsMin = other.boundsMin;
+    boundsMax = other.boundsMax;
+    positionTransform = other.positionTransform;
+    lods = std::move(other.lods);
+    vertexCount = std::exchange(other.vertexCount,0);
+    vertexBuffer = std::exchange(other.vertexBuffer,nullptr);
+    vertexBufferMemory = std::exchange(other.vertexBufferMemory,nullptr);
+    indexCount = std::exchange(other.indexCount,0);
+    indexType = other.indexType;
+    indexBuffer = std::exchange(other.indexBuffer,nullptr);
+    indexBufferMemory = std::exchange(other.indexBufferMemory,nullptr);
+    meshletCount = std::exchange(other.meshletCount,0);
+    meshletBuffer = std::exchange(other.meshletBuffer,nullptr);
+    meshletBufferMemory = std::exchange(other.meshletBufferMemory,nullptr);
+    meshletDescriptorPool = std::exchange(other.meshletDescriptorPool,nullptr);
+    meshletDescriptorSet = std::exchange(other.meshletDescriptorSet,nullptr);
+    physicalDevice = other.physicalDevice;
+    device = other.device;
+    return *this;
+}
+
+void Mesh::SetMeshletDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSet descriptorSet)
+{
+    meshletDescriptorPool = descriptorPool;
+    meshletDescriptorSet = descriptorSet;
 }
 
 void Mesh::DestroyBuffers()
 {
-    vkFreeMemory(device,vertexBufferMemory,nullptr);
+    //Default constructed, nothing was ever created
+    if(!device)
+        return;
+
+    if(meshletDescriptorSet)
+        vkFreeDescriptorSets(device,meshletDescriptorPool,1,&meshletDescriptorSet);
+
+    MemoryBudget::Free(device,vertexBufferMemory);
     vkDestroyBuffer(device,vertexBuffer,nullptr);
 
-    vkFreeMemory(device,indexBufferMemory,nullptr);
+    MemoryBudget::Free(device,indexBufferMemory);
     vkDestroyBuffer(device,indexBuffer,nullptr);
+
+    MemoryBudget::Free(device,meshletBufferMemory);
+    vkDestroyBuffer(device,meshletBuffer,nullptr);
+
+    vertexBuffer = nullptr;
+    vertexBufferMemory = nullptr;
+    indexBuffer = nullptr;
+    indexBufferMemory = nullptr;
+    meshletBuffer = nullptr;
+    meshletBufferMemory = nullptr;
+    meshletDescriptorPool = nullptr;
+    meshletDescriptorSet = nullptr;
 }
 
 Mesh::~Mesh()
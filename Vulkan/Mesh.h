@@ -3,19 +3,61 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vector>
+#include "StagingBatch.h"
 #include "Utilities.h"
+#include "VertexLayout.h"
 
 struct Model
 {
     glm::mat4 currentModel;
 };
 
+//Range of the index buffer drawing the mesh at one level of detail
+struct MeshLod
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error; //How far the surface is from the full detail one at most, in model units
+};
+
+//Small cluster of LOD 0 triangles that is culled on its own, laid out to match the culling shader (std430)
+struct Meshlet
+{
+    glm::vec4 sphere; //Bounding sphere in model space, xyz centre and w radius
+    glm::vec4 cone; //Normal cone, xyz average normal and w sine of the spread (1 when it can't be back face culled)
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    uint32_t padding[2];
+};
+
+//CPU side geometry of a single mesh, before it is uploaded
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices; //All LODs one after the other, LOD 0 first
+    uint32_t materialIndex;
+    uint32_t node; //Scene graph node the mesh hangs from
+    std::vector<MeshLod> lods;
+    std::vector<Meshlet> meshlets;
+};
+
 class Mesh
 {
 public:
     Mesh();
+    //With a batch the buffers are only filled once the batch is submitted, otherwise the upload happens here
     Mesh(const VkPhysicalDevice& newPhysicalDevice,const VkDevice& newDevice,VkQueue transferQueue,
-        VkCommandPool transferCommandPool,const std::vector<Vertex>* vertices, const std::vector<uint32_t>* indices, int newTexID);
+        VkCommandPool transferCommandPool,const std::vector<Vertex>* vertices, const std::vector<uint32_t>* indices, int newTexID,
+        const VertexLayout& layout = DEFAULT_VERTEX_LAYOUT, StagingBatch* batch = nullptr);
+    //Geometry given as plain arrays, so it can be read straight out of a memory mapped file
+    Mesh(const VkPhysicalDevice& newPhysicalDevice,const VkDevice& newDevice,VkQueue transferQueue,
+        VkCommandPool transferCommandPool,const Vertex* vertices, size_t newVertexCount, const uint32_t* indices, size_t newIndexCount, int newTexID,
+        const VertexLayout& layout = DEFAULT_VERTEX_LAYOUT, StagingBatch* batch = nullptr);
+    //Owns its buffers (until DestroyBuffers), so only one mesh may hold them, moving leaves the old one empty
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    Mesh(Mesh&& other) noexcept;
+    Mesh& operator=(Mesh&& other) noexcept;
 
     void SetModel(glm::mat4 _model) {model.currentModel = _model;}
     glm::mat4 GetModel() const { return model.currentModel;} 
@@ -27,10 +69,37 @@ public:
 
     int GetIndicesCount() const{return indexCount;}
     VkBuffer GetIndexBuffer() const{return indexBuffer;}
+    //16 bit when every vertex can be addressed with it, which halves the index buffer
+    VkIndexType GetIndexType() const{return indexType;}
 
     int GetTexId() const { return texId;}
     void SetTexId(int texId) { this->texId = texId;}
 
+    //Bounding sphere of the vertices in model space
+    glm::vec3 GetBoundsCenter() const {return boundsCenter;}
+    float GetBoundsRadius() const {return boundsRadius;}
+    //Bounding box of the vertices in model space
+    glm::vec3 GetBoundsMin() const {return boundsMin;}
+    glm::vec3 GetBoundsMax() const {return boundsMax;}
+
+    //LOD 0 is the full mesh, higher levels have fewer triangles and a bigger error
+    void SetLods(const std::vector<MeshLod>& newLods);
+    size_t GetLodCount() const {return lods.size();}
+    const MeshLod& GetLod(size_t index) const {return lods[index];}
+
+    //Clusters of LOD 0 for GPU culling, uploaded to a storage buffer the culling shader reads.
+    //A plain array like the geometry, so a memory mapped file can be read straight into the staging memory
+    void SetMeshlets(VkQueue transferQueue, VkCommandPool transferCommandPool, const Meshlet* meshlets, size_t newMeshletCount,
+        StagingBatch* batch = nullptr);
+    uint32_t GetMeshletCount() const {return meshletCount;}
+    VkBuffer GetMeshletBuffer() const {return meshletBuffer;}
+    VkDescriptorSet GetMeshletDescriptorSet() const {return meshletDescriptorSet;}
+    //Freed back to its pool (created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT) by DestroyBuffers
+    void SetMeshletDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSet descriptorSet);
+
+    //Takes the positions as stored in the vertex buffer to model space (undoes the quantisation)
+    const glm::mat4& GetPositionTransform() const {return positionTransform;}
+
     ~Mesh();
 
 
@@ -39,18 +108,35 @@ private:
 
     int texId;
 
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    glm::mat4 positionTransform;
+
+    std::vector<MeshLod> lods;
+
 private:
     int vertexCount;
     VkBuffer vertexBuffer;
     VkDeviceMemory vertexBufferMemory;
 
     size_t indexCount;
+    VkIndexType indexType;
     VkBuffer indexBuffer;
     VkDeviceMemory indexBufferMemory;
+
+    uint32_t meshletCount;
+    VkBuffer meshletBuffer;
+    VkDeviceMemory meshletBufferMemory;
+    VkDescriptorPool meshletDescriptorPool;
+    VkDescriptorSet meshletDescriptorSet;
     
     VkPhysicalDevice physicalDevice;
     VkDevice device;
 
-    void CreateVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool,const std::vector<Vertex>* vertices);
-    void CreateIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool,const std::vector<uint32_t>* indices);
+    void CalculateBounds(const Vertex* vertices);
+    void CreateVertexBuffer(StagingBatch& batch, const Vertex* vertices, const VertexLayout& layout);
+    void CreateIndexBuffer(StagingBatch& batch, const uint32_t* indices);
 };
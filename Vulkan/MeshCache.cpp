@@ -0,0 +1,384 @@
+﻿#include "MeshCache.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "TextureCache.h"
+
+//Bump whenever the layout of the file or of Vertex, or how meshes are processed, changes so old caches get rebuilt
+const uint32_t MESH_CACHE_VERSION = 6;
+const char MESH_CACHE_MAGIC[4] = {'V','K','M','C'};
+
+//Sections start on 16 byte boundaries so the mapped arrays are properly aligned
+static uint64_t AlignOffset(uint64_t offset)
+{
+    return (offset + 15) & ~uint64_t(15);
+}
+
+MeshCache::MeshCache(): mappedData(nullptr), mappedSize(0), fileHandle(nullptr), mappingHandle(nullptr)
+{
+}
+
+bool MeshCache::Open(const std::string& modelFile)
+{
+    Close();
+
+    if(!Map(GetCacheFile(modelFile)))
+        return false;
+
+    if(!IsValid(modelFile))
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::Map(const std::string& cacheFile)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(cacheFile.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+    fileHandle = file;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file,&size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header)))
+        return false;
+    mappedSize = static_cast<size_t>(size.QuadPart);
+
+    HANDLE mapping = CreateFileMappingA(file,nullptr,PAGE_READONLY,0,0,nullptr);
+    if(!mapping)
+        return false;
+    mappingHandle = mapping;
+
+    mappedData = static_cast<const uint8_t*>(MapViewOfFile(mapping,FILE_MAP_READ,0,0,0));
+    return mappedData != nullptr;
+#else
+    int file = open(cacheFile.c_str(),O_RDONLY);
+    if(file < 0)
+        return false;
+
+    struct stat fileInfo;
+    if(fstat(file,&fileInfo) != 0 || fileInfo.st_size < static_cast<off_t>(sizeof(Header)))
+    {
+        close(file);
+        return false;
+    }
+    mappedSize = static_cast<size_t>(fileInfo.st_size);
+
+    //The mapping stays valid after the descriptor is closed
+    void* data = mmap(nullptr,mappedSize,PROT_READ,MAP_PRIVATE,file,0);
+    close(file);
+    if(data == MAP_FAILED)
+        return false;
+
+    mappedData = static_cast<const uint8_t*>(data);
+    return true;
+#endif
+}
+
+void MeshCache::Close()
+{
+#ifdef _WIN32
+    if(mappedData)
+        UnmapViewOfFile(mappedData);
+    if(mappingHandle)
+        CloseHandle(mappingHandle);
+    if(fileHandle)
+        CloseHandle(fileHandle);
+#else
+    if(mappedData)
+        munmap(const_cast<uint8_t*>(mappedData),mappedSize);
+#endif
+    mappedData = nullptr;
+    mappedSize = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+bool MeshCache::IsValid(const std::string& modelFile) const
+{
+    const Header* header = GetHeader();
+    if(memcmp(header->magic,MESH_CACHE_MAGIC,sizeof(MESH_CACHE_MAGIC)) != 0 || header->version != MESH_CACHE_VERSION ||
+       header->vertexSize != sizeof(Vertex) || header->fileSize != mappedSize)
+        return false;
+
+    //Every section has to be inside the file (a cut off write must not be read past its end)
+    if(header->materialsOffset > mappedSize || header->nodeNamesOffset > mappedSize ||
+       header->nodesOffset + header->nodeCount * sizeof(Node) > mappedSize ||
+       header->rangesOffset + header->meshCount * sizeof(MeshRange) > mappedSize ||
+       header->lodsOffset + header->lodCount * sizeof(MeshLod) > mappedSize ||
+       header->meshletsOffset + header->meshletCount * sizeof(Meshlet) > mappedSize ||
+       header->verticesOffset + header->vertexCount * sizeof(Vertex) > mappedSize ||
+       header->indicesOffset + header->indexCount * sizeof(uint32_t) > mappedSize)
+        return false;
+
+    for (uint32_t i = 0; i < header->meshCount; ++i)
+    {
+        const MeshRange& range = GetMeshRange(i);
+        if(uint64_t(range.vertexOffset) + range.vertexCount > header->vertexCount ||
+           uint64_t(range.indexOffset) + range.indexCount > header->indexCount || range.materialIndex >= header->materialCount ||
+           uint64_t(range.lodOffset) + range.lodCount > header->lodCount ||
+           uint64_t(range.meshletOffset) + range.meshletCount > header->meshletCount || range.node >= header->nodeCount)
+            return false;
+    }
+
+    //Parents have to come before their children
+    const Node* nodes = reinterpret_cast<const Node*>(mappedData + header->nodesOffset);
+    for (uint32_t i = 0; i < header->nodeCount; ++i)
+    {
+        if(nodes[i].parent != SceneGraph::NO_NODE && nodes[i].parent >= i)
+            return false;
+    }
+
+    int64_t sourceTime;
+    uint64_t sourceSize;
+    if(!GetSourceInfo(modelFile,sourceTime,sourceSize) || sourceSize != header->sourceSize)
+        return false;
+
+    if(sourceTime == header->sourceTime)
+        return true;
+
+    //Touched but maybe not changed (e.g. checked out again), compare the contents before throwing the cache away
+    std::vector<char> source = ReadFile(modelFile);
+    return TextureCache::HashContent(source) == header->sourceHash;
+}
+
+bool MeshCache::Write(const std::string& modelFile, const std::vector<std::string>& textureNames, const SceneGraph& sceneGraph,
+    const std::vector<MeshData>& meshes)
+{
+    Header header{};
+    memcpy(header.magic,MESH_CACHE_MAGIC,sizeof(MESH_CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+
+    if(!GetSourceInfo(modelFile,header.sourceTime,header.sourceSize))
+        return false;
+    header.sourceHash = TextureCache::HashContent(ReadFile(modelFile));
+
+    //Lay out the mesh ranges in one shared vertex and index array
+    std::vector<MeshRange> ranges(meshes.size());
+    std::vector<MeshLod> lods;
+    std::vector<Meshlet> meshlets;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        ranges[i].vertexOffset = static_cast<uint32_t>(header.vertexCount);
+        ranges[i].vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+        ranges[i].indexOffset = static_cast<uint32_t>(header.indexCount);
+        ranges[i].indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+        ranges[i].materialIndex = meshes[i].materialIndex;
+        ranges[i].lodOffset = static_cast<uint32_t>(lods.size());
+        ranges[i].lodCount = static_cast<uint32_t>(meshes[i].lods.size());
+        lods.insert(lods.end(),meshes[i].lods.begin(),meshes[i].lods.end());
+        ranges[i].meshletOffset = static_cast<uint32_t>(meshlets.size());
+        ranges[i].meshletCount = static_cast<uint32_t>(meshes[i].meshlets.size());
+        ranges[i].node = meshes[i].node;
+        meshlets.insert(meshlets.end(),meshes[i].meshlets.begin(),meshes[i].meshlets.end());
+        header.vertexCount += meshes[i].vertices.size();
+        header.indexCount += meshes[i].indices.size();
+    }
+    header.materialCount = static_cast<uint32_t>(textureNames.size());
+    header.meshCount = static_cast<uint32_t>(meshes.size());
+    header.nodeCount = sceneGraph.GetNodeCount();
+    header.lodCount = lods.size();
+    header.meshletCount = meshlets.size();
+
+    //Texture and node names are stored as a length followed by the characters
+    auto appendName = [](std::vector<char>& names, const std::string& name)
+    {
+        uint32_t length = static_cast<uint32_t>(name.size());
+        names.insert(names.end(),reinterpret_cast<const char*>(&length),reinterpret_cast<const char*>(&length)+sizeof(length));
+        names.insert(names.end(),name.begin(),name.end());
+    };
+
+    std::vector<char> materials;
+    for (const std::string& name : textureNames)
+        appendName(materials,name);
+
+    std::vector<char> nodeNames;
+    std::vector<Node> nodes(sceneGraph.GetNodeCount());
+    for (uint32_t i = 0; i < sceneGraph.GetNodeCount(); ++i)
+    {
+        nodes[i].localTransform = sceneGraph.GetLocalTransform(i);
+        nodes[i].parent = sceneGraph.GetParent(i);
+        appendName(nodeNames,sceneGraph.GetName(i));
+    }
+
+    header.materialsOffset = AlignOffset(sizeof(Header));
+    header.nodeNamesOffset = AlignOffset(header.materialsOffset + materials.size());
+    header.nodesOffset = AlignOffset(header.nodeNamesOffset + nodeNames.size());
+    header.rangesOffset = AlignOffset(header.nodesOffset + nodes.size() * sizeof(Node));
+    header.lodsOffset = AlignOffset(header.rangesOffset + ranges.size() * sizeof(MeshRange));
+    header.meshletsOffset = AlignOffset(header.lodsOffset + lods.size() * sizeof(MeshLod));
+    header.verticesOffset = AlignOffset(header.meshletsOffset + meshlets.size() * sizeof(Meshlet));
+    header.indicesOffset = AlignOffset(header.verticesOffset + header.vertexCount * sizeof(Vertex));
+    header.fileSize = header.indicesOffset + header.indexCount * sizeof(uint32_t);
+
+    //Write to a temporary file and swap it in, so a crash halfway never leaves a broken cache behind.
+    //Every writer gets its own, two imports of the same file (in this process or another) would mix their data otherwise
+    static std::atomic<uint32_t> nextWriter{0};
+#ifdef _WIN32
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+    std::string cacheFile = GetCacheFile(modelFile);
+    std::string tempFile = cacheFile + "." + std::to_string(processId) + "." + std::to_string(nextWriter++) + ".tmp";
+    {
+        std::ofstream file(tempFile,std::ios::binary | std::ios::trunc);
+        if(!file.is_open())
+            return false;
+
+        auto writeAt = [&file](uint64_t offset, const void* data, size_t size)
+        {
+            //Pad up to the section start
+            static const char zeros[16] = {};
+            file.write(zeros,static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+            file.write(static_cast<const char*>(data),static_cast<std::streamsize>(size));
+        };
+
+        file.write(reinterpret_cast<const char*>(&header),sizeof(header));
+        writeAt(header.materialsOffset,materials.data(),materials.size());
+        writeAt(header.nodeNamesOffset,nodeNames.data(),nodeNames.size());
+        writeAt(header.nodesOffset,nodes.data(),nodes.size() * sizeof(Node));
+        writeAt(header.rangesOffset,ranges.data(),ranges.size() * sizeof(MeshRange));
+        writeAt(header.lodsOffset,lods.data(),lods.size() * sizeof(MeshLod));
+        writeAt(header.meshletsOffset,meshlets.data(),meshlets.size() * sizeof(Meshlet));
+
+        writeAt(header.verticesOffset,nullptr,0);
+        for (const MeshData& mesh : meshes)
+            file.write(reinterpret_cast<const char*>(mesh.vertices.data()),static_cast<std::streamsize>(mesh.vertices.size() * sizeof(Vertex)));
+
+        writeAt(header.indicesOffset,nullptr,0);
+        for (const MeshData& mesh : meshes)
+            file.write(reinterpret_cast<const char*>(mesh.indices.data()),static_cast<std::streamsize>(mesh.indices.size() * sizeof(uint32_t)));
+
+        if(!file.good())
+        {
+            file.close();
+            std::error_code error;
+            std::filesystem::remove(tempFile,error);
+            return false;
+        }
+    }
+
+    //Whichever writer renames last wins, both wrote the same data
+    std::error_code error;
+    std::filesystem::rename(tempFile,cacheFile,error);
+    if(error)
+    {
+        std::filesystem::remove(tempFile,error);
+        return false;
+    }
+    return true;
+}
+
+std::string MeshCache::GetCacheFile(const std::string& modelFile)
+{
+    return modelFile + ".meshcache";
+}
+
+std::vector<std::string> MeshCache::GetTextureNames() const
+{
+    const Header* header = GetHeader();
+    return ReadNames(header->materialsOffset,header->nodeNamesOffset,header->materialCount);
+}
+
+SceneGraph MeshCache::GetSceneGraph() const
+{
+    const Header* header = GetHeader();
+    std::vector<std::string> names = ReadNames(header->nodeNamesOffset,header->nodesOffset,header->nodeCount);
+    const Node* nodes = reinterpret_cast<const Node*>(mappedData + header->nodesOffset);
+
+    //Stored in scene graph order, so adding them back one by one gives the same indices
+    SceneGraph sceneGraph;
+    for (uint32_t i = 0; i < header->nodeCount; ++i)
+        sceneGraph.AddNode(nodes[i].parent,nodes[i].localTransform,names[i]);
+    return sceneGraph;
+}
+
+std::vector<std::string> MeshCache::ReadNames(uint64_t offset, uint64_t endOffset, uint32_t count) const
+{
+    std::vector<std::string> names(count);
+
+    const uint8_t* data = mappedData + offset;
+    const uint8_t* end = mappedData + endOffset;
+    for (std::string& name : names)
+    {
+        uint32_t length;
+        if(data + sizeof(length) > end)
+            throw std::runtime_error("Mesh cache name list is corrupted!");
+        memcpy(&length,data,sizeof(length));
+        data += sizeof(length);
+
+        if(data + length > end)
+            throw std::runtime_error("Mesh cache name list is corrupted!");
+        name.assign(reinterpret_cast<const char*>(data),length);
+        data += length;
+    }
+    return names;
+}
+
+uint32_t MeshCache::GetMeshCount() const
+{
+    return GetHeader()->meshCount;
+}
+
+const MeshCache::MeshRange& MeshCache::GetMeshRange(uint32_t index) const
+{
+    return reinterpret_cast<const MeshRange*>(mappedData + GetHeader()->rangesOffset)[index];
+}
+
+std::vector<MeshLod> MeshCache::GetMeshLods(uint32_t index) const
+{
+    const MeshRange& range = GetMeshRange(index);
+    const MeshLod* lods = reinterpret_cast<const MeshLod*>(mappedData + GetHeader()->lodsOffset) + range.lodOffset;
+    return std::vector<MeshLod>(lods,lods + range.lodCount);
+}
+
+const Meshlet* MeshCache::GetMeshlets(uint32_t index) const
+{
+    const MeshRange& range = GetMeshRange(index);
+    return reinterpret_cast<const Meshlet*>(mappedData + GetHeader()->meshletsOffset) + range.meshletOffset;
+}
+
+const Vertex* MeshCache::GetVertices() const
+{
+    return reinterpret_cast<const Vertex*>(mappedData + GetHeader()->verticesOffset);
+}
+
+const uint32_t* MeshCache::GetIndices() const
+{
+    return reinterpret_cast<const uint32_t*>(mappedData + GetHeader()->indicesOffset);
+}
+
+bool MeshCache::GetSourceInfo(const std::string& modelFile, int64_t& time, uint64_t& size)
+{
+    std::error_code error;
+    size = std::filesystem::file_size(modelFile,error);
+    if(error)
+        return false;
+
+    time = static_cast<int64_t>(std::filesystem::last_write_time(modelFile,error).time_since_epoch().count());
+    return !error;
+}
+
+MeshCache::~MeshCache()
+{
+    Close();
+}
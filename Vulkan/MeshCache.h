@@ -0,0 +1,108 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+#include "SceneGraph.h"
+
+//Binary copy of what we get out of Assimp for a model file, written next to it as <model>.meshcache.
+//It is checked against the model's size and modification time (and content hash if those changed)
+//and then memory mapped, so the vertices, indices and meshlets are read from the file straight into the mapped staging
+//memory (vertices packed and indices narrowed on the way), without another copy in between.
+class MeshCache
+{
+public:
+    //Where each mesh lives in the shared vertex/index arrays
+    struct MeshRange
+    {
+        uint32_t vertexOffset;
+        uint32_t vertexCount;
+        uint32_t indexOffset;
+        uint32_t indexCount;
+        uint32_t materialIndex;
+        uint32_t lodOffset;
+        uint32_t lodCount;
+        uint32_t meshletOffset;
+        uint32_t meshletCount;
+        uint32_t node;
+    };
+
+    MeshCache();
+
+    //Map the cache of a model file, returns false if there is none or it is out of date
+    bool Open(const std::string& modelFile);
+    void Close();
+
+    //Write the cache of a model file, returns false if it couldn't be written (loading still works, just slower)
+    static bool Write(const std::string& modelFile, const std::vector<std::string>& textureNames, const SceneGraph& sceneGraph,
+        const std::vector<MeshData>& meshes);
+    static std::string GetCacheFile(const std::string& modelFile);
+
+    std::vector<std::string> GetTextureNames() const;
+    SceneGraph GetSceneGraph() const;
+    uint32_t GetMeshCount() const;
+    const MeshRange& GetMeshRange(uint32_t index) const;
+    //LOD index offsets are relative to the mesh's own indices
+    std::vector<MeshLod> GetMeshLods(uint32_t index) const;
+    //GetMeshRange(index).meshletCount of them
+    const Meshlet* GetMeshlets(uint32_t index) const;
+    const Vertex* GetVertices() const;
+    const uint32_t* GetIndices() const;
+
+    ~MeshCache();
+
+private:
+    struct Node
+    {
+        glm::mat4 localTransform;
+        uint32_t parent;
+        uint32_t padding[3];
+    };
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t vertexSize;
+        uint32_t padding;
+
+        //Model file the cache was made from
+        int64_t sourceTime;
+        uint64_t sourceSize;
+        uint64_t sourceHash;
+
+        uint32_t materialCount;
+        uint32_t meshCount;
+        uint32_t nodeCount;
+        uint32_t padding2;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint64_t lodCount;
+        uint64_t meshletCount;
+
+        //Byte offsets of each section from the start of the file
+        uint64_t materialsOffset;
+        uint64_t nodeNamesOffset;
+        uint64_t nodesOffset;
+        uint64_t rangesOffset;
+        uint64_t lodsOffset;
+        uint64_t meshletsOffset;
+        uint64_t verticesOffset;
+        uint64_t indicesOffset;
+        uint64_t fileSize;
+    };
+
+    const uint8_t* mappedData;
+    size_t mappedSize;
+    void* fileHandle;
+    void* mappingHandle;
+
+    const Header* GetHeader() const {return reinterpret_cast<const Header*>(mappedData);}
+    bool Map(const std::string& cacheFile);
+    bool IsValid(const std::string& modelFile) const;
+    //Length prefixed strings between two offsets
+    std::vector<std::string> ReadNames(uint64_t offset, uint64_t endOffset, uint32_t count) const;
+
+    static bool GetSourceInfo(const std::string& modelFile, int64_t& time, uint64_t& size);
+};
@@ -1,14 +1,34 @@
 ﻿#include "MeshModel.h"
 #include "Mesh.h"
 
-MeshModel::MeshModel(): model()
+MeshModel::MeshModel(): model(), modelChanged(true)
 {
 }
 
-MeshModel::MeshModel(std::vector<Mesh> newMeshList): meshList(newMeshList), model(glm::mat4(1.0f))
+MeshModel::MeshModel(std::vector<Mesh> newMeshList): meshList(std::move(newMeshList)), model(glm::mat4(1.0f)), modelChanged(true),
+    meshNodes(meshList.size(),0), meshTransforms(meshList.size(),glm::mat4(1.0f))
 {
+    sceneGraph.AddNode(SceneGraph::NO_NODE,glm::mat4(1.0f));
 }
 
+MeshModel::MeshModel(std::vector<Mesh> newMeshList, const SceneGraph& newSceneGraph, const std::vector<uint32_t>& newMeshNodes):
+    meshList(std::move(newMeshList)), model(glm::mat4(1.0f)), modelChanged(true), sceneGraph(newSceneGraph), meshNodes(newMeshNodes),
+    meshTransforms(meshList.size(),glm::mat4(1.0f))
+{
+    if(meshNodes.size() != meshList.size())
+        throw std::runtime_error("Every mesh of a model needs a scene node!");
+
+    for (uint32_t node : meshNodes)
+    {
+        if(node >= sceneGraph.GetNodeCount())
+            throw std::runtime_error("Mesh attached to an invalid scene node!");
+    }
+}
+
+MeshModel::MeshModel(MeshModel&& other) = default;
+
+MeshModel& MeshModel::operator=(MeshModel&& other) = default;
+
 Mesh* MeshModel::GetMesh(size_t index)
 {
     if(index >= meshList.size())
@@ -17,11 +37,29 @@ Mesh* MeshModel::GetMesh(size_t index)
     return &meshList[index];
 }
 
+void MeshModel::UpdateTransforms()
+{
+    bool graphChanged = sceneGraph.UpdateWorldTransforms();
+    if(!graphChanged && !modelChanged)
+        return;
+
+    //Meshes whose node didn't move keep their transform unless the whole model moved
+    for (size_t i = 0; i < meshNodes.size(); ++i)
+    {
+        if(modelChanged || sceneGraph.WasUpdated(meshNodes[i]))
+            meshTransforms[i] = model * sceneGraph.GetWorldTransform(meshNodes[i]);
+    }
+    modelChanged = false;
+}
+
 
 void MeshModel::DestroyMeshModel()
 {
     for(Mesh& mesh: meshList)
         mesh.DestroyBuffers();
+    meshList.clear();
+    meshNodes.clear();
+    meshTransforms.clear();
 }
 
 MeshModel::~MeshModel()
@@ -53,31 +91,38 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
     return textureList;
 }
 
-std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue,
-    VkCommandPool transferCommandPool, aiNode* node, const aiScene* scene, const std::vector<int>& matToTex)
+void MeshModel::LoadNode(aiNode* node, const aiScene* scene, uint32_t parent, SceneGraph& sceneGraph, ArenaVector<aiMesh*>& meshes,
+    ArenaVector<uint32_t>& meshNodes)
 {
-    std::vector<Mesh> meshList;
+    //Assimp matrices are row major, glm's are column major
+    const aiMatrix4x4& transformation = node->mTransformation;
+    glm::mat4 localTransform;
+    for (int row = 0; row < 4; ++row)
+    {
+        for (int column = 0; column < 4; ++column)
+            localTransform[column][row] = transformation[row][column];
+    }
+
+    //Added before its children so parents always come first
+    uint32_t nodeIndex = sceneGraph.AddNode(parent,localTransform,node->mName.C_Str());
+
     for (size_t i = 0; i < node->mNumMeshes; ++i)
     {
-        meshList.push_back(LoadMesh(newPhysicalDevice,newDevice,transferQueue,transferCommandPool,
-        scene->mMeshes[node->mMeshes[i]],scene,matToTex));
+        meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+        meshNodes.push_back(nodeIndex);
     }
 
     for (size_t i = 0; i < node->mNumChildren; ++i)
     {
-        std::vector<Mesh> newList = LoadNode(newPhysicalDevice,newDevice,transferQueue,transferCommandPool,
-            node->mChildren[i],scene,matToTex);
-        meshList.insert(meshList.end(),newList.begin(),newList.end());
+        LoadNode(node->mChildren[i],scene,nodeIndex,sceneGraph,meshes,meshNodes);
     }
-
-    return meshList;
 }
 
-Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue,
-    VkCommandPool transferCommandPool, aiMesh* mesh, const aiScene* scene, const std::vector<int>& matToTex)
+MeshData MeshModel::LoadMesh(const aiMesh* mesh)
 {
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
+    MeshData meshData{};
+    std::vector<Vertex>& vertices = meshData.vertices;
+    std::vector<uint32_t>& indices = meshData.indices;
 
     vertices.resize(mesh->mNumVertices);
 
@@ -97,16 +142,18 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
         vertices[i].col = {1.0f,1.0f,1.0f};    
     }
 
+    //Triangulated on import, so three indices a face
+    indices.reserve(static_cast<size_t>(mesh->mNumFaces) * 3);
     for (size_t i = 0; i < mesh->mNumFaces; ++i)
     {
-        aiFace face = mesh->mFaces[i];
+        const aiFace& face = mesh->mFaces[i];
         for (size_t j = 0; j < face.mNumIndices; ++j)
         {
             indices.push_back(face.mIndices[j]);
         }
     }
 
-    Mesh newMesh = Mesh(newPhysicalDevice,newDevice,transferQueue,transferCommandPool,&vertices,&indices,matToTex[mesh->mMaterialIndex]);
+    meshData.materialIndex = mesh->mMaterialIndex;
 
-    return newMesh;
+    return meshData;
 }
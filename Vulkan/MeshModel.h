@@ -1,31 +1,63 @@
 ﻿#pragma once
 #include <string>
+#include <utility>
 #include <vector>
 #include <assimp/scene.h>
 #include <glm/glm.hpp>
 #include <vulkan/vulkan_core.h>
 
+#include "LinearArena.h"
+#include "SceneGraph.h"
+
 class Mesh;
+struct MeshData;
 
 class MeshModel
 {
 public:
 
     MeshModel();
+    //Every mesh placed at the model origin
     MeshModel(std::vector<Mesh> newMeshList);
+    //Each mesh hangs from its node in the scene graph
+    MeshModel(std::vector<Mesh> newMeshList, const SceneGraph& newSceneGraph, const std::vector<uint32_t>& newMeshNodes);
+    //Meshes can't be copied, so neither can the model
+    MeshModel(const MeshModel&) = delete;
+    MeshModel& operator=(const MeshModel&) = delete;
+    MeshModel(MeshModel&& other);
+    MeshModel& operator=(MeshModel&& other);
 
     size_t GetMeshCount()const {return meshList.size();}
 
-    void SetModel(glm::mat4 newModel) {model = newModel;}
+    //Places the whole model, on top of the node transforms
+    void SetModel(const glm::mat4& newModel)
+    {
+        //Same matrix every frame shouldn't recompute the mesh transforms
+        if(newModel == model) return;
+        model = newModel;
+        modelChanged = true;
+    }
     glm::mat4 GetModel() const {return model;}
 
+    SceneGraph& GetSceneGraph() {return sceneGraph;}
+    //Bring the mesh transforms up to date with the model and scene graph, once a frame before drawing
+    void UpdateTransforms();
+    //Model matrix times the world transform of the mesh's node
+    const glm::mat4& GetMeshTransform(size_t index) const {return meshTransforms[index];}
+
     Mesh* GetMesh(size_t index);
 
+    //Texture ids this model holds a reference to (released when the model is destroyed)
+    void SetTextureIds(std::vector<int> newTextureIds) {textureIds = std::move(newTextureIds);}
+    const std::vector<int>& GetTextureIds() const {return textureIds;}
+
     static std::vector<std::string> LoadMaterials(const aiScene* scene);
-    static std::vector<Mesh> LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-        aiNode* node, const aiScene* scene,const std::vector<int>& matToTex);
-    static Mesh LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-                         aiMesh* mesh, const aiScene* scene, const std::vector<int>& matToTex);
+    //Add the node and its children to the scene graph and list the scene meshes they hold with their node,
+    //the meshes are converted afterwards so that can happen on several threads (the lists only last for the load)
+    static void LoadNode(aiNode* node, const aiScene* scene, uint32_t parent, SceneGraph& sceneGraph, ArenaVector<aiMesh*>& meshes,
+        ArenaVector<uint32_t>& meshNodes);
+    //Convert a scene mesh to our vertex format (CPU only and safe to run in parallel, the renderer uploads it)
+    static MeshData LoadMesh(const aiMesh* mesh);
     
     void DestroyMeshModel();
     ~MeshModel();
@@ -33,5 +65,11 @@ public:
 private:
 
     std::vector<Mesh> meshList;
+    std::vector<int> textureIds;
     glm::mat4 model;
+    bool modelChanged;
+
+    SceneGraph sceneGraph;
+    std::vector<uint32_t> meshNodes;
+    std::vector<glm::mat4> meshTransforms;
 };
@@ -0,0 +1,325 @@
+﻿#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <deque>
+
+void MeshOptimizer::Optimize(MeshData& mesh)
+{
+    OptimizeVertexCache(mesh.indices,mesh.vertices.size());
+    OptimizeOverdraw(mesh.indices,mesh.vertices);
+    OptimizeVertexFetch(mesh.vertices,mesh.indices);
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if(triangleCount == 0)
+        return;
+
+    //Triangles using each vertex, as one array with an offset per vertex
+    std::vector<uint32_t> liveTriangles(vertexCount,0);
+    for (uint32_t index : indices)
+        liveTriangles[index]++;
+
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1,0);
+    for (size_t i = 0; i < vertexCount; ++i)
+        adjacencyOffsets[i+1] = adjacencyOffsets[i] + liveTriangles[i];
+
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(),adjacencyOffsets.end()-1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+    std::vector<uint32_t> cacheTime(vertexCount,0);
+    std::vector<bool> emitted(triangleCount,false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    //Time starts past the cache size so no vertex counts as cached to begin with
+    uint32_t timeStamp = CACHE_SIZE + 1;
+    uint32_t cursor = 1;
+    int32_t fanningVertex = 0;
+    while (fanningVertex >= 0)
+    {
+        //Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (uint32_t i = adjacencyOffsets[fanningVertex]; i < adjacencyOffsets[fanningVertex+1]; ++i)
+        {
+            uint32_t triangle = adjacency[i];
+            if(emitted[triangle])
+                continue;
+
+            for (uint32_t corner = 0; corner < 3; ++corner)
+            {
+                uint32_t vertex = indices[triangle*3 + corner];
+                result.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                liveTriangles[vertex]--;
+
+                if(timeStamp - cacheTime[vertex] > CACHE_SIZE)
+                    cacheTime[vertex] = timeStamp++;
+            }
+            emitted[triangle] = true;
+        }
+
+        fanningVertex = GetNextVertex(candidates,liveTriangles,cacheTime,timeStamp,deadEnds,cursor);
+    }
+
+    indices.swap(result);
+}
+
+int32_t MeshOptimizer::GetNextVertex(const std::vector<uint32_t>& candidates, const std::vector<uint32_t>& liveTriangles,
+    const std::vector<uint32_t>& cacheTime, uint32_t timeStamp, std::vector<uint32_t>& deadEnds, uint32_t& cursor)
+{
+    //Prefer the candidate that has been in the cache longest but will still be there after fanning it
+    int32_t best = -1;
+    int64_t bestPriority = -1;
+    for (uint32_t vertex : candidates)
+    {
+        if(liveTriangles[vertex] == 0)
+            continue;
+
+        int64_t priority = 0;
+        if(timeStamp - cacheTime[vertex] + 2 * liveTriangles[vertex] <= CACHE_SIZE)
+            priority = timeStamp - cacheTime[vertex];
+
+        if(priority > bestPriority)
+        {
+            bestPriority = priority;
+            best = static_cast<int32_t>(vertex);
+        }
+    }
+    if(best >= 0)
+        return best;
+
+    //Dead end, go back through recently used vertices
+    while (!deadEnds.empty())
+    {
+        uint32_t vertex = deadEnds.back();
+        deadEnds.pop_back();
+        if(liveTriangles[vertex] > 0)
+            return static_cast<int32_t>(vertex);
+    }
+
+    //Nothing left nearby, take the next vertex in input order that still has triangles
+    while (cursor < liveTriangles.size())
+    {
+        if(liveTriangles[cursor] > 0)
+            return static_cast<int32_t>(cursor);
+        cursor++;
+    }
+    return -1;
+}
+
+void MeshOptimizer::OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold)
+{
+    size_t triangleCount = indices.size() / 3;
+    if(triangleCount < 2)
+        return;
+
+    float meshAcmr = AnalyzeVertexCache(indices,vertices.size()).acmr;
+
+    //Cut the cache optimized order into clusters wherever the cache is about to be cold anyway
+    //(a cluster ends once its own miss ratio is close enough to the whole mesh's), so moving clusters around costs little
+    std::vector<size_t> clusterStarts;
+    std::deque<uint32_t> cache;
+    size_t clusterMisses = 0;
+    size_t clusterStart = 0;
+    clusterStarts.push_back(0);
+    for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+    {
+        for (uint32_t corner = 0; corner < 3; ++corner)
+        {
+            uint32_t vertex = indices[triangle*3 + corner];
+            if(std::find(cache.begin(),cache.end(),vertex) == cache.end())
+            {
+                cache.push_back(vertex);
+                if(cache.size() > CACHE_SIZE)
+                    cache.pop_front();
+                clusterMisses++;
+            }
+        }
+
+        size_t clusterTriangles = triangle + 1 - clusterStart;
+        if(triangle + 1 < triangleCount && static_cast<float>(clusterMisses) / clusterTriangles <= meshAcmr * threshold)
+        {
+            //Start the next cluster with an empty cache, the same as the GPU would see after a reorder
+            clusterStarts.push_back(triangle + 1);
+            clusterStart = triangle + 1;
+            clusterMisses = 0;
+            cache.clear();
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    //Whole mesh centre
+    glm::vec3 meshCentre(0.0f);
+    for (const Vertex& vertex : vertices)
+        meshCentre += vertex.pos;
+    meshCentre /= static_cast<float>(std::max<size_t>(vertices.size(),1));
+
+    //Clusters facing away from the centre are likely in front of the ones facing inwards, so draw them first
+    size_t clusterCount = clusterStarts.size() - 1;
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t cluster = 0; cluster < clusterCount; ++cluster)
+    {
+        glm::vec3 centre(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t triangle = clusterStarts[cluster]; triangle < clusterStarts[cluster+1]; ++triangle)
+        {
+            const glm::vec3& p0 = vertices[indices[triangle*3]].pos;
+            const glm::vec3& p1 = vertices[indices[triangle*3+1]].pos;
+            const glm::vec3& p2 = vertices[indices[triangle*3+2]].pos;
+
+            //Area weighted, the length of the cross product is twice the triangle area
+            glm::vec3 triangleNormal = glm::cross(p1 - p0,p2 - p0);
+            float triangleArea = glm::length(triangleNormal);
+            centre += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += triangleNormal;
+            area += triangleArea;
+        }
+
+        if(area > 0.0f)
+            centre /= area;
+        float normalLength = glm::length(normal);
+        if(normalLength > 0.0f)
+            normal /= normalLength;
+
+        sortKeys[cluster] = glm::dot(centre - meshCentre,normal);
+    }
+
+    std::vector<size_t> clusterOrder(clusterCount);
+    for (size_t i = 0; i < clusterCount; ++i)
+        clusterOrder[i] = i;
+    std::stable_sort(clusterOrder.begin(),clusterOrder.end(),[&sortKeys](size_t a, size_t b)
+    {
+        return sortKeys[a] > sortKeys[b];
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (size_t cluster : clusterOrder)
+    {
+        result.insert(result.end(),indices.begin() + clusterStarts[cluster]*3,indices.begin() + clusterStarts[cluster+1]*3);
+    }
+    indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+    //Number vertices in the order the index buffer first reaches them
+    const uint32_t unused = UINT32_MAX;
+    std::vector<uint32_t> remap(vertices.size(),unused);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (uint32_t& index : indices)
+    {
+        if(remap[index] == unused)
+        {
+            remap[index] = static_cast<uint32_t>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    vertices.swap(result);
+}
+
+MeshOptimizer::VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    VertexCacheStats stats{};
+    if(indices.empty() || vertexCount == 0)
+        return stats;
+
+    //Simulate a FIFO cache like the one in the GPU
+    std::deque<uint32_t> cache;
+    size_t misses = 0;
+    for (uint32_t index : indices)
+    {
+        if(std::find(cache.begin(),cache.end(),index) != cache.end())
+            continue;
+
+        cache.push_back(index);
+        if(cache.size() > CACHE_SIZE)
+            cache.pop_front();
+        misses++;
+    }
+
+    stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+    stats.atvr = static_cast<float>(misses) / vertexCount;
+    return stats;
+}
+
+void MeshOptimizer::SplitForShortIndices(std::vector<MeshData>& meshes, float maxVertexGrowth)
+{
+    std::vector<MeshData> result;
+    result.reserve(meshes.size());
+
+    const uint32_t unused = UINT32_MAX;
+    for (MeshData& mesh : meshes)
+    {
+        if(mesh.vertices.size() <= MAX_SHORT_INDEX_VERTICES)
+        {
+            result.push_back(std::move(mesh));
+            continue;
+        }
+
+        //Each piece takes triangles until the next one would need a vertex past the 16 bit range,
+        //vertices get numbered by first use within the piece like OptimizeVertexFetch does
+        std::vector<MeshData> pieces;
+        std::vector<uint32_t> remap(mesh.vertices.size(),unused);
+        std::vector<uint32_t> pieceVertices; //Original vertices used by the current piece, to reset remap
+        size_t splitVertexCount = 0;
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            size_t newVertices = 0;
+            for (size_t j = 0; j < 3; ++j)
+            {
+                if(remap[mesh.indices[i + j]] == unused)
+                    newVertices++;
+            }
+
+            if(pieces.empty() || pieces.back().vertices.size() + newVertices > MAX_SHORT_INDEX_VERTICES)
+            {
+                for (uint32_t vertex : pieceVertices)
+                    remap[vertex] = unused;
+                pieceVertices.clear();
+
+                MeshData piece;
+                piece.materialIndex = mesh.materialIndex;
+                piece.node = mesh.node;
+                pieces.push_back(std::move(piece));
+            }
+
+            MeshData& piece = pieces.back();
+            for (size_t j = 0; j < 3; ++j)
+            {
+                uint32_t index = mesh.indices[i + j];
+                if(remap[index] == unused)
+                {
+                    remap[index] = static_cast<uint32_t>(piece.vertices.size());
+                    piece.vertices.push_back(mesh.vertices[index]);
+                    pieceVertices.push_back(index);
+                    splitVertexCount++;
+                }
+                piece.indices.push_back(remap[index]);
+            }
+        }
+
+        if(splitVertexCount > mesh.vertices.size() * maxVertexGrowth)
+        {
+            result.push_back(std::move(mesh));
+            continue;
+        }
+
+        for (MeshData& piece : pieces)
+            result.push_back(std::move(piece));
+    }
+
+    meshes.swap(result);
+}
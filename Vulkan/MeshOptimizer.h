@@ -0,0 +1,42 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+
+//Import time reordering of mesh data so the GPU does less work drawing it:
+// - triangles ordered for the post-transform vertex cache (Tipsify, Sander et al. 2007)
+// - clusters of those triangles ordered outside-in so less gets shaded and then overdrawn
+// - vertices ordered by first use so vertex fetch walks through memory
+class MeshOptimizer
+{
+public:
+    struct VertexCacheStats
+    {
+        float acmr; //Average cache miss ratio, transformed vertices per triangle (0.5 best, 3 worst)
+        float atvr; //Average transformed vertex ratio, transformed vertices per vertex (1 best)
+    };
+
+    //Runs every step below on the mesh
+    static void Optimize(MeshData& mesh);
+
+    static void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+    //Indices must already be cache optimized, threshold is how much worse the cache can get for better overdraw
+    static void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f);
+    //Also drops vertices no triangle uses
+    static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+    static VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount);
+
+    //Splits meshes with too many vertices for 16 bit indices into pieces that fit, walking the (cache optimized) triangles
+    //in order so each piece stays compact. Meshes where the vertices shared between pieces would add more than
+    //maxVertexGrowth are left whole, there 32 bit indices cost less than the extra vertices
+    static void SplitForShortIndices(std::vector<MeshData>& meshes, float maxVertexGrowth = 1.1f);
+
+private:
+    //Roughly the post-transform cache size of current GPUs
+    static const uint32_t CACHE_SIZE = 16;
+
+    static int32_t GetNextVertex(const std::vector<uint32_t>& candidates, const std::vector<uint32_t>& liveTriangles,
+        const std::vector<uint32_t>& cacheTime, uint32_t timeStamp, std::vector<uint32_t>& deadEnds, uint32_t& cursor);
+};
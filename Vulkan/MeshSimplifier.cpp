@@ -0,0 +1,279 @@
+﻿#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "MeshOptimizer.h"
+
+//Not worth another level below this
+const size_t MIN_LOD_TRIANGLES = 64;
+
+void MeshSimplifier::GenerateLods(MeshData& mesh)
+{
+    mesh.lods.clear();
+    mesh.lods.push_back({0,static_cast<uint32_t>(mesh.indices.size()),0.0f});
+
+    //Every level is simplified from the full mesh so its error is measured against the real surface
+    const std::vector<uint32_t> fullIndices = mesh.indices;
+    size_t targetIndexCount = fullIndices.size();
+    while (mesh.lods.size() < MAX_MESH_LODS)
+    {
+        targetIndexCount = targetIndexCount / 6 * 3;
+        if(targetIndexCount < MIN_LOD_TRIANGLES * 3)
+            break;
+
+        std::vector<uint32_t> lodIndices;
+        float error = Simplify(mesh.vertices,fullIndices,targetIndexCount,lodIndices);
+
+        //Locked borders and seams stopped it, another level would look the same
+        if(lodIndices.size() * 10 > mesh.lods.back().indexCount * 9)
+            break;
+
+        MeshOptimizer::OptimizeVertexCache(lodIndices,mesh.vertices.size());
+
+        MeshLod lod{};
+        lod.indexOffset = static_cast<uint32_t>(mesh.indices.size());
+        lod.indexCount = static_cast<uint32_t>(lodIndices.size());
+        lod.error = std::max(error,mesh.lods.back().error);
+        mesh.lods.push_back(lod);
+        mesh.indices.insert(mesh.indices.end(),lodIndices.begin(),lodIndices.end());
+
+        targetIndexCount = lodIndices.size();
+    }
+}
+
+float MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount,
+    std::vector<uint32_t>& result)
+{
+    result = indices;
+    size_t vertexCount = vertices.size();
+
+    //Each vertex starts with the planes of the triangles around it
+    std::vector<Quadric> quadrics(vertexCount,Quadric{});
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        Quadric plane{};
+        AddPlane(plane,vertices[indices[i]].pos,vertices[indices[i+1]].pos,vertices[indices[i+2]].pos);
+        for (size_t corner = 0; corner < 3; ++corner)
+            AddQuadric(quadrics[indices[i+corner]],plane);
+    }
+
+    std::vector<bool> locked = FindLockedVertices(vertices,indices);
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        double error;
+    };
+
+    double maxError = 0.0;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+    std::vector<uint32_t> vertexTriangles;
+
+    //Collapse in passes: cheapest edges first, each vertex moves at most once per pass, then rebuild the indices
+    while (result.size() > targetIndexCount)
+    {
+        //Triangles around each vertex
+        std::fill(triangleOffsets.begin(),triangleOffsets.end(),0);
+        for (uint32_t index : result)
+            triangleOffsets[index+1]++;
+        for (size_t i = 0; i < vertexCount; ++i)
+            triangleOffsets[i+1] += triangleOffsets[i];
+        vertexTriangles.resize(result.size());
+        std::vector<uint32_t> fill(triangleOffsets.begin(),triangleOffsets.end()-1);
+        for (size_t i = 0; i < result.size(); ++i)
+            vertexTriangles[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+
+        //Both directions of every edge, the vertex that moves has to be free
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (size_t corner = 0; corner < 3; ++corner)
+            {
+                uint32_t a = result[i + corner];
+                uint32_t b = result[i + (corner+1) % 3];
+                if(!locked[a])
+                {
+                    Quadric combined = quadrics[a];
+                    AddQuadric(combined,quadrics[b]);
+                    collapses.push_back({a,b,GetError(combined,vertices[b].pos)});
+                }
+                if(!locked[b])
+                {
+                    Quadric combined = quadrics[b];
+                    AddQuadric(combined,quadrics[a]);
+                    collapses.push_back({b,a,GetError(combined,vertices[a].pos)});
+                }
+            }
+        }
+        std::sort(collapses.begin(),collapses.end(),[](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        for (size_t i = 0; i < vertexCount; ++i)
+            remap[i] = static_cast<uint32_t>(i);
+        std::fill(touched.begin(),touched.end(),false);
+
+        size_t triangleCount = result.size() / 3;
+        size_t targetTriangles = targetIndexCount / 3;
+        size_t collapseCount = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if(triangleCount <= targetTriangles)
+                break;
+            if(touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            //Moving the vertex must not turn any of its triangles over
+            bool flips = false;
+            size_t removedTriangles = 0;
+            for (uint32_t i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from+1] && !flips; ++i)
+            {
+                uint32_t triangle = vertexTriangles[i];
+                uint32_t corners[3] = {remap[result[triangle*3]],remap[result[triangle*3+1]],remap[result[triangle*3+2]]};
+                if(corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+                {
+                    //Shares the edge, disappears
+                    removedTriangles++;
+                    continue;
+                }
+                if(corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2])
+                    continue;
+
+                glm::vec3 positions[3] = {vertices[corners[0]].pos,vertices[corners[1]].pos,vertices[corners[2]].pos};
+                glm::vec3 normal = glm::cross(positions[1] - positions[0],positions[2] - positions[0]);
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    if(corners[corner] == collapse.from)
+                        positions[corner] = vertices[collapse.to].pos;
+                }
+                glm::vec3 newNormal = glm::cross(positions[1] - positions[0],positions[2] - positions[0]);
+                flips = glm::dot(normal,newNormal) <= 0.0f;
+            }
+            if(flips)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            AddQuadric(quadrics[collapse.to],quadrics[collapse.from]);
+            touched[collapse.from] = true;
+            touched[collapse.to] = true;
+            maxError = std::max(maxError,collapse.error);
+            triangleCount -= std::min(removedTriangles,triangleCount);
+            collapseCount++;
+        }
+
+        //Everything left is locked or would flip a triangle
+        if(collapseCount == 0)
+            break;
+
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            uint32_t a = remap[result[i]];
+            uint32_t b = remap[result[i+1]];
+            uint32_t c = remap[result[i+2]];
+            if(a == b || b == c || a == c)
+                continue;
+
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+    }
+
+    //Quadric error is a squared distance
+    return static_cast<float>(std::sqrt(maxError));
+}
+
+void MeshSimplifier::AddPlane(Quadric& quadric, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+    glm::vec3 normal = glm::cross(p1 - p0,p2 - p0);
+    float length = glm::length(normal);
+    if(length <= 0.0f)
+        return;
+    normal /= length;
+
+    double a = normal.x;
+    double b = normal.y;
+    double c = normal.z;
+    double d = -glm::dot(normal,p0);
+    quadric.a00 += a*a; quadric.a01 += a*b; quadric.a02 += a*c; quadric.a03 += a*d;
+    quadric.a11 += b*b; quadric.a12 += b*c; quadric.a13 += b*d;
+    quadric.a22 += c*c; quadric.a23 += c*d;
+    quadric.a33 += d*d;
+}
+
+void MeshSimplifier::AddQuadric(Quadric& quadric, const Quadric& other)
+{
+    quadric.a00 += other.a00; quadric.a01 += other.a01; quadric.a02 += other.a02; quadric.a03 += other.a03;
+    quadric.a11 += other.a11; quadric.a12 += other.a12; quadric.a13 += other.a13;
+    quadric.a22 += other.a22; quadric.a23 += other.a23;
+    quadric.a33 += other.a33;
+}
+
+double MeshSimplifier::GetError(const Quadric& quadric, const glm::vec3& position)
+{
+    double x = position.x;
+    double y = position.y;
+    double z = position.z;
+    double error = quadric.a00*x*x + 2*quadric.a01*x*y + 2*quadric.a02*x*z + 2*quadric.a03*x +
+                   quadric.a11*y*y + 2*quadric.a12*y*z + 2*quadric.a13*y +
+                   quadric.a22*z*z + 2*quadric.a23*z +
+                   quadric.a33;
+    //Rounding can take it slightly below zero
+    return std::max(error,0.0);
+}
+
+std::vector<bool> MeshSimplifier::FindLockedVertices(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+    std::vector<bool> locked(vertices.size(),false);
+
+    //Edges used by only one triangle are on a border
+    std::unordered_map<uint64_t,uint32_t> edgeUses;
+    edgeUses.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            uint64_t a = indices[i + corner];
+            uint64_t b = indices[i + (corner+1) % 3];
+            edgeUses[std::min(a,b) << 32 | std::max(a,b)]++;
+        }
+    }
+    for (const auto& edge : edgeUses)
+    {
+        if(edge.second == 1)
+        {
+            locked[edge.first >> 32] = true;
+            locked[edge.first & 0xffffffffull] = true;
+        }
+    }
+
+    //The importer joined identical vertices, so two vertices at one position means a UV seam
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3& position) const
+        {
+            size_t hash = std::hash<float>()(position.x);
+            hash = hash * 31 + std::hash<float>()(position.y);
+            return hash * 31 + std::hash<float>()(position.z);
+        }
+    };
+    std::unordered_map<glm::vec3,uint32_t,PositionHash> firstAtPosition;
+    firstAtPosition.reserve(vertices.size());
+    for (uint32_t i = 0; i < vertices.size(); ++i)
+    {
+        auto inserted = firstAtPosition.emplace(vertices[i].pos,i);
+        if(!inserted.second)
+        {
+            locked[i] = true;
+            locked[inserted.first->second] = true;
+        }
+    }
+
+    return locked;
+}
@@ -0,0 +1,36 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+
+//Import time LOD generation using quadric error metrics (Garland & Heckbert 1997).
+//Edges are only collapsed onto vertices that already exist, so every LOD is just another
+//range of indices into the mesh's vertex buffer.
+class MeshSimplifier
+{
+public:
+    //Fills mesh.lods and appends the index ranges of the lower detail levels to mesh.indices
+    static void GenerateLods(MeshData& mesh);
+
+    //Simplify towards targetIndexCount, returns how far (in model units) the surface moved at most
+    static float Simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount,
+        std::vector<uint32_t>& result);
+
+private:
+    //Symmetric 4x4 matrix, sum of squared distances to a set of planes
+    struct Quadric
+    {
+        double a00, a01, a02, a03;
+        double a11, a12, a13;
+        double a22, a23;
+        double a33;
+    };
+
+    static void AddPlane(Quadric& quadric, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2);
+    static void AddQuadric(Quadric& quadric, const Quadric& other);
+    static double GetError(const Quadric& quadric, const glm::vec3& position);
+
+    //Vertices on open borders or UV seams can't move without tearing the mesh
+    static std::vector<bool> FindLockedVertices(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+};
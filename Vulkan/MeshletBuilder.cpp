@@ -0,0 +1,110 @@
+﻿#include "MeshletBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::vector<Meshlet> MeshletBuilder::Build(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t indexCount)
+{
+    std::vector<Meshlet> meshlets;
+
+    //Meshlet each vertex was last added to, so checking if it's already in the current one is cheap
+    std::vector<uint32_t> vertexMeshlet(vertices.size(),UINT32_MAX);
+    uint32_t meshletVertices = 0;
+
+    Meshlet current{};
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        uint32_t meshletIndex = static_cast<uint32_t>(meshlets.size());
+        uint32_t newVertices = 0;
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            if(vertexMeshlet[indices[i+corner]] != meshletIndex)
+                newVertices++;
+        }
+
+        //Full, close it and start the next one with this triangle
+        if(meshletVertices + newVertices > MAX_MESHLET_VERTICES || current.indexCount / 3 >= MAX_MESHLET_TRIANGLES)
+        {
+            CalculateBounds(vertices,indices,current);
+            meshlets.push_back(current);
+
+            meshletIndex++;
+            current = Meshlet{};
+            current.indexOffset = static_cast<uint32_t>(i);
+            meshletVertices = 0;
+        }
+
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+            if(vertexMeshlet[indices[i+corner]] != meshletIndex)
+            {
+                vertexMeshlet[indices[i+corner]] = meshletIndex;
+                meshletVertices++;
+            }
+        }
+        current.indexCount += 3;
+    }
+
+    if(current.indexCount > 0)
+    {
+        CalculateBounds(vertices,indices,current);
+        meshlets.push_back(current);
+    }
+
+    return meshlets;
+}
+
+void MeshletBuilder::CalculateBounds(const std::vector<Vertex>& vertices, const uint32_t* indices, Meshlet& meshlet)
+{
+    const uint32_t* first = indices + meshlet.indexOffset;
+    const uint32_t* last = first + meshlet.indexCount;
+
+    //Sphere around the centre of the bounding box, like the whole mesh bounds
+    glm::vec3 minPos = vertices[*first].pos;
+    glm::vec3 maxPos = minPos;
+    for (const uint32_t* index = first; index != last; ++index)
+    {
+        minPos = glm::min(minPos,vertices[*index].pos);
+        maxPos = glm::max(maxPos,vertices[*index].pos);
+    }
+    glm::vec3 centre = (minPos + maxPos) * 0.5f;
+
+    float radius = 0.0f;
+    for (const uint32_t* index = first; index != last; ++index)
+        radius = std::max(radius,glm::length(vertices[*index].pos - centre));
+
+    //Normal cone: the average triangle normal and how far the others spread from it
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.indexCount / 3);
+    glm::vec3 axis(0.0f);
+    for (const uint32_t* triangle = first; triangle != last; triangle += 3)
+    {
+        glm::vec3 normal = glm::cross(vertices[triangle[1]].pos - vertices[triangle[0]].pos,
+                                      vertices[triangle[2]].pos - vertices[triangle[0]].pos);
+        float length = glm::length(normal);
+        if(length <= 0.0f)
+            continue;
+
+        normals.push_back(normal / length);
+        axis += normals.back();
+    }
+
+    //A sine of 1 means "facing every way", which never gets culled
+    float coneSine = 1.0f;
+    float axisLength = glm::length(axis);
+    if(axisLength > 0.0f)
+    {
+        axis /= axisLength;
+
+        float minDot = 1.0f;
+        for (const glm::vec3& normal : normals)
+            minDot = std::min(minDot,glm::dot(normal,axis));
+
+        //Wider than a hemisphere can always be seen from somewhere in front
+        if(minDot > 0.0f)
+            coneSine = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    meshlet.sphere = glm::vec4(centre,radius);
+    meshlet.cone = glm::vec4(axis,coneSine);
+}
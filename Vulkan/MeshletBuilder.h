@@ -0,0 +1,20 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+
+//Splits a mesh into meshlets: runs of consecutive triangles using at most MAX_MESHLET_VERTICES vertices
+//and MAX_MESHLET_TRIANGLES triangles. The index order is left alone (it's already cache optimized, so
+//neighbouring triangles are close together), each meshlet is just a range of the index buffer.
+class MeshletBuilder
+{
+public:
+    static const uint32_t MAX_MESHLET_VERTICES = 64;
+    static const uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+    static std::vector<Meshlet> Build(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t indexCount);
+
+private:
+    static void CalculateBounds(const std::vector<Vertex>& vertices, const uint32_t* indices, Meshlet& meshlet);
+};
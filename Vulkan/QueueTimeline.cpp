@@ -0,0 +1,163 @@
+﻿#include "QueueTimeline.h"
+
+#include <limits>
+#include <stdexcept>
+
+QueueTimeline::QueueTimeline(): device(nullptr), queue(nullptr), semaphore(nullptr), submittedValue(0), completedValue(0),
+    waitSemaphores(nullptr), getSemaphoreCounterValue(nullptr)
+{
+}
+
+void QueueTimeline::Init(VkDevice newDevice, VkQueue newQueue, bool timelineExtensionEnabled)
+{
+    device = newDevice;
+    queue = newQueue;
+    if(!timelineExtensionEnabled)
+        return;
+
+    waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(device,"vkWaitSemaphoresKHR"));
+    getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+        vkGetDeviceProcAddr(device,"vkGetSemaphoreCounterValueKHR"));
+    if(!waitSemaphores || !getSemaphoreCounterValue)
+        return;
+
+    VkSemaphoreTypeCreateInfoKHR typeCreateInfo{};
+    typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    typeCreateInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo{};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &typeCreateInfo;
+
+    if(vkCreateSemaphore(device,&semaphoreCreateInfo,nullptr,&semaphore) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a timeline semaphore");
+}
+
+void QueueTimeline::Destroy()
+{
+    vkDestroySemaphore(device,semaphore,nullptr);
+    semaphore = nullptr;
+
+    for (const PendingFence& pending : pendingFences)
+        vkDestroyFence(device,pending.fence,nullptr);
+    for (VkFence fence : freeFences)
+        vkDestroyFence(device,fence,nullptr);
+    pendingFences.clear();
+    freeFences.clear();
+}
+
+uint64_t QueueTimeline::Submit(const VkSubmitInfo& submitInfo)
+{
+    uint64_t value = submittedValue + 1;
+
+    if(!semaphore)
+    {
+        VkFence fence = GetFence();
+        VkResult result = vkQueueSubmit(queue,1,&submitInfo,fence);
+        if(result != VK_SUCCESS)
+        {
+            freeFences.push_back(fence);
+            throw std::runtime_error("Failed to submit command buffer to queue");
+        }
+        pendingFences.push_back({value,fence});
+        submittedValue = value;
+        return value;
+    }
+
+    //Timeline semaphore signalled after the batch's own semaphores, binary semaphores ignore their values
+    signalSemaphores.assign(submitInfo.pSignalSemaphores,submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+    signalSemaphores.push_back(semaphore);
+    signalValues.assign(signalSemaphores.size(),0);
+    signalValues.back() = value;
+    waitValues.assign(submitInfo.waitSemaphoreCount,0);
+
+    VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo{};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timelineSubmitInfo.pNext = submitInfo.pNext;
+    timelineSubmitInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+    timelineSubmitInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineSubmitInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+    timelineSubmitInfo.pSignalSemaphoreValues = signalValues.data();
+
+    VkSubmitInfo timelineSubmit = submitInfo;
+    timelineSubmit.pNext = &timelineSubmitInfo;
+    timelineSubmit.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    timelineSubmit.pSignalSemaphores = signalSemaphores.data();
+
+    VkResult result = vkQueueSubmit(queue,1,&timelineSubmit,VK_NULL_HANDLE);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to submit command buffer to queue");
+
+    submittedValue = value;
+    return value;
+}
+
+void QueueTimeline::Wait(uint64_t value)
+{
+    if(value <= completedValue)
+        return;
+
+    if(semaphore)
+    {
+        VkSemaphoreWaitInfoKHR waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &value;
+        waitSemaphores(device,&waitInfo,std::numeric_limits<uint64_t>::max());
+        completedValue = value;
+        return;
+    }
+
+    //Fences signal in submission order, so waiting on the one for this value covers all before it
+    for (const PendingFence& pending : pendingFences)
+    {
+        if(pending.value >= value)
+        {
+            vkWaitForFences(device,1,&pending.fence,VK_TRUE,std::numeric_limits<uint64_t>::max());
+            break;
+        }
+    }
+    GetCompletedValue();
+}
+
+uint64_t QueueTimeline::GetCompletedValue()
+{
+    if(semaphore)
+    {
+        uint64_t value = 0;
+        if(getSemaphoreCounterValue(device,semaphore,&value) == VK_SUCCESS)
+            completedValue = value;
+        return completedValue;
+    }
+
+    //Signalled fences go back to be reused
+    size_t signalledCount = 0;
+    while (signalledCount < pendingFences.size() && vkGetFenceStatus(device,pendingFences[signalledCount].fence) == VK_SUCCESS)
+    {
+        completedValue = pendingFences[signalledCount].value;
+        freeFences.push_back(pendingFences[signalledCount].fence);
+        signalledCount++;
+    }
+    pendingFences.erase(pendingFences.begin(),pendingFences.begin() + signalledCount);
+    return completedValue;
+}
+
+VkFence QueueTimeline::GetFence()
+{
+    VkFence fence;
+    if(!freeFences.empty())
+    {
+        fence = freeFences.back();
+        freeFences.pop_back();
+        vkResetFences(device,1,&fence);
+        return fence;
+    }
+
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if(vkCreateFence(device,&fenceCreateInfo,nullptr,&fence) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a fence for a queue submission");
+    return fence;
+}
@@ -0,0 +1,57 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+//Every submission to a queue signals the next value of one counter, so "is this work done" is a single number compare.
+//With VK_KHR_timeline_semaphore the counter is a timeline semaphore others can wait on,
+//without it each submission gets a fence (recycled once it has signalled) and the counter is worked out from them.
+class QueueTimeline
+{
+public:
+    QueueTimeline();
+
+    //timelineExtensionEnabled when VK_KHR_timeline_semaphore and its feature are enabled on the device
+    void Init(VkDevice newDevice, VkQueue newQueue, bool timelineExtensionEnabled);
+    void Destroy();
+
+    //Submits one batch that signals the next value (on top of whatever it signals already) and returns that value
+    uint64_t Submit(const VkSubmitInfo& submitInfo);
+    //Blocks until the value has been signalled
+    void Wait(uint64_t value);
+    //Highest value known to be signalled, everything submitted up to it is finished
+    uint64_t GetCompletedValue();
+    bool IsComplete(uint64_t value) {return value <= GetCompletedValue();}
+
+    //Last value handed out by Submit
+    uint64_t GetSubmittedValue() const {return submittedValue;}
+    //Null without the extension
+    VkSemaphore GetSemaphore() const {return semaphore;}
+
+private:
+    struct PendingFence
+    {
+        uint64_t value;
+        VkFence fence;
+    };
+
+    VkDevice device;
+    VkQueue queue;
+    VkSemaphore semaphore;
+    uint64_t submittedValue;
+    uint64_t completedValue;
+    PFN_vkWaitSemaphoresKHR waitSemaphores;
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue;
+
+    //Without the extension
+    std::vector<PendingFence> pendingFences; //In submission order
+    std::vector<VkFence> freeFences;
+
+    //Lists Submit hands the timeline semaphore's values in, kept so submitting doesn't allocate every frame
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<uint64_t> signalValues;
+    std::vector<uint64_t> waitValues;
+
+    VkFence GetFence();
+};
@@ -0,0 +1,597 @@
+﻿#include "RenderGraph.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+bool RenderGraph::ImageDesc::operator==(const ImageDesc& other) const
+{
+    return format == other.format && width == other.width && height == other.height && mipLevels == other.mipLevels &&
+        samples == other.samples && usage == other.usage && aspect == other.aspect;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Read(ResourceId resource, Usage usage)
+{
+    graph.passes[pass].accesses.push_back({resource,usage,false});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Write(ResourceId resource, Usage usage)
+{
+    graph.passes[pass].accesses.push_back({resource,usage,true});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::SideEffects()
+{
+    graph.passes[pass].sideEffects = true;
+    return *this;
+}
+
+RenderGraph::RenderGraph(): physicalDevice(nullptr), device(nullptr), framesInFlight(1), compileCount(0), transientImageVersion(0), passCount(0), finalSrcStages(0)
+{
+}
+
+void RenderGraph::Init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t newFramesInFlight)
+{
+    physicalDevice = newPhysicalDevice;
+    device = newDevice;
+    framesInFlight = newFramesInFlight;
+}
+
+void RenderGraph::Destroy()
+{
+    DestroyRetiredMemory(true);
+    DestroyTransientMemory(transientImages,memorySlots);
+    Reset();
+    passes.clear();
+}
+
+void RenderGraph::Reset()
+{
+    resources.clear();
+    passCount = 0;
+    finalBarriers.clear();
+    finalSrcStages = 0;
+}
+
+RenderGraph::ResourceId RenderGraph::ImportImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect,
+    VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout finalLayout)
+{
+    Resource resource{};
+    resource.name = name;
+    resource.isImage = true;
+    resource.imported = true;
+    resource.image = image;
+    resource.view = view;
+    resource.aspect = aspect;
+    resource.initialLayout = layout;
+    resource.initialStages = stages;
+    resource.initialAccess = access;
+    resource.finalLayout = finalLayout;
+    resource.transientImage = -1;
+    resources.push_back(resource);
+    return static_cast<ResourceId>(resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::ImportBuffer(const char* name, VkBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+    Resource resource{};
+    resource.name = name;
+    resource.isImage = false;
+    resource.imported = true;
+    resource.buffer = buffer;
+    resource.initialStages = stages;
+    resource.initialAccess = access;
+    resource.transientImage = -1;
+    resources.push_back(resource);
+    return static_cast<ResourceId>(resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::CreateImage(const char* name, const ImageDesc& desc)
+{
+    Resource resource{};
+    resource.name = name;
+    resource.isImage = true;
+    resource.imported = false;
+    resource.aspect = desc.aspect;
+    resource.desc = desc;
+    resource.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.transientImage = -1;
+    resources.push_back(resource);
+    return static_cast<ResourceId>(resources.size() - 1);
+}
+
+void RenderGraph::MarkOutput(ResourceId resource)
+{
+    resources[resource].output = true;
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(const char* name, std::function<void(VkCommandBuffer)> record)
+{
+    //A pass left from an earlier frame is reused with the lists it already has
+    if(passCount == passes.size())
+        passes.emplace_back();
+
+    Pass& pass = passes[passCount];
+    pass.name = name;
+    pass.record = std::move(record);
+    pass.accesses.clear();
+    pass.sideEffects = false;
+    pass.culled = false;
+    pass.barriers.clear();
+    pass.srcStages = 0;
+    pass.dstStages = 0;
+    return PassBuilder(*this,passCount++);
+}
+
+void RenderGraph::Compile()
+{
+    //Memory replaced this many compiles ago isn't used by any frame still on the GPU
+    compileCount++;
+    DestroyRetiredMemory(false);
+
+    CullPasses();
+    FindLifetimes();
+    AllocateTransientImages();
+    BuildBarriers();
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer)
+{
+    for (size_t i = 0; i < passCount; ++i)
+    {
+        const Pass& pass = passes[i];
+        if(pass.culled)
+            continue;
+
+        RecordBarriers(commandBuffer,pass.barriers,pass.srcStages,pass.dstStages);
+        pass.record(commandBuffer);
+    }
+
+    RecordBarriers(commandBuffer,finalBarriers,finalSrcStages,VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+}
+
+uint32_t RenderGraph::GetCulledPassCount() const
+{
+    return static_cast<uint32_t>(std::count_if(passes.begin(),passes.begin() + passCount,[](const Pass& pass) {return pass.culled;}));
+}
+
+VkDeviceSize RenderGraph::GetTransientMemorySize() const
+{
+    VkDeviceSize size = 0;
+    for (const MemorySlot& slot : memorySlots)
+        size += slot.size;
+    return size;
+}
+
+RenderGraph::UsageInfo RenderGraph::GetUsageInfo(Usage usage)
+{
+    switch (usage)
+    {
+    case Usage::ColourAttachment:
+        return {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT};
+    case Usage::DepthAttachment:
+        return {VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT};
+    case Usage::ComputeSampled:
+        return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_ACCESS_SHADER_READ_BIT};
+    case Usage::ComputeRead:
+        return {VK_IMAGE_LAYOUT_GENERAL,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_ACCESS_SHADER_READ_BIT};
+    case Usage::ComputeWrite:
+        return {VK_IMAGE_LAYOUT_GENERAL,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+    case Usage::FragmentSampled:
+        return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,VK_ACCESS_SHADER_READ_BIT};
+    case Usage::IndirectRead:
+        return {VK_IMAGE_LAYOUT_UNDEFINED,VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,VK_ACCESS_INDIRECT_COMMAND_READ_BIT};
+    case Usage::TransferRead:
+        return {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_ACCESS_TRANSFER_READ_BIT};
+    case Usage::TransferWrite:
+        return {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_ACCESS_TRANSFER_WRITE_BIT};
+    }
+    throw std::runtime_error("Unknown render graph usage");
+}
+
+bool RenderGraph::IsWriteAccess(VkAccessFlags access)
+{
+    return (access & (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT)) != 0;
+}
+
+void RenderGraph::CullPasses()
+{
+    //From the last pass back: a pass is needed if it has side effects or writes something needed,
+    //and then everything it reads is needed too
+    neededResources.assign(resources.size(),false);
+    for (size_t i = 0; i < resources.size(); ++i)
+        neededResources[i] = resources[i].output;
+
+    for (size_t i = passCount; i-- > 0;)
+    {
+        Pass& pass = passes[i];
+        bool kept = pass.sideEffects;
+        for (const PassAccess& access : pass.accesses)
+        {
+            if(access.write && neededResources[access.resource])
+                kept = true;
+        }
+
+        pass.culled = !kept;
+        if(!kept)
+            continue;
+
+        for (const PassAccess& access : pass.accesses)
+        {
+            if(!access.write)
+                neededResources[access.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::FindLifetimes()
+{
+    for (Resource& resource : resources)
+    {
+        resource.firstPass = -1;
+        resource.lastPass = -1;
+    }
+
+    for (size_t i = 0; i < passCount; ++i)
+    {
+        if(passes[i].culled)
+            continue;
+
+        for (const PassAccess& access : passes[i].accesses)
+        {
+            Resource& resource = resources[access.resource];
+            if(resource.firstPass < 0)
+                resource.firstPass = static_cast<int>(i);
+            resource.lastPass = static_cast<int>(i);
+        }
+    }
+}
+
+void RenderGraph::AllocateTransientImages()
+{
+    //Transient images some pass still uses, in the order they're first used (then in the order they were created)
+    std::vector<ResourceId>& used = usedTransientImages;
+    used.clear();
+    for (size_t i = 0; i < resources.size(); ++i)
+    {
+        if(!resources[i].imported && resources[i].firstPass >= 0)
+            used.push_back(static_cast<ResourceId>(i));
+    }
+    std::sort(used.begin(),used.end(),[this](ResourceId a, ResourceId b)
+    {
+        return resources[a].firstPass != resources[b].firstPass ? resources[a].firstPass < resources[b].firstPass : a < b;
+    });
+
+    //The same frame as last time gets the same images and memory
+    bool reuse = used.size() == transientImages.size();
+    for (size_t i = 0; reuse && i < used.size(); ++i)
+    {
+        const Resource& resource = resources[used[i]];
+        reuse = resource.desc == transientImages[i].desc && resource.firstPass == transientImages[i].firstPass &&
+            resource.lastPass == transientImages[i].lastPass;
+    }
+
+    if(!reuse)
+    {
+        //Frames still on the GPU may use the old ones
+        if(!transientImages.empty() || !memorySlots.empty())
+            retiredMemory.push_back({std::move(transientImages),std::move(memorySlots),compileCount + framesInFlight});
+        transientImages.clear();
+        memorySlots.clear();
+        transientImageVersion++;
+
+        for (ResourceId id : used)
+        {
+            const Resource& resource = resources[id];
+
+            VkImageCreateInfo imageCreateInfo{};
+            imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageCreateInfo.extent = {resource.desc.width,resource.desc.height,1};
+            imageCreateInfo.mipLevels = resource.desc.mipLevels;
+            imageCreateInfo.arrayLayers = 1;
+            imageCreateInfo.format = resource.desc.format;
+            imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageCreateInfo.usage = resource.desc.usage;
+            imageCreateInfo.samples = resource.desc.samples;
+            imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            TransientImage transientImage{};
+            transientImage.desc = resource.desc;
+            transientImage.firstPass = resource.firstPass;
+            transientImage.lastPass = resource.lastPass;
+            transientImage.predecessor = -1;
+            if(vkCreateImage(device,&imageCreateInfo,nullptr,&transientImage.image) != VK_SUCCESS)
+                throw std::runtime_error("Failed to create a render graph image");
+
+            VkMemoryRequirements memoryRequirements{};
+            vkGetImageMemoryRequirements(device,transientImage.image,&memoryRequirements);
+
+            //First memory whose images are all done before this one starts (images are bound at the start, so any alignment fits)
+            size_t slot = memorySlots.size();
+            for (size_t i = 0; i < memorySlots.size(); ++i)
+            {
+                if(memorySlots[i].lastPass < resource.firstPass && (memorySlots[i].memoryTypeBits & memoryRequirements.memoryTypeBits))
+                {
+                    slot = i;
+                    break;
+                }
+            }
+            if(slot == memorySlots.size())
+            {
+                MemorySlot newSlot{};
+                newSlot.memoryTypeBits = memoryRequirements.memoryTypeBits;
+                newSlot.transientAttachments = true;
+                newSlot.lastImage = -1;
+                memorySlots.push_back(newSlot);
+            }
+
+            MemorySlot& memorySlot = memorySlots[slot];
+            memorySlot.size = std::max(memorySlot.size,memoryRequirements.size);
+            memorySlot.memoryTypeBits &= memoryRequirements.memoryTypeBits;
+            memorySlot.transientAttachments = memorySlot.transientAttachments &&
+                (resource.desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+            memorySlot.lastPass = resource.lastPass;
+            transientImage.slot = static_cast<uint32_t>(slot);
+            transientImage.predecessor = memorySlot.lastImage;
+            memorySlot.lastImage = static_cast<int>(transientImages.size());
+            transientImages.push_back(transientImage);
+        }
+
+        for (MemorySlot& memorySlot : memorySlots)
+        {
+            VkMemoryAllocateInfo memoryAllocateInfo{};
+            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            memoryAllocateInfo.allocationSize = memorySlot.size;
+            memoryAllocateInfo.memoryTypeIndex = std::numeric_limits<uint32_t>::max();
+            //Tile based GPUs may not have to give images that never leave a render pass any memory
+            if(memorySlot.transientAttachments)
+            {
+                memoryAllocateInfo.memoryTypeIndex = FindMemoryTypeIndex(physicalDevice,memorySlot.memoryTypeBits,
+                    VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            }
+            if(memoryAllocateInfo.memoryTypeIndex == std::numeric_limits<uint32_t>::max())
+            {
+                memoryAllocateInfo.memoryTypeIndex = FindMemoryTypeIndex(physicalDevice,memorySlot.memoryTypeBits,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            }
+            if(memoryAllocateInfo.memoryTypeIndex == std::numeric_limits<uint32_t>::max() ||
+               MemoryBudget::Allocate(physicalDevice,device,memoryAllocateInfo,&memorySlot.memory) != VK_SUCCESS)
+                throw std::runtime_error("Failed to allocate render graph memory");
+        }
+
+        for (TransientImage& transientImage : transientImages)
+        {
+            vkBindImageMemory(device,transientImage.image,memorySlots[transientImage.slot].memory,0);
+
+            VkImageViewCreateInfo viewCreateInfo{};
+            viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewCreateInfo.image = transientImage.image;
+            viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewCreateInfo.format = transientImage.desc.format;
+            viewCreateInfo.components = {VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY,
+                VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY};
+            viewCreateInfo.subresourceRange.aspectMask = transientImage.desc.aspect;
+            viewCreateInfo.subresourceRange.levelCount = transientImage.desc.mipLevels;
+            viewCreateInfo.subresourceRange.layerCount = 1;
+            if(vkCreateImageView(device,&viewCreateInfo,nullptr,&transientImage.view) != VK_SUCCESS)
+                throw std::runtime_error("Failed to create a render graph image view");
+        }
+    }
+
+    for (size_t i = 0; i < used.size(); ++i)
+    {
+        Resource& resource = resources[used[i]];
+        resource.image = transientImages[i].image;
+        resource.view = transientImages[i].view;
+        resource.transientImage = static_cast<int>(i);
+        transientImages[i].resource = used[i];
+    }
+}
+
+void RenderGraph::BuildBarriers()
+{
+    states.assign(resources.size(),State{});
+    for (size_t i = 0; i < resources.size(); ++i)
+    {
+        const Resource& resource = resources[i];
+        State& state = states[i];
+        state.layout = resource.initialLayout;
+
+        if(resource.imported)
+        {
+            if(IsWriteAccess(resource.initialAccess))
+            {
+                state.writeStages = resource.initialStages;
+                state.writeAccess = resource.initialAccess;
+            }
+            else
+            {
+                state.readStages = resource.initialStages;
+            }
+        }
+        else if(resource.transientImage >= 0)
+        {
+            //Memory shared with an image used before this one, which has to be done with it first,
+            //the first image waits for the last one of the previous frame
+            const TransientImage& transientImage = transientImages[resource.transientImage];
+            if(transientImage.predecessor < 0)
+            {
+                state.writeStages = memorySlots[transientImage.slot].endStages;
+                state.writeAccess = memorySlots[transientImage.slot].endAccess;
+            }
+        }
+    }
+
+    for (size_t passIndex = 0; passIndex < passCount; ++passIndex)
+    {
+        Pass& pass = passes[passIndex];
+        pass.barriers.clear();
+        pass.srcStages = 0;
+        pass.dstStages = 0;
+        if(pass.culled)
+            continue;
+
+        for (const PassAccess& access : pass.accesses)
+        {
+            const Resource& resource = resources[access.resource];
+            State& state = states[access.resource];
+            UsageInfo usage = GetUsageInfo(access.usage);
+            bool layoutChange = resource.isImage && state.layout != usage.layout;
+
+            if(resource.transientImage >= 0 && resource.firstPass == static_cast<int>(passIndex))
+            {
+                //The image it shares memory with is finished by now, so waits for whatever used it last
+                const TransientImage& transientImage = transientImages[resource.transientImage];
+                if(transientImage.predecessor >= 0)
+                {
+                    const State& predecessorState = states[transientImages[transientImage.predecessor].resource];
+                    state.writeStages = predecessorState.writeStages | predecessorState.readStages;
+                    state.writeAccess = predecessorState.writeAccess;
+                }
+            }
+
+            if(layoutChange || access.write)
+            {
+                //Writes wait for everything before them, layout changes count as writes
+                VkPipelineStageFlags srcStages = state.writeStages | state.readStages;
+                if(layoutChange || srcStages)
+                {
+                    pass.barriers.push_back({access.resource,state.layout,resource.isImage ? usage.layout : VK_IMAGE_LAYOUT_UNDEFINED,
+                        state.writeAccess,usage.access});
+                    pass.srcStages |= srcStages;
+                    pass.dstStages |= usage.stages;
+                }
+
+                state.layout = resource.isImage ? usage.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+                state.writeStages = usage.stages;
+                state.writeAccess = access.write ? usage.access & ~(VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT) : 0;
+                state.readStages = 0;
+                state.visibleStages = usage.stages;
+                state.visibleAccess = usage.access;
+            }
+            else
+            {
+                //Reads only wait for the last write, and only once for each stage
+                if(state.writeStages && ((usage.stages & ~state.visibleStages) || (usage.access & ~state.visibleAccess)))
+                {
+                    pass.barriers.push_back({access.resource,state.layout,state.layout,state.writeAccess,usage.access});
+                    pass.srcStages |= state.writeStages;
+                    pass.dstStages |= usage.stages;
+                    state.visibleStages |= usage.stages;
+                    state.visibleAccess |= usage.access;
+                }
+                state.readStages |= usage.stages;
+            }
+        }
+    }
+
+    //Imported images that have to be left in a given layout
+    for (size_t i = 0; i < resources.size(); ++i)
+    {
+        const Resource& resource = resources[i];
+        const State& state = states[i];
+        if(resource.imported && resource.isImage && resource.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED && resource.finalLayout != state.layout)
+        {
+            finalBarriers.push_back({static_cast<ResourceId>(i),state.layout,resource.finalLayout,state.writeAccess,0});
+            finalSrcStages |= state.writeStages | state.readStages;
+        }
+
+        //The next frame's first image in the same memory waits for this one
+        if(resource.transientImage >= 0)
+        {
+            const TransientImage& transientImage = transientImages[resource.transientImage];
+            MemorySlot& memorySlot = memorySlots[transientImage.slot];
+            if(memorySlot.lastImage == resource.transientImage)
+            {
+                memorySlot.endStages = state.writeStages | state.readStages;
+                memorySlot.endAccess = state.writeAccess;
+            }
+        }
+    }
+}
+
+void RenderGraph::RecordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers,
+    VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages)
+{
+    if(barriers.empty())
+        return;
+
+    //Images get their own barriers for the layout, buffers share one for the whole memory
+    imageMemoryBarriers.clear();
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    bool bufferBarrier = false;
+
+    for (const Barrier& barrier : barriers)
+    {
+        const Resource& resource = resources[barrier.resource];
+        if(!resource.isImage)
+        {
+            memoryBarrier.srcAccessMask |= barrier.srcAccess;
+            memoryBarrier.dstAccessMask |= barrier.dstAccess;
+            bufferBarrier = true;
+            continue;
+        }
+
+        VkImageMemoryBarrier imageMemoryBarrier{};
+        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageMemoryBarrier.oldLayout = barrier.oldLayout;
+        imageMemoryBarrier.newLayout = barrier.newLayout;
+        imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.image = resource.image;
+        imageMemoryBarrier.subresourceRange.aspectMask = resource.aspect;
+        imageMemoryBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        imageMemoryBarrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+        imageMemoryBarrier.srcAccessMask = barrier.srcAccess;
+        imageMemoryBarrier.dstAccessMask = barrier.dstAccess;
+        imageMemoryBarriers.push_back(imageMemoryBarrier);
+    }
+
+    //Nothing before it to wait for, only a layout change
+    if(!srcStages)
+        srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,srcStages,dstStages,0,bufferBarrier ? 1 : 0,bufferBarrier ? &memoryBarrier : nullptr,
+        0,nullptr,static_cast<uint32_t>(imageMemoryBarriers.size()),imageMemoryBarriers.data());
+}
+
+void RenderGraph::DestroyTransientMemory(std::vector<TransientImage>& images, std::vector<MemorySlot>& slots)
+{
+    for (TransientImage& transientImage : images)
+    {
+        vkDestroyImageView(device,transientImage.view,nullptr);
+        vkDestroyImage(device,transientImage.image,nullptr);
+    }
+    for (MemorySlot& memorySlot : slots)
+        MemoryBudget::Free(device,memorySlot.memory);
+    images.clear();
+    slots.clear();
+}
+
+void RenderGraph::DestroyRetiredMemory(bool all)
+{
+    for (auto retired = retiredMemory.begin(); retired != retiredMemory.end();)
+    {
+        if(all || retired->compileIndex <= compileCount)
+        {
+            DestroyTransientMemory(retired->images,retired->slots);
+            retired = retiredMemory.erase(retired);
+        }
+        else
+        {
+            ++retired;
+        }
+    }
+}
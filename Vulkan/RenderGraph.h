@@ -0,0 +1,238 @@
+﻿#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+//Describes a frame as passes that read and write resources, instead of wiring barriers by hand.
+//Each frame: Reset, import the resources that live outside the graph (and create transient ones), add the passes
+//in the order they run, then Compile and Execute. Compile drops passes nothing needs, works out the barriers
+//between passes from what they declared, and places transient images that are never used at the same time in the same memory.
+//Lists are kept from frame to frame, so describing the same frame again doesn't allocate (names aren't copied, so use literals).
+class RenderGraph
+{
+public:
+    using ResourceId = uint32_t;
+
+    //How a pass uses a resource, decides the layout of images and the stages and access barriers wait for
+    enum class Usage
+    {
+        ColourAttachment,
+        DepthAttachment,
+        ComputeSampled, //Sampled in a compute shader (shader read only layout)
+        ComputeRead, //Read in a compute shader in the general layout (storage buffers and images, or sampled in general)
+        ComputeWrite, //Written (and read) in a compute shader in the general layout
+        FragmentSampled,
+        IndirectRead, //Draw commands and counts
+        TransferRead,
+        TransferWrite
+    };
+
+    struct ImageDesc
+    {
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipLevels;
+        VkSampleCountFlagBits samples;
+        VkImageUsageFlags usage;
+        VkImageAspectFlags aspect;
+
+        bool operator==(const ImageDesc& other) const;
+    };
+
+    //What a pass declares, returned by AddPass
+    class PassBuilder
+    {
+    public:
+        PassBuilder(RenderGraph& newGraph, size_t newPass): graph(newGraph), pass(newPass) {}
+        PassBuilder& Read(ResourceId resource, Usage usage);
+        PassBuilder& Write(ResourceId resource, Usage usage);
+        //Kept even if nothing reads what it writes (e.g. it draws to the swapchain)
+        PassBuilder& SideEffects();
+    private:
+        RenderGraph& graph;
+        size_t pass;
+    };
+
+    RenderGraph();
+
+    //framesInFlight is how many compiles a replaced transient image is kept for, frames may still use it until then
+    void Init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t newFramesInFlight);
+    void Destroy();
+
+    //Starts describing a frame, the passes and resources of the last one are dropped (transient memory and lists are kept for reuse)
+    void Reset();
+
+    //A resource that lives outside the graph, with what last used it before the frame (0 stages for nothing pending).
+    //finalLayout is what an image is left in at the end of the frame, undefined to leave it as its last pass used it
+    ResourceId ImportImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect,
+        VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+    ResourceId ImportBuffer(const char* name, VkBuffer buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+    //Only exists while the passes using it run, its contents don't last from one frame to the next
+    ResourceId CreateImage(const char* name, const ImageDesc& desc);
+    //Kept even if no pass of this frame reads it (e.g. the next frame does)
+    void MarkOutput(ResourceId resource);
+
+    //The pass records its commands in record, which runs in Execute after the barriers it needs
+    PassBuilder AddPass(const char* name, std::function<void(VkCommandBuffer)> record);
+
+    void Compile();
+    void Execute(VkCommandBuffer commandBuffer);
+
+    //Transient images only have these after Compile
+    VkImage GetImage(ResourceId resource) const {return resources[resource].image;}
+    VkImageView GetImageView(ResourceId resource) const {return resources[resource].view;}
+    VkBuffer GetBuffer(ResourceId resource) const {return resources[resource].buffer;}
+
+    //Goes up every time Compile creates new transient images, whatever was made with the old views has to be made again
+    uint64_t GetTransientImageVersion() const {return transientImageVersion;}
+
+    //Of the last compile
+    uint32_t GetCulledPassCount() const;
+    VkDeviceSize GetTransientMemorySize() const;
+
+private:
+    struct UsageInfo
+    {
+        VkImageLayout layout;
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+    };
+
+    struct Resource
+    {
+        const char* name;
+        bool isImage;
+        bool imported;
+        bool output;
+        VkImage image;
+        VkImageView view;
+        VkBuffer buffer;
+        VkImageAspectFlags aspect;
+        ImageDesc desc; //Transient images
+
+        //State before the first pass, and for imported images what to leave them in
+        VkImageLayout initialLayout;
+        VkPipelineStageFlags initialStages;
+        VkAccessFlags initialAccess;
+        VkImageLayout finalLayout;
+
+        //Passes (after culling) that first and last use it, -1 if none does
+        int firstPass;
+        int lastPass;
+        int transientImage; //Index into transientImages, -1 for imported resources
+    };
+
+    struct PassAccess
+    {
+        ResourceId resource;
+        Usage usage;
+        bool write;
+    };
+
+    struct Barrier
+    {
+        ResourceId resource;
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+    };
+
+    struct Pass
+    {
+        const char* name;
+        std::function<void(VkCommandBuffer)> record;
+        std::vector<PassAccess> accesses;
+        bool sideEffects;
+        bool culled;
+
+        //Worked out by Compile, recorded in one vkCmdPipelineBarrier before the pass
+        std::vector<Barrier> barriers;
+        VkPipelineStageFlags srcStages;
+        VkPipelineStageFlags dstStages;
+    };
+
+    //Where a transient image lives, shared by images whose passes don't overlap
+    struct MemorySlot
+    {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint32_t memoryTypeBits;
+        bool transientAttachments; //Every image in it never leaves a render pass, so it can be lazily allocated
+        int lastPass;
+        int lastImage;
+
+        //What the last image in it was last used by, the next frame's first image waits on them
+        VkPipelineStageFlags endStages;
+        VkAccessFlags endAccess;
+    };
+
+    struct TransientImage
+    {
+        ImageDesc desc;
+        int firstPass;
+        int lastPass;
+        VkImage image;
+        VkImageView view;
+        uint32_t slot;
+        int predecessor; //Image in the same memory used before this one, -1 if it's the first
+        ResourceId resource; //Of this frame
+    };
+
+    struct RetiredMemory
+    {
+        std::vector<TransientImage> images;
+        std::vector<MemorySlot> slots;
+        uint64_t compileIndex; //Destroyed once Compile has run this many times
+    };
+
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t framesInFlight;
+    uint64_t compileCount;
+    uint64_t transientImageVersion;
+
+    //What each resource was last used for while BuildBarriers walks through the passes
+    struct State
+    {
+        VkImageLayout layout;
+        VkPipelineStageFlags writeStages;
+        VkAccessFlags writeAccess;
+        VkPipelineStageFlags readStages; //Read since the last write
+        VkPipelineStageFlags visibleStages; //Reads the last write is already visible to
+        VkAccessFlags visibleAccess;
+    };
+
+    std::vector<Resource> resources;
+    //Passes of the frame are the first passCount, the ones after are left from bigger frames so their lists can be reused
+    std::vector<Pass> passes;
+    size_t passCount;
+    std::vector<Barrier> finalBarriers; //Imported images going to their final layout
+    VkPipelineStageFlags finalSrcStages;
+
+    //Kept from compile to compile while the transient images of the frame stay the same
+    std::vector<TransientImage> transientImages;
+    std::vector<MemorySlot> memorySlots;
+    std::vector<RetiredMemory> retiredMemory;
+
+    //Scratch lists of Compile and Execute, kept so they only allocate while growing
+    std::vector<bool> neededResources;
+    std::vector<ResourceId> usedTransientImages;
+    std::vector<State> states;
+    std::vector<VkImageMemoryBarrier> imageMemoryBarriers;
+
+    static UsageInfo GetUsageInfo(Usage usage);
+    static bool IsWriteAccess(VkAccessFlags access);
+
+    void CullPasses();
+    void FindLifetimes();
+    void AllocateTransientImages();
+    void BuildBarriers();
+    void RecordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers,
+        VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages);
+    void DestroyTransientMemory(std::vector<TransientImage>& images, std::vector<MemorySlot>& slots);
+    void DestroyRetiredMemory(bool all);
+};
@@ -0,0 +1,65 @@
+﻿#include "SceneGraph.h"
+
+#include <stdexcept>
+
+SceneGraph::SceneGraph(): anyDirty(false)
+{
+}
+
+uint32_t SceneGraph::AddNode(uint32_t parent, const glm::mat4& localTransform, const std::string& name)
+{
+    if(parent != NO_NODE && parent >= parents.size())
+        throw std::runtime_error("Attempted to add a scene node to an unknown parent!");
+
+    uint32_t node = static_cast<uint32_t>(parents.size());
+    parents.push_back(parent);
+    localTransforms.push_back(localTransform);
+    worldTransforms.push_back(localTransform);
+    dirty.push_back(1);
+    updated.push_back(0);
+    names.push_back(name);
+    anyDirty = true;
+    return node;
+}
+
+uint32_t SceneGraph::FindNode(const std::string& name) const
+{
+    for (uint32_t i = 0; i < names.size(); ++i)
+    {
+        if(names[i] == name)
+            return i;
+    }
+    return NO_NODE;
+}
+
+void SceneGraph::SetLocalTransform(uint32_t node, const glm::mat4& localTransform)
+{
+    if(node >= parents.size())
+        throw std::runtime_error("Attempted to transform an invalid scene node!");
+
+    localTransforms[node] = localTransform;
+    dirty[node] = 1;
+    anyDirty = true;
+}
+
+bool SceneGraph::UpdateWorldTransforms()
+{
+    if(!anyDirty)
+        return false;
+
+    //Parents come first, so their world transform is always final by the time their children are reached
+    for (size_t i = 0; i < parents.size(); ++i)
+    {
+        uint32_t parent = parents[i];
+        bool changed = dirty[i] || (parent != NO_NODE && updated[parent]);
+        updated[i] = changed;
+        if(!changed)
+            continue;
+
+        worldTransforms[i] = parent == NO_NODE ? localTransforms[i] : worldTransforms[parent] * localTransforms[i];
+        dirty[i] = 0;
+    }
+
+    anyDirty = false;
+    return true;
+}
@@ -0,0 +1,44 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+//Node hierarchy of a model (as it came out of Assimp), kept in flat arrays where every parent comes before its children.
+//Local transforms are set per node, world transforms are brought up to date in one pass over the arrays
+//and only recomputed for nodes whose own transform or an ancestor's changed since the last update.
+class SceneGraph
+{
+public:
+    static const uint32_t NO_NODE = UINT32_MAX;
+
+    SceneGraph();
+
+    //The parent has to exist already (or be NO_NODE for a root), which keeps parents before children
+    uint32_t AddNode(uint32_t parent, const glm::mat4& localTransform, const std::string& name = "");
+
+    uint32_t GetNodeCount() const {return static_cast<uint32_t>(parents.size());}
+    uint32_t GetParent(uint32_t node) const {return parents[node];}
+    const std::string& GetName(uint32_t node) const {return names[node];}
+    //First node with this name, or NO_NODE
+    uint32_t FindNode(const std::string& name) const;
+
+    void SetLocalTransform(uint32_t node, const glm::mat4& localTransform);
+    const glm::mat4& GetLocalTransform(uint32_t node) const {return localTransforms[node];}
+    //As of the last UpdateWorldTransforms
+    const glm::mat4& GetWorldTransform(uint32_t node) const {return worldTransforms[node];}
+
+    //Returns false if nothing changed since the last update
+    bool UpdateWorldTransforms();
+    //World transform was recomputed by the last update that returned true
+    bool WasUpdated(uint32_t node) const {return updated[node] != 0;}
+
+private:
+    std::vector<uint32_t> parents;
+    std::vector<glm::mat4> localTransforms;
+    std::vector<glm::mat4> worldTransforms;
+    std::vector<uint8_t> dirty; //Local transform changed
+    std::vector<uint8_t> updated;
+    std::vector<std::string> names;
+    bool anyDirty;
+};
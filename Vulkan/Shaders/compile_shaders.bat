@@ -1,3 +1,7 @@
 C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V shader.vert
 C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V shader.frag
+C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V cull.comp -o cull.spv
+C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V cullmesh.comp -o cullmesh.spv
+C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V depthreduce.comp -o depthreduce.spv
+C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V depth.vert -o depth.spv
 pause
\ No newline at end of file
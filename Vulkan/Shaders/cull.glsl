@@ -0,0 +1,94 @@
+//Shared by the culling shaders: the per frame culling data and the frustum and occlusion tests
+
+//Same layout as VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout(set = 0, binding = 0) uniform UboCulling
+{
+    vec4 frustumPlanes[6];
+    vec4 cameraPosition;
+    mat4 view;
+    mat4 projection;
+    vec4 depthPyramidSize;  //xy size of the top level, z is 1 when it holds the last frame's depth
+} uboCulling;
+
+layout(set = 0, binding = 1) writeonly buffer DrawCommands
+{
+    DrawCommand commands[];
+} drawCommands;
+
+layout(set = 0, binding = 2) buffer DrawCounts
+{
+    uint counts[];
+} drawCounts;
+
+//Farthest depth of every block of the last frame's depth buffer, one level for each block size
+//(this frame's, for the second pass of mesh culling)
+layout(set = 0, binding = 3) uniform sampler2D depthPyramid;
+
+//World space sphere at least partly inside all six frustum planes
+bool IsInsideFrustum(vec3 centre, float radius)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        if(dot(uboCulling.frustumPlanes[i].xyz,centre) + uboCulling.frustumPlanes[i].w < -radius)
+            return false;
+    }
+    return true;
+}
+
+//World space sphere behind everything the depth pyramid holds over its screen rectangle
+bool IsBehindDepthPyramid(vec3 centre, float radius)
+{
+    //The camera looks down -z, so the closest point of the sphere has the biggest z
+    vec3 viewCentre = (uboCulling.view * vec4(centre,1.0)).xyz;
+    vec4 nearClip = uboCulling.projection * vec4(viewCentre.xy,viewCentre.z + radius,1.0);
+    if(nearClip.w <= 0.0 || nearClip.z < 0.0 || nearClip.z > nearClip.w)
+        return false; //Crosses the near plane (depth below 0, or above 1 with reverse depth)
+    float sphereDepth = nearClip.z / nearClip.w;
+    bool reverseDepth = uboCulling.depthPyramidSize.w != 0.0;
+
+    //Screen rectangle of the box around the sphere, x/z and y/z are largest at its corners
+    vec2 ndcMin = vec2(1e30);
+    vec2 ndcMax = vec2(-1e30);
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = viewCentre + radius * vec3((i & 1) != 0 ? 1.0 : -1.0,(i & 2) != 0 ? 1.0 : -1.0,(i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = uboCulling.projection * vec4(corner,1.0);
+        ndcMin = min(ndcMin,clip.xy / clip.w);
+        ndcMax = max(ndcMax,clip.xy / clip.w);
+    }
+    vec2 uvMin = clamp(ndcMin * 0.5 + 0.5,0.0,1.0);
+    vec2 uvMax = clamp(ndcMax * 0.5 + 0.5,0.0,1.0);
+
+    //Level where the rectangle is at most one texel across, so it touches at most 2x2 texels
+    vec2 size = (uvMax - uvMin) * uboCulling.depthPyramidSize.xy;
+    int level = int(ceil(log2(max(max(size.x,size.y),1.0))));
+    level = min(level,textureQueryLevels(depthPyramid) - 1);
+
+    ivec2 levelSize = textureSize(depthPyramid,level);
+    ivec2 texelMin = clamp(ivec2(uvMin * vec2(levelSize)),ivec2(0),levelSize - 1);
+    ivec2 texelMax = clamp(ivec2(uvMax * vec2(levelSize)),ivec2(0),levelSize - 1);
+    vec4 depths = vec4(texelFetch(depthPyramid,texelMin,level).r,texelFetch(depthPyramid,ivec2(texelMax.x,texelMin.y),level).r,
+                       texelFetch(depthPyramid,ivec2(texelMin.x,texelMax.y),level).r,texelFetch(depthPyramid,texelMax,level).r);
+
+    //Hidden when even its closest point is farther than the farthest depth drawn over it (smaller with reverse depth)
+    if(reverseDepth)
+        return sphereDepth < min(min(depths.x,depths.y),min(depths.z,depths.w));
+    return sphereDepth > max(max(depths.x,depths.y),max(depths.z,depths.w));
+}
+
+//World space sphere behind everything that was drawn over its screen rectangle last frame
+bool IsOccluded(vec3 centre, float radius)
+{
+    if(uboCulling.depthPyramidSize.z == 0.0)
+        return false;
+    return IsBehindDepthPyramid(centre,radius);
+}
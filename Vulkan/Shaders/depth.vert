@@ -0,0 +1,23 @@
+#version 450    //Use GLSL 4.5
+
+//Depth pre-pass: positions only, the transform has to match shader.vert exactly
+
+layout(location = 0) in vec3 pos;
+
+layout(set = 0,binding = 0) uniform  UboViewProjection
+{
+    mat4 projection;
+    mat4 view; 
+} uboViewProjection;
+
+layout(push_constant) uniform PushModel
+{
+    mat4 model;
+}pushModel;
+
+invariant gl_Position;
+
+void main()
+{
+    gl_Position =uboViewProjection.projection*uboViewProjection.view*pushModel.model*vec4(pos,1.0);
+}
@@ -25,6 +25,9 @@ layout(push_constant) uniform PushModel
 
 
 
+//Same position as depth.vert to the bit, so fragments pass the EQUAL test after the depth pre-pass
+invariant gl_Position;
+
 layout(location = 0) out vec3 fragCol;
 layout(location = 1) out vec2 fragTex;
 
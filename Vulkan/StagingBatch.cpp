@@ -0,0 +1,135 @@
+﻿#include "StagingBatch.h"
+
+#include <cstring>
+
+#include <algorithm>
+
+#include "QueueTimeline.h"
+#include "Utilities.h"
+
+//Staging buffers are made at least this big, so a model's many small buffers share a few of them
+const VkDeviceSize STAGING_BUFFER_SIZE = 4ull * 1024 * 1024;
+
+StagingBatch::StagingBatch(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice): physicalDevice(newPhysicalDevice),
+    device(newDevice), commandPool(VK_NULL_HANDLE), commandBuffer(VK_NULL_HANDLE)
+{
+}
+
+void StagingBatch::Add(VkBuffer dstBuffer, const void* newData, VkDeviceSize size)
+{
+    if(size == 0)
+        return;
+
+    memcpy(Allocate(dstBuffer,size),newData,static_cast<size_t>(size));
+}
+
+void* StagingBatch::Allocate(VkBuffer dstBuffer, VkDeviceSize size)
+{
+    if(size == 0)
+        return nullptr;
+
+    //Each copy starts 16 byte aligned in its staging buffer
+    VkDeviceSize srcOffset = 0;
+    if(!stagingBuffers.empty())
+        srcOffset = (stagingBuffers.back().used + 15) & ~VkDeviceSize(15);
+
+    //Doesn't fit in the last one, start a new one (bigger data gets one of its own size)
+    if(stagingBuffers.empty() || srcOffset + size > stagingBuffers.back().size)
+    {
+        StagingBuffer stagingBuffer{};
+        stagingBuffer.size = std::max(size,STAGING_BUFFER_SIZE);
+        CreateBuffer(physicalDevice,device,stagingBuffer.size,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &stagingBuffer.buffer,&stagingBuffer.memory);
+
+        void* mappedData;
+        vkMapMemory(device,stagingBuffer.memory,0,stagingBuffer.size,0,&mappedData);
+        stagingBuffer.mappedData = static_cast<uint8_t*>(mappedData);
+        stagingBuffers.push_back(stagingBuffer);
+        srcOffset = 0;
+    }
+
+    StagingBuffer& stagingBuffer = stagingBuffers.back();
+    stagingBuffer.used = srcOffset + size;
+    copies.push_back({stagingBuffer.buffer,dstBuffer,srcOffset,size});
+    return stagingBuffer.mappedData + srcOffset;
+}
+
+void StagingBatch::Submit(VkQueue transferQueue, VkCommandPool transferCommandPool, QueueTimeline* timeline)
+{
+    if(copies.empty())
+        return;
+
+    RecordCopies(transferCommandPool);
+    if(timeline)
+    {
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        timeline->Wait(timeline->Submit(submitInfo));
+    }
+    else
+    {
+        //Frees the command buffer itself
+        EndAndSubmitCommandBuffer(device,transferCommandPool,transferQueue,commandBuffer);
+        commandBuffer = VK_NULL_HANDLE;
+    }
+
+    Release();
+}
+
+uint64_t StagingBatch::SubmitAsync(VkCommandPool transferCommandPool, QueueTimeline& timeline)
+{
+    if(copies.empty())
+        return 0;
+
+    RecordCopies(transferCommandPool);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    return timeline.Submit(submitInfo);
+}
+
+void StagingBatch::Release()
+{
+    if(commandBuffer)
+        vkFreeCommandBuffers(device,commandPool,1,&commandBuffer);
+    commandBuffer = VK_NULL_HANDLE;
+
+    for (const StagingBuffer& stagingBuffer : stagingBuffers)
+    {
+        vkUnmapMemory(device,stagingBuffer.memory);
+        MemoryBudget::Free(device,stagingBuffer.memory);
+        vkDestroyBuffer(device,stagingBuffer.buffer,nullptr);
+    }
+    stagingBuffers.clear();
+    copies.clear();
+}
+
+StagingBatch::~StagingBatch()
+{
+    Release();
+}
+
+void StagingBatch::RecordCopies(VkCommandPool transferCommandPool)
+{
+    //The data is already in the staging buffers, only the copies are left
+    commandPool = transferCommandPool;
+    commandBuffer = BeginCommandBuffer(device,transferCommandPool);
+    for (const Copy& copy : copies)
+    {
+        VkBufferCopy bufferCopyRegion = {};
+        bufferCopyRegion.srcOffset = copy.srcOffset;
+        bufferCopyRegion.dstOffset = 0;
+        bufferCopyRegion.size = copy.size;
+        vkCmdCopyBuffer(commandBuffer,copy.srcBuffer,copy.dstBuffer,1,&bufferCopyRegion);
+        FrameCounters::CountUpload(copy.size);
+    }
+    copies.clear();
+}
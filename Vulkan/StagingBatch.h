@@ -0,0 +1,67 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+class QueueTimeline;
+
+//Collects data for several device local buffers and uploads it all through a few big staging buffers,
+//one command buffer and one wait, instead of a staging buffer and a queue wait per buffer.
+//The staging buffers stay mapped, so data is written into them as it's added and never kept anywhere else
+class StagingBatch
+{
+public:
+    StagingBatch(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice);
+    StagingBatch(const StagingBatch&) = delete;
+    StagingBatch& operator=(const StagingBatch&) = delete;
+
+    //Data is copied into the staging memory now, dstBuffer gets it when the batch is submitted
+    void Add(VkBuffer dstBuffer, const void* data, VkDeviceSize size);
+    //Staging memory for size bytes of dstBuffer, for data that is converted on the way (fill it before submitting).
+    //Null when size is 0
+    void* Allocate(VkBuffer dstBuffer, VkDeviceSize size);
+    bool IsEmpty() const {return copies.empty();}
+
+    //Records every copy, submits them and waits for the transfer to finish, the batch is empty again afterwards.
+    //With the queue's timeline only the transfer is waited for, not everything else on the queue
+    void Submit(VkQueue transferQueue, VkCommandPool transferCommandPool, QueueTimeline* timeline = nullptr);
+    //Submits without waiting and returns the timeline value the copies are done at (0 if there was nothing to copy).
+    //The staging buffers and command buffer are kept until Release, which may only be called once the timeline has reached it
+    uint64_t SubmitAsync(VkCommandPool transferCommandPool, QueueTimeline& timeline);
+    //Frees the staging memory and forgets any copies not submitted yet, the batch can be filled again afterwards
+    void Release();
+
+    ~StagingBatch();
+
+private:
+    struct StagingBuffer
+    {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        uint8_t* mappedData;
+        VkDeviceSize size;
+        VkDeviceSize used;
+    };
+
+    struct Copy
+    {
+        VkBuffer srcBuffer;
+        VkBuffer dstBuffer;
+        VkDeviceSize srcOffset;
+        VkDeviceSize size;
+    };
+
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+
+    std::vector<StagingBuffer> stagingBuffers;
+    std::vector<Copy> copies;
+
+    //Of the submitted copies, until they're released
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+
+    //Records every copy into a new command buffer, ready to be ended
+    void RecordCopies(VkCommandPool transferCommandPool);
+};
@@ -0,0 +1,111 @@
+﻿#include "TextureCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+int TextureCache::FindByPath(const std::string& resolvedPath) const
+{
+    auto it = pathToTexture.find(resolvedPath);
+    return it != pathToTexture.end() ? it->second : -1;
+}
+
+int TextureCache::FindByContent(uint64_t contentHash, const std::vector<char>& content) const
+{
+    auto range = contentToTexture.equal_range(contentHash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const std::vector<char>& entryContent = *entries.at(it->second).content;
+        if(entryContent.size() == content.size() && memcmp(entryContent.data(),content.data(),content.size()) == 0)
+            return it->second;
+    }
+    return -1;
+}
+
+void TextureCache::Add(const std::string& resolvedPath, uint64_t contentHash, std::shared_ptr<const std::vector<char>> content, int textureId)
+{
+    Entry entry{};
+    entry.contentHash = contentHash;
+    entry.content = std::move(content);
+    entry.refCount = 1;
+    entry.paths.push_back(resolvedPath);
+
+    entries[textureId] = entry;
+    pathToTexture[resolvedPath] = textureId;
+    contentToTexture.emplace(contentHash,textureId);
+}
+
+void TextureCache::AddPath(const std::string& resolvedPath, int textureId)
+{
+    auto it = entries.find(textureId);
+    if(it == entries.end())
+        throw std::runtime_error("Attempted to add a path to an unknown texture!");
+
+    it->second.paths.push_back(resolvedPath);
+    pathToTexture[resolvedPath] = textureId;
+}
+
+void TextureCache::AddRef(int textureId)
+{
+    auto it = entries.find(textureId);
+    if(it == entries.end())
+        throw std::runtime_error("Attempted to reference an unknown texture!");
+
+    it->second.refCount++;
+}
+
+bool TextureCache::Release(int textureId)
+{
+    auto it = entries.find(textureId);
+    if(it == entries.end())
+        throw std::runtime_error("Attempted to release an unknown texture!");
+
+    if(--it->second.refCount > 0)
+        return false;
+
+    //Last user gone, forget every way of reaching this texture
+    for (const std::string& path : it->second.paths)
+        pathToTexture.erase(path);
+
+    auto range = contentToTexture.equal_range(it->second.contentHash);
+    for (auto contentIt = range.first; contentIt != range.second; ++contentIt)
+    {
+        if(contentIt->second == textureId)
+        {
+            contentToTexture.erase(contentIt);
+            break;
+        }
+    }
+
+    entries.erase(it);
+    return true;
+}
+
+uint32_t TextureCache::GetRefCount(int textureId) const
+{
+    auto it = entries.find(textureId);
+    return it != entries.end() ? it->second.refCount : 0;
+}
+
+std::string TextureCache::ResolvePath(const std::string& path)
+{
+    //weakly_canonical removes "..", "." and duplicated separators even if part of the path doesn't exist
+    std::error_code error;
+    std::filesystem::path resolved = std::filesystem::weakly_canonical(std::filesystem::absolute(path,error),error);
+    if(error)
+        return path;
+
+    return resolved.generic_string();
+}
+
+uint64_t TextureCache::HashContent(const std::vector<char>& content)
+{
+    //64 bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (char byte : content)
+    {
+        hash ^= static_cast<uint8_t>(byte);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
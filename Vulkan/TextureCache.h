@@ -0,0 +1,46 @@
+﻿#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Keeps track of which texture ids are already loaded so the same image is only uploaded once.
+//Textures are looked up by resolved file path first and then by the file contents (found by hash, then compared
+//byte for byte), so a file reached through two different paths (or copied under another name) is still shared.
+class TextureCache
+{
+public:
+    //Texture id already holding this resolved path, or -1
+    int FindByPath(const std::string& resolvedPath) const;
+    //Texture id already holding an image with exactly this content, or -1
+    int FindByContent(uint64_t contentHash, const std::vector<char>& content) const;
+
+    //Register a newly created texture, starting with one reference. The content is kept to compare against
+    void Add(const std::string& resolvedPath, uint64_t contentHash, std::shared_ptr<const std::vector<char>> content, int textureId);
+    //Make another path point to an existing texture (doesn't add a reference)
+    void AddPath(const std::string& resolvedPath, int textureId);
+
+    void AddRef(int textureId);
+    //Drops one reference, returns true when it was the last one and the texture should be destroyed
+    bool Release(int textureId);
+
+    uint32_t GetRefCount(int textureId) const;
+
+    static std::string ResolvePath(const std::string& path);
+    static uint64_t HashContent(const std::vector<char>& content);
+
+private:
+    struct Entry
+    {
+        uint64_t contentHash;
+        std::shared_ptr<const std::vector<char>> content;
+        uint32_t refCount;
+        std::vector<std::string> paths;
+    };
+
+    std::unordered_map<int,Entry> entries;
+    std::unordered_map<std::string,int> pathToTexture;
+    //Different files can have the same hash, so the contents are compared on lookup
+    std::unordered_multimap<uint64_t,int> contentToTexture;
+};
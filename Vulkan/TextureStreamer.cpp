@@ -0,0 +1,364 @@
+﻿#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "stb_image.h"
+
+//Textures nobody has drawn for this many frames give back all their mips when memory is short
+const uint64_t UNUSED_TEXTURE_FRAMES = 120;
+
+TextureStreamer::TextureStreamer(ThreadPool& newThreadPool): threadPool(newThreadPool), nextRequestId(0),
+    residentBytes(0), jobsInFlight(0)
+{
+}
+
+void TextureStreamer::Request(int textureId, const std::string& fileName, std::shared_ptr<const std::vector<char>> fileData)
+{
+    StreamedTexture& texture = textures[textureId];
+    texture = StreamedTexture{};
+    texture.requestId = nextRequestId++;
+    texture.fileName = fileName;
+    texture.fileData = std::move(fileData);
+    texture.decoded = false;
+    texture.residentMip = 0;
+    texture.requestedMip = 0;
+
+    StartDecode(textureId,texture);
+}
+
+void TextureStreamer::StartDecode(int textureId, StreamedTexture& texture)
+{
+    texture.decoding = true;
+    {
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        jobsInFlight++;
+    }
+
+    threadPool.Submit([this,textureId,requestId = texture.requestId,fileName = texture.fileName,fileData = texture.fileData]()
+    {
+        //Whatever happens below, the destructor mustn't be left waiting for this job
+        struct JobFinished
+        {
+            TextureStreamer* streamer;
+            ~JobFinished()
+            {
+                std::lock_guard<std::mutex> lock(streamer->decodedMutex);
+                streamer->jobsInFlight--;
+                streamer->jobsFinished.notify_all();
+            }
+        } jobFinished{this};
+
+        DecodedTexture decoded{};
+        decoded.textureId = textureId;
+        decoded.requestId = requestId;
+        decoded.fileName = fileName;
+
+        int width, height, channels;
+        stbi_uc* image = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(fileData->data()),static_cast<int>(fileData->size()),
+            &width,&height,&channels,STBI_rgb_alpha);
+
+        if(image)
+        {
+            try
+            {
+                BuildMipChain(image,width,height,decoded.pixels,decoded.mips);
+            }
+            catch (const std::exception& e)
+            {
+                //Usually bad_alloc on a very big image, it keeps the placeholder like a file that can't be read
+                decoded.pixels = {};
+                decoded.mips = {};
+                decoded.error = "Failed to build the mips of a texture file "+fileName+": "+e.what();
+            }
+            stbi_image_free(image);
+        }
+        else
+        {
+            decoded.error = "Failed to load a texture file "+fileName;
+        }
+
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        decodedTextures.push_back(std::move(decoded));
+    });
+}
+
+void TextureStreamer::Remove(int textureId)
+{
+    auto it = textures.find(textureId);
+    if(it == textures.end())
+        return;
+
+    //A decode still running for it is thrown away in CollectDecoded (request id no longer matches)
+    if(it->second.decoded)
+        residentBytes -= GetResidencyBytes(it->second,it->second.residentMip);
+    textures.erase(it);
+}
+
+void TextureStreamer::CollectDecoded()
+{
+    {
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        collectedTextures.swap(decodedTextures);
+    }
+
+    for (DecodedTexture& decoded : collectedTextures)
+    {
+        auto it = textures.find(decoded.textureId);
+        if(it == textures.end() || it->second.requestId != decoded.requestId)
+            continue;
+
+        StreamedTexture& texture = it->second;
+        texture.decoding = false;
+        if(!decoded.error.empty())
+        {
+            //Keep showing the placeholder (or the mips it has) rather than stopping the frame loop, and don't try again
+            std::cerr << decoded.error << std::endl;
+            texture.fileData.reset();
+            continue;
+        }
+
+        //Decoded again to get more mips, everything else about it is still the same
+        if(texture.decoded)
+        {
+            texture.pixels = std::move(decoded.pixels);
+            continue;
+        }
+
+        texture.decoded = true;
+        texture.pixels = std::move(decoded.pixels);
+        texture.mips = std::move(decoded.mips);
+
+        //Nothing on the GPU yet
+        texture.residentMip = static_cast<uint32_t>(texture.mips.size());
+        texture.requestedMip = texture.residentMip;
+    }
+    collectedTextures.clear();
+}
+
+void TextureStreamer::MarkUsed(int textureId, float screenSize, uint64_t frame)
+{
+    auto it = textures.find(textureId);
+    if(it == textures.end() || !it->second.decoded)
+        return;
+
+    StreamedTexture& texture = it->second;
+    uint32_t lastMip = static_cast<uint32_t>(texture.mips.size()-1);
+
+    //Smallest level that still has at least one texel for every pixel it covers
+    uint32_t mip = lastMip;
+    if(screenSize >= 1.0f)
+    {
+        float textureSize = static_cast<float>(std::max(texture.mips[0].width,texture.mips[0].height));
+        float level = std::floor(std::log2(textureSize/screenSize));
+        mip = static_cast<uint32_t>(std::clamp(level,0.0f,static_cast<float>(lastMip)));
+    }
+
+    //First use this frame replaces last frame's request, later uses keep the most detailed one
+    if(texture.requestFrame != frame)
+    {
+        texture.requestFrame = frame;
+        texture.requestedMip = mip;
+    }
+    else
+    {
+        texture.requestedMip = std::min(texture.requestedMip,mip);
+    }
+    texture.lastUsedFrame = frame;
+}
+
+void TextureStreamer::PlanResidency(uint64_t frame, uint64_t memoryBudget, size_t maxChanges, std::vector<ResidencyChange>& changes)
+{
+    changes.clear();
+    uint64_t plannedBytes = residentBytes;
+
+    //Textures seen last frame that want more detail than they have, biggest difference first
+    wantMore.clear();
+    //Textures holding GPU memory, least recently used first
+    holdingMemory.clear();
+    for (const auto& pair : textures)
+    {
+        const StreamedTexture& texture = pair.second;
+        if(!texture.decoded)
+            continue;
+
+        if(texture.lastUsedFrame + 1 >= frame && texture.requestedMip < texture.residentMip)
+            wantMore.push_back(pair.first);
+        if(texture.residentMip < texture.mips.size())
+            holdingMemory.push_back(pair.first);
+    }
+
+    std::sort(wantMore.begin(),wantMore.end(),[this](int a, int b)
+    {
+        const StreamedTexture& textureA = textures.at(a);
+        const StreamedTexture& textureB = textures.at(b);
+        return textureA.residentMip - textureA.requestedMip > textureB.residentMip - textureB.requestedMip;
+    });
+
+    for (int textureId : wantMore)
+    {
+        if(changes.size() >= maxChanges)
+            break;
+
+        //Its mip chain was dropped, it has to be decoded again first
+        StreamedTexture& texture = textures.at(textureId);
+        if(texture.pixels.empty())
+        {
+            if(!texture.decoding && texture.fileData)
+                StartDecode(textureId,texture);
+            continue;
+        }
+
+        //Go as close to the requested level as the budget allows
+        uint64_t currentBytes = GetResidencyBytes(texture,texture.residentMip);
+        for (uint32_t mip = texture.requestedMip; mip < texture.residentMip; ++mip)
+        {
+            uint64_t extraBytes = GetResidencyBytes(texture,mip) - currentBytes;
+            if(plannedBytes + extraBytes <= memoryBudget)
+            {
+                changes.push_back({textureId,mip});
+                plannedBytes += extraBytes;
+                break;
+            }
+        }
+    }
+
+    if(plannedBytes <= memoryBudget)
+        return;
+
+    //Over budget (e.g. the budget was lowered): take top mips away from the textures used least recently
+    std::sort(holdingMemory.begin(),holdingMemory.end(),[this](int a, int b)
+    {
+        const StreamedTexture& textureA = textures.at(a);
+        const StreamedTexture& textureB = textures.at(b);
+        if(textureA.lastUsedFrame != textureB.lastUsedFrame)
+            return textureA.lastUsedFrame < textureB.lastUsedFrame;
+        return textureA.residentMip < textureB.residentMip;
+    });
+
+    for (int textureId : holdingMemory)
+    {
+        if(plannedBytes <= memoryBudget || changes.size() >= maxChanges)
+            break;
+
+        const StreamedTexture& texture = textures.at(textureId);
+        uint32_t mipCount = static_cast<uint32_t>(texture.mips.size());
+
+        //Unused for a while: back to the placeholder, otherwise drop the top level
+        uint32_t newMip = texture.lastUsedFrame + UNUSED_TEXTURE_FRAMES < frame ? mipCount : texture.residentMip + 1;
+        plannedBytes -= GetResidencyBytes(texture,texture.residentMip) - GetResidencyBytes(texture,newMip);
+        changes.push_back({textureId,newMip});
+    }
+}
+
+void TextureStreamer::SetResident(int textureId, uint32_t residentMip)
+{
+    StreamedTexture& texture = textures.at(textureId);
+    residentBytes -= GetResidencyBytes(texture,texture.residentMip);
+    residentBytes += GetResidencyBytes(texture,residentMip);
+    texture.residentMip = residentMip;
+
+    //Has what it asked for, the GPU holds every mip it needs (and fewer are copied on the GPU)
+    if(residentMip <= texture.requestedMip)
+        std::vector<uint8_t>().swap(texture.pixels);
+}
+
+bool TextureStreamer::IsDecoded(int textureId) const
+{
+    auto it = textures.find(textureId);
+    return it != textures.end() && it->second.decoded;
+}
+
+bool TextureStreamer::HasPixels(int textureId) const
+{
+    return !textures.at(textureId).pixels.empty();
+}
+
+uint32_t TextureStreamer::GetResidentMip(int textureId) const
+{
+    return textures.at(textureId).residentMip;
+}
+
+uint32_t TextureStreamer::GetMipCount(int textureId) const
+{
+    return static_cast<uint32_t>(textures.at(textureId).mips.size());
+}
+
+const TextureStreamer::MipLevel& TextureStreamer::GetMip(int textureId, uint32_t mip) const
+{
+    return textures.at(textureId).mips[mip];
+}
+
+const uint8_t* TextureStreamer::GetPixels(int textureId) const
+{
+    return textures.at(textureId).pixels.data();
+}
+
+uint64_t TextureStreamer::GetResidencyBytes(const StreamedTexture& texture, uint32_t residentMip) const
+{
+    if(residentMip >= texture.mips.size())
+        return 0;
+
+    //Levels are stored smallest last, so everything from residentMip on is one contiguous block
+    const MipLevel& lastMip = texture.mips.back();
+    return lastMip.offset + lastMip.size - texture.mips[residentMip].offset;
+}
+
+void TextureStreamer::BuildMipChain(const uint8_t* basePixels, uint32_t width, uint32_t height,
+    std::vector<uint8_t>& pixels, std::vector<MipLevel>& mips)
+{
+    //Work out the size of every level first so the pixels are allocated once
+    size_t totalSize = 0;
+    for (uint32_t mipWidth = width, mipHeight = height;; mipWidth = std::max(mipWidth/2,1u), mipHeight = std::max(mipHeight/2,1u))
+    {
+        MipLevel level{};
+        level.width = mipWidth;
+        level.height = mipHeight;
+        level.offset = totalSize;
+        level.size = static_cast<size_t>(mipWidth) * mipHeight * 4;
+        mips.push_back(level);
+        totalSize += level.size;
+
+        if(mipWidth == 1 && mipHeight == 1)
+            break;
+    }
+
+    pixels.resize(totalSize);
+    memcpy(pixels.data(),basePixels,mips[0].size);
+
+    //Each level is a 2x2 box filter of the one above (edge texels are repeated on odd sizes)
+    for (size_t i = 1; i < mips.size(); ++i)
+    {
+        const MipLevel& src = mips[i-1];
+        const MipLevel& dst = mips[i];
+        const uint8_t* srcPixels = pixels.data() + src.offset;
+        uint8_t* dstPixels = pixels.data() + dst.offset;
+
+        for (uint32_t y = 0; y < dst.height; ++y)
+        {
+            uint32_t y0 = std::min(y*2,src.height-1);
+            uint32_t y1 = std::min(y*2+1,src.height-1);
+            for (uint32_t x = 0; x < dst.width; ++x)
+            {
+                uint32_t x0 = std::min(x*2,src.width-1);
+                uint32_t x1 = std::min(x*2+1,src.width-1);
+                for (uint32_t c = 0; c < 4; ++c)
+                {
+                    uint32_t sum = srcPixels[(y0*src.width + x0)*4 + c] + srcPixels[(y0*src.width + x1)*4 + c] +
+                                   srcPixels[(y1*src.width + x0)*4 + c] + srcPixels[(y1*src.width + x1)*4 + c];
+                    dstPixels[(y*dst.width + x)*4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    //Workers hold a pointer to us until their decode is handed over
+    std::unique_lock<std::mutex> lock(decodedMutex);
+    jobsFinished.wait(lock,[this]() { return jobsInFlight == 0; });
+}
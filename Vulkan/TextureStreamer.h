@@ -0,0 +1,111 @@
+﻿#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ThreadPool.h"
+
+//CPU side of texture streaming.
+//Files are decoded and turned into a full mip chain on the worker threads. Only the (compressed) file stays in
+//system memory for good, the mip chain is dropped once the texture has the mips it asked for and decoded again
+//if it wants more later. Every frame the renderer reports how big each texture is on screen, and PlanResidency
+//decides which textures should get more mips on the GPU and which should give some back to stay inside the memory budget.
+//The renderer carries out the changes and reports them back with SetResident.
+class TextureStreamer
+{
+public:
+    struct MipLevel
+    {
+        uint32_t width;
+        uint32_t height;
+        size_t offset; //Offset of the level in the texture pixels
+        size_t size;
+    };
+
+    //Mips from newResidentMip to the last one should be on the GPU (newResidentMip == mip count means none)
+    struct ResidencyChange
+    {
+        int textureId;
+        uint32_t newResidentMip;
+    };
+
+    TextureStreamer(ThreadPool& newThreadPool);
+
+    //Start decoding a texture in the background, until then the renderer keeps showing the placeholder
+    void Request(int textureId, const std::string& fileName, std::shared_ptr<const std::vector<char>> fileData);
+    void Remove(int textureId);
+
+    //Move finished background decodes in, must be called from the render thread
+    void CollectDecoded();
+
+    //Report the texture is drawn this frame covering screenSize pixels
+    void MarkUsed(int textureId, float screenSize, uint64_t frame);
+
+    //Fills changes (emptied first) so the caller can keep reusing one list
+    void PlanResidency(uint64_t frame, uint64_t memoryBudget, size_t maxChanges, std::vector<ResidencyChange>& changes);
+    void SetResident(int textureId, uint32_t residentMip);
+
+    bool IsDecoded(int textureId) const;
+    //False once the mip chain has been dropped, only needed to give a texture more mips (PlanResidency waits for them)
+    bool HasPixels(int textureId) const;
+    uint32_t GetResidentMip(int textureId) const;
+    uint32_t GetMipCount(int textureId) const;
+    const MipLevel& GetMip(int textureId, uint32_t mip) const;
+    const uint8_t* GetPixels(int textureId) const;
+    uint64_t GetResidentBytes() const {return residentBytes;}
+
+    ~TextureStreamer();
+
+private:
+    struct StreamedTexture
+    {
+        uint64_t requestId;
+        std::string fileName;
+        std::shared_ptr<const std::vector<char>> fileData; //To decode it again, null if that failed
+        bool decoded;
+        bool decoding; //A decode job for it is running
+        std::vector<uint8_t> pixels; //RGBA8, every mip one after the other starting with the biggest. Empty once dropped
+        std::vector<MipLevel> mips;
+
+        uint32_t residentMip;
+        uint32_t requestedMip;
+        uint64_t requestFrame;
+        uint64_t lastUsedFrame;
+    };
+
+    struct DecodedTexture
+    {
+        int textureId;
+        uint64_t requestId;
+        std::string fileName;
+        std::string error;
+        std::vector<uint8_t> pixels;
+        std::vector<MipLevel> mips;
+    };
+
+    ThreadPool& threadPool;
+    std::unordered_map<int,StreamedTexture> textures;
+    uint64_t nextRequestId;
+    uint64_t residentBytes;
+
+    //Filled by the workers, emptied by CollectDecoded
+    std::mutex decodedMutex;
+    std::vector<DecodedTexture> decodedTextures;
+    std::vector<DecodedTexture> collectedTextures; //Swapped with decodedTextures, so neither list is ever given up
+    size_t jobsInFlight;
+
+    //Scratch lists of PlanResidency, kept between frames so planning doesn't allocate
+    std::vector<int> wantMore;
+    std::vector<int> holdingMemory;
+    std::condition_variable jobsFinished;
+
+    void StartDecode(int textureId, StreamedTexture& texture);
+    uint64_t GetResidencyBytes(const StreamedTexture& texture, uint32_t residentMip) const;
+
+    static void BuildMipChain(const uint8_t* basePixels, uint32_t width, uint32_t height,
+        std::vector<uint8_t>& pixels, std::vector<MipLevel>& mips);
+};
@@ -0,0 +1,66 @@
+﻿#include "ThreadPool.h"
+
+thread_local ThreadPool* ThreadPool::currentPool = nullptr;
+
+ThreadPool::ThreadPool(size_t threadCount): nextSequence(0), stopping(false)
+{
+    //hardware_concurrency is allowed to return 0 if it can't tell
+    if(threadCount == 0)
+        threadCount = 1;
+
+    workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back(&ThreadPool::WorkerLoop,this);
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    currentPool = this;
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock,[this]() { return stopping || !jobs.empty(); });
+
+            //Finish whatever is still queued before leaving
+            if(stopping && jobs.empty())
+                return;
+
+            std::pop_heap(jobs.begin(),jobs.end());
+            job = std::move(jobs.back().run);
+            jobs.pop_back();
+        }
+        job();
+    }
+}
+
+bool ThreadPool::RunQueuedJob()
+{
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if(jobs.empty())
+            return false;
+
+        std::pop_heap(jobs.begin(),jobs.end());
+        job = std::move(jobs.back().run);
+        jobs.pop_back();
+    }
+    job();
+    return true;
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+}
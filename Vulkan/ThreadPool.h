@@ -0,0 +1,88 @@
+﻿#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of worker threads that run queued jobs (CPU side work only, never Vulkan commands)
+class ThreadPool
+{
+public:
+    ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+
+    size_t GetThreadCount() const {return workers.size();}
+
+    //Queue a job and get a future to its result (exceptions thrown by the job are rethrown by future.get()).
+    //Queued jobs with a higher priority are started first, equal ones in the order they were submitted
+    template<typename F>
+    auto Submit(F&& job, float priority = 0.0f) -> std::future<decltype(job())>
+    {
+        using ResultType = decltype(job());
+
+        //packaged_task is move only, std::function needs copyable so wrap it in a shared_ptr
+        auto task = std::make_shared<std::packaged_task<ResultType()>>(std::forward<F>(job));
+        std::future<ResultType> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            jobs.push_back({priority,nextSequence++,[task]() { (*task)(); }});
+            std::push_heap(jobs.begin(),jobs.end());
+        }
+        queueCondition.notify_one();
+        return result;
+    }
+
+    //Blocks until the job behind result is done. On one of this pool's workers queued jobs are run meanwhile, so a job
+    //can wait for jobs it submitted itself without every worker ending up waiting with nobody left to run them
+    template<typename T>
+    void Wait(const std::future<T>& result)
+    {
+        if(currentPool != this)
+        {
+            result.wait();
+            return;
+        }
+
+        while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            //Nothing queued, so it's running on another worker
+            if(!RunQueuedJob())
+                result.wait_for(std::chrono::microseconds(100));
+        }
+    }
+
+    ~ThreadPool();
+
+private:
+    struct QueuedJob
+    {
+        float priority;
+        uint64_t sequence;
+        std::function<void()> run;
+
+        //The heap keeps the biggest on top: highest priority, then submitted first
+        bool operator<(const QueuedJob& other) const
+        {
+            return priority != other.priority ? priority < other.priority : sequence > other.sequence;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<QueuedJob> jobs; //Heap
+    uint64_t nextSequence;
+
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    bool stopping;
+
+    static thread_local ThreadPool* currentPool; //Pool whose worker this thread is, if any
+
+    void WorkerLoop();
+    //Runs the next queued job on the calling thread, false if there was none
+    bool RunQueuedJob();
+};
@@ -0,0 +1,156 @@
+﻿#include "TransformStore.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define TRANSFORM_STORE_SSE
+#include <xmmintrin.h>
+#endif
+
+TransformStore::TransformStore(): count(0)
+{
+}
+
+uint32_t TransformStore::Add(size_t addCount)
+{
+    uint32_t first = static_cast<uint32_t>(count);
+    count += addCount;
+    size_t paddedCount = (count + 3) & ~size_t(3);
+
+    //New objects (and padding lanes) start as the identity
+    for (ComponentArray* values : {&positionX,&positionY,&positionZ,&rotationX,&rotationY,&rotationZ})
+        values->resize(paddedCount,0.0f);
+    for (ComponentArray* values : {&rotationW,&scaleX,&scaleY,&scaleZ})
+        values->resize(paddedCount,1.0f);
+    matrices.resize(count,glm::mat4(1.0f));
+
+    return first;
+}
+
+void TransformStore::SetTransforms(uint32_t first, size_t setCount, const glm::vec3* positions, const glm::quat* rotations,
+    const glm::vec3* scales)
+{
+    if(first + setCount > count)
+        throw std::runtime_error("Attempted to update transforms past the end of the store!");
+
+    for (size_t i = 0; i < setCount; ++i)
+    {
+        size_t index = first + i;
+        positionX[index] = positions[i].x;
+        positionY[index] = positions[i].y;
+        positionZ[index] = positions[i].z;
+    }
+    if(rotations)
+    {
+        for (size_t i = 0; i < setCount; ++i)
+        {
+            size_t index = first + i;
+            rotationX[index] = rotations[i].x;
+            rotationY[index] = rotations[i].y;
+            rotationZ[index] = rotations[i].z;
+            rotationW[index] = rotations[i].w;
+        }
+    }
+    if(scales)
+    {
+        for (size_t i = 0; i < setCount; ++i)
+        {
+            size_t index = first + i;
+            scaleX[index] = scales[i].x;
+            scaleY[index] = scales[i].y;
+            scaleZ[index] = scales[i].z;
+        }
+    }
+
+    ComposeMatrices(first,setCount);
+}
+
+void TransformStore::SetMatrix(uint32_t handle, const glm::mat4& matrix)
+{
+    if(handle >= count)
+        throw std::runtime_error("Attempted to update an invalid transform!");
+
+    matrices[handle] = matrix;
+}
+
+void TransformStore::ComposeMatrices(size_t first, size_t composeCount)
+{
+    size_t end = first + composeCount;
+
+    //Translation * rotation * scale, the rotation columns come from the unit quaternion:
+    //(1-2(yy+zz), 2(xy+wz), 2(xz-wy)), (2(xy-wz), 1-2(xx+zz), 2(yz+wx)), (2(xz+wy), 2(yz-wx), 1-2(xx+yy))
+#ifdef TRANSFORM_STORE_SSE
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    //Whole groups of four, lanes outside the range are computed but not stored
+    for (size_t i = first & ~size_t(3); i < end; i += 4)
+    {
+        __m128 x = _mm_load_ps(&rotationX[i]);
+        __m128 y = _mm_load_ps(&rotationY[i]);
+        __m128 z = _mm_load_ps(&rotationZ[i]);
+        __m128 w = _mm_load_ps(&rotationW[i]);
+        __m128 sx = _mm_load_ps(&scaleX[i]);
+        __m128 sy = _mm_load_ps(&scaleY[i]);
+        __m128 sz = _mm_load_ps(&scaleZ[i]);
+
+        __m128 xx = _mm_mul_ps(x,x);
+        __m128 yy = _mm_mul_ps(y,y);
+        __m128 zz = _mm_mul_ps(z,z);
+        __m128 xy = _mm_mul_ps(x,y);
+        __m128 xz = _mm_mul_ps(x,z);
+        __m128 yz = _mm_mul_ps(y,z);
+        __m128 wx = _mm_mul_ps(w,x);
+        __m128 wy = _mm_mul_ps(w,y);
+        __m128 wz = _mm_mul_ps(w,z);
+
+        //One register per matrix element, holding it for four objects
+        __m128 c0x = _mm_mul_ps(_mm_sub_ps(one,_mm_mul_ps(two,_mm_add_ps(yy,zz))),sx);
+        __m128 c0y = _mm_mul_ps(_mm_mul_ps(two,_mm_add_ps(xy,wz)),sx);
+        __m128 c0z = _mm_mul_ps(_mm_mul_ps(two,_mm_sub_ps(xz,wy)),sx);
+        __m128 c0w = zero;
+        __m128 c1x = _mm_mul_ps(_mm_mul_ps(two,_mm_sub_ps(xy,wz)),sy);
+        __m128 c1y = _mm_mul_ps(_mm_sub_ps(one,_mm_mul_ps(two,_mm_add_ps(xx,zz))),sy);
+        __m128 c1z = _mm_mul_ps(_mm_mul_ps(two,_mm_add_ps(yz,wx)),sy);
+        __m128 c1w = zero;
+        __m128 c2x = _mm_mul_ps(_mm_mul_ps(two,_mm_add_ps(xz,wy)),sz);
+        __m128 c2y = _mm_mul_ps(_mm_mul_ps(two,_mm_sub_ps(yz,wx)),sz);
+        __m128 c2z = _mm_mul_ps(_mm_sub_ps(one,_mm_mul_ps(two,_mm_add_ps(xx,yy))),sz);
+        __m128 c2w = zero;
+        __m128 c3x = _mm_load_ps(&positionX[i]);
+        __m128 c3y = _mm_load_ps(&positionY[i]);
+        __m128 c3z = _mm_load_ps(&positionZ[i]);
+        __m128 c3w = one;
+
+        //Transpose so each register holds one column of one object
+        _MM_TRANSPOSE4_PS(c0x,c0y,c0z,c0w);
+        _MM_TRANSPOSE4_PS(c1x,c1y,c1z,c1w);
+        _MM_TRANSPOSE4_PS(c2x,c2y,c2z,c2w);
+        _MM_TRANSPOSE4_PS(c3x,c3y,c3z,c3w);
+        __m128 columns[4][4] = {{c0x,c1x,c2x,c3x},{c0y,c1y,c2y,c3y},{c0z,c1z,c2z,c3z},{c0w,c1w,c2w,c3w}};
+
+        for (size_t lane = 0; lane < 4; ++lane)
+        {
+            size_t index = i + lane;
+            if(index < first || index >= end)
+                continue;
+
+            float* matrix = &matrices[index][0][0];
+            for (int column = 0; column < 4; ++column)
+                _mm_storeu_ps(matrix + column * 4,columns[lane][column]);
+        }
+    }
+#else
+    for (size_t i = first; i < end; ++i)
+    {
+        float x = rotationX[i], y = rotationY[i], z = rotationZ[i], w = rotationW[i];
+        glm::mat4& matrix = matrices[i];
+        matrix[0] = glm::vec4(1.0f - 2.0f * (y*y + z*z),2.0f * (x*y + w*z),2.0f * (x*z - w*y),0.0f) * scaleX[i];
+        matrix[1] = glm::vec4(2.0f * (x*y - w*z),1.0f - 2.0f * (x*x + z*z),2.0f * (y*z + w*x),0.0f) * scaleY[i];
+        matrix[2] = glm::vec4(2.0f * (x*z + w*y),2.0f * (y*z - w*x),1.0f - 2.0f * (x*x + y*y),0.0f) * scaleZ[i];
+        matrix[3] = glm::vec4(positionX[i],positionY[i],positionZ[i],1.0f);
+    }
+#endif
+}
@@ -0,0 +1,69 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+//Positions, rotations and scales of every object, one array per component (structure of arrays),
+//and the model matrices composed from them. Objects are addressed by handle (their index in the arrays).
+//Matrices are composed four objects at a time with SSE, so updating many objects in one call
+//costs about as much as reading the inputs and writing the matrices.
+class TransformStore
+{
+public:
+    TransformStore();
+
+    //Adds count objects at the origin with no rotation and unit scale, returns the handle of the first (the rest follow it)
+    uint32_t Add(size_t count = 1);
+    size_t GetCount() const {return count;}
+
+    //Objects first to first+count-1 get the given components and new matrices,
+    //rotations or scales can be null to keep the current ones
+    void SetTransforms(uint32_t first, size_t count, const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales);
+    //Matrix that can't be split into position, rotation and scale, kept until the next SetTransforms of the object
+    void SetMatrix(uint32_t handle, const glm::mat4& matrix);
+
+    const glm::mat4& GetMatrix(uint32_t handle) const {return matrices[handle];}
+
+private:
+    //Every group of four lanes starts on a 16 byte boundary for aligned SSE loads
+    template<typename T>
+    struct AlignedAllocator
+    {
+        using value_type = T;
+
+        AlignedAllocator() = default;
+        template<typename U>
+        AlignedAllocator(const AlignedAllocator<U>&) {}
+
+        T* allocate(size_t n) {return static_cast<T*>(::operator new(n * sizeof(T),std::align_val_t(16)));}
+        void deallocate(T* p, size_t) {::operator delete(p,std::align_val_t(16));}
+
+        template<typename U>
+        bool operator==(const AlignedAllocator<U>&) const {return true;}
+        template<typename U>
+        bool operator!=(const AlignedAllocator<U>&) const {return false;}
+    };
+    using ComponentArray = std::vector<float,AlignedAllocator<float>>;
+
+    size_t count;
+
+    //Padded to a multiple of 4
+    ComponentArray positionX;
+    ComponentArray positionY;
+    ComponentArray positionZ;
+    ComponentArray rotationX;
+    ComponentArray rotationY;
+    ComponentArray rotationZ;
+    ComponentArray rotationW;
+    ComponentArray scaleX;
+    ComponentArray scaleY;
+    ComponentArray scaleZ;
+
+    std::vector<glm::mat4> matrices;
+
+    //Recompose the matrices of objects first to first+count-1
+    void ComposeMatrices(size_t first, size_t count);
+};
@@ -1,12 +1,35 @@
 ﻿#pragma once
+#include <cmath>
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <glm/glm.hpp>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include "FrameStats.h"
+#include "MemoryBudget.h"
 const int MAX_FRAME_DRAWS = 2;
 const int MAX_OBJECTS = 20;
+const int MAX_TEXTURE_UPDATES_PER_FRAME = 2; //Streamed textures that can change residency in a single frame
+const uint32_t MAX_MODEL_UPLOADS_PER_FRAME = 1; //Asynchronously loaded models that get their buffers created in a single frame
+const VkDeviceSize DEFAULT_TEXTURE_MEMORY_BUDGET = 256ull * 1024 * 1024;
+const VkDeviceSize TEXTURE_BUDGET_MARGIN = 32ull * 1024 * 1024; //Device memory left free before a lowered texture budget goes up again
+const VkDeviceSize TEXTURE_BUDGET_STEP = 8ull * 1024 * 1024; //Most a lowered texture budget goes up per frame
+const uint32_t MAX_MESH_LODS = 5; //LOD 0 plus up to this many simplified levels, each about half the triangles of the one before
+const float MAX_LOD_PIXEL_ERROR = 1.0f; //Mesh LODs are switched when their error would cover less than this many pixels
+const uint32_t MAX_MESHLET_MESHES = 256; //Meshes per frame that can have their meshlets culled on the GPU
+const uint32_t MAX_MESHLET_DRAWS = 65536; //Meshlet draw commands per frame
+const uint32_t MAX_CULLED_MESHES = 4096; //Meshes per frame that can be culled as a whole on the GPU
+const size_t MAX_SHORT_INDEX_VERTICES = 65536; //Meshes with up to this many vertices get 16 bit indices
+const size_t FRAME_ARENA_SIZE = 256 * 1024; //Starting size of the memory lists built while recording a frame come from
+const size_t LOAD_ARENA_SIZE = 64 * 1024; //Same for the lists that only last while a model loads
+const bool LOG_MESH_OPTIMIZATION = false; //Print each imported model's vertex cache stats (ACMR, ATVR) before and after optimizing
+const uint32_t STEADY_STATE_FRAMES = 8; //Frames without changes before Draw is expected to stop allocating (debug builds check)
+//Counted by each frame's pipeline statistics query, results come back in the order of the bits
+const VkQueryPipelineStatisticFlags PIPELINE_STATISTICS = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
 const std::vector<const char*> deviceExtensions ={
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
@@ -43,6 +66,54 @@ struct SwapchainImage
     VkImageView imageView;
 };
 
+//Biggest scale of the model matrix axes, for scaling bounding sphere radii
+static float GetMaxAxisScale(const glm::mat4& model)
+{
+    float scaleX = glm::length(glm::vec3(model[0]));
+    float scaleY = glm::length(glm::vec3(model[1]));
+    float scaleZ = glm::length(glm::vec3(model[2]));
+    return scaleX > scaleY ? (scaleX > scaleZ ? scaleX : scaleZ) : (scaleY > scaleZ ? scaleY : scaleZ);
+}
+
+//Frustum planes (xyz normal pointing inside, w distance) from a view projection matrix, for a 0 to 1 depth range.
+//GLM_FORCE_DEPTH_ZERO_TO_ONE is defined for the whole project so every glm projection gives that range
+static void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    //Rows of the matrix (glm is column major)
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i)
+        rows[i] = glm::vec4(viewProjection[0][i],viewProjection[1][i],viewProjection[2][i],viewProjection[3][i]);
+
+    planes[0] = rows[3] + rows[0]; //Left
+    planes[1] = rows[3] - rows[0]; //Right
+    planes[2] = rows[3] + rows[1]; //Bottom
+    planes[3] = rows[3] - rows[1]; //Top
+    planes[4] = rows[2];           //Near (far with reverse depth)
+    planes[5] = rows[3] - rows[2]; //Far (near with reverse depth)
+
+    //Normalise so plane distances are in world units
+    for (int i = 0; i < 6; ++i)
+    {
+        //An infinite far plane has no normal, everything is in front of it
+        float length = glm::length(glm::vec3(planes[i]));
+        planes[i] = length > 0.0f ? planes[i] / length : glm::vec4(0.0f,0.0f,0.0f,1.0f);
+    }
+}
+
+//Perspective projection with depth 1 at the near plane going to 0 at infinity (reverse Z),
+//float depth has most of its precision near 0 so this spreads it evenly over the distance
+static glm::mat4 ReverseInfinitePerspective(float fovy, float aspect, float zNear)
+{
+    float focalLength = 1.0f / std::tan(fovy * 0.5f);
+
+    glm::mat4 projection(0.0f);
+    projection[0][0] = focalLength / aspect;
+    projection[1][1] = focalLength;
+    projection[2][3] = -1.0f; //w = -z, the camera looks down -z
+    projection[3][2] = zNear; //depth = zNear / -z
+    return projection;
+}
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -121,9 +192,18 @@ static void CreateBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDev
     memoryAllocateInfo.memoryTypeIndex = FindMemoryTypeIndex(physicalDevice,memoryRequirements.memoryTypeBits,
         bufferProperties);
     //Allocate memory to VkDeviceMemory
-    result = vkAllocateMemory(device,&memoryAllocateInfo,nullptr,bufferMemory);
+    result = MemoryBudget::Allocate(physicalDevice,device,memoryAllocateInfo,bufferMemory);
+    if(result == VK_ERROR_OUT_OF_DEVICE_MEMORY && (bufferProperties & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+    {
+        //Video memory is full even after reclaiming, a slower buffer in system memory still beats not having it
+        memoryAllocateInfo.memoryTypeIndex = FindMemoryTypeIndex(physicalDevice,memoryRequirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        if(memoryAllocateInfo.memoryTypeIndex != std::numeric_limits<uint32_t>::max())
+            result = MemoryBudget::Allocate(physicalDevice,device,memoryAllocateInfo,bufferMemory);
+    }
     if(result !=VK_SUCCESS)
     {
+        vkDestroyBuffer(device,*buffer,nullptr);
         throw std::runtime_error("Failed to allocate vertex buffer memory");
     }
 
@@ -189,21 +269,20 @@ static void CopyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool tra
 
     //Command to copy src buffer to dst buffer
     vkCmdCopyBuffer(transferCommandBuffer,srcBuffer,dstBuffer,1,&bufferCopyRegion);
+    FrameCounters::CountUpload(bufferSize);
 
     EndAndSubmitCommandBuffer(device,transferCommandPool,transferQueue,transferCommandBuffer);
 }
 
-static void CopyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-    VkBuffer srcBuffer,VkImage image,uint32_t width, uint32_t height)
+static void RecordCopyImageBuffer(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkDeviceSize srcOffset,
+    VkImage image, uint32_t width, uint32_t height, uint32_t mipLevel = 0)
 {
-    VkCommandBuffer transferCommandBuffer = BeginCommandBuffer(device,transferCommandPool);
-
     VkBufferImageCopy imageRegion{};
-    imageRegion.bufferOffset = 0;
+    imageRegion.bufferOffset = srcOffset;
     imageRegion.bufferRowLength = 0;
     imageRegion.bufferImageHeight = 0;
     imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageRegion.imageSubresource.mipLevel = 0;
+    imageRegion.imageSubresource.mipLevel = mipLevel;
     imageRegion.imageSubresource.baseArrayLayer = 0;
     imageRegion.imageSubresource.layerCount = 1;
     imageRegion.imageOffset = {0,0,0};
@@ -211,16 +290,54 @@ static void CopyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPoo
     imageRegion.imageExtent.height = height;
     imageRegion.imageExtent.depth = 1;
 
-    vkCmdCopyBufferToImage(transferCommandBuffer,srcBuffer,image,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    vkCmdCopyBufferToImage(commandBuffer,srcBuffer,image,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         1,&imageRegion);
+    FrameCounters::CountUpload(static_cast<VkDeviceSize>(width) * height * 4); //Textures are all RGBA8
+}
+
+//One mip level from an image in TRANSFER_SRC_OPTIMAL to one in TRANSFER_DST_OPTIMAL, both the same size
+static void RecordCopyImageMip(VkCommandBuffer commandBuffer, VkImage srcImage, uint32_t srcMipLevel,
+    VkImage dstImage, uint32_t dstMipLevel, uint32_t width, uint32_t height)
+{
+    VkImageCopy imageRegion{};
+    imageRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageRegion.srcSubresource.mipLevel = srcMipLevel;
+    imageRegion.srcSubresource.baseArrayLayer = 0;
+    imageRegion.srcSubresource.layerCount = 1;
+    imageRegion.dstSubresource = imageRegion.srcSubresource;
+    imageRegion.dstSubresource.mipLevel = dstMipLevel;
+    imageRegion.extent.width = width;
+    imageRegion.extent.height = height;
+    imageRegion.extent.depth = 1;
+
+    vkCmdCopyImage(commandBuffer,srcImage,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,dstImage,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1,&imageRegion);
+}
+
+//vkUpdateDescriptorSets, counting the descriptors written for the frame stats
+static void UpdateDescriptorSets(VkDevice device, uint32_t writeCount, const VkWriteDescriptorSet* writes)
+{
+    uint32_t descriptorCount = 0;
+    for (uint32_t i = 0; i < writeCount; ++i)
+        descriptorCount += writes[i].descriptorCount;
+    FrameCounters::CountDescriptorUpdates(descriptorCount);
+
+    vkUpdateDescriptorSets(device,writeCount,writes,0,nullptr);
+}
+
+static void CopyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
+    VkBuffer srcBuffer,VkImage image,uint32_t width, uint32_t height)
+{
+    VkCommandBuffer transferCommandBuffer = BeginCommandBuffer(device,transferCommandPool);
+
+    RecordCopyImageBuffer(transferCommandBuffer,srcBuffer,0,image,width,height);
     
     EndAndSubmitCommandBuffer(device,transferCommandPool,transferQueue,transferCommandBuffer);
 }
 
-static void TransitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool,VkImage image,VkImageLayout oldLayout, VkImageLayout newLayout)
+static void RecordImageLayoutTransition(VkCommandBuffer commandBuffer,VkImage image,VkImageLayout oldLayout, VkImageLayout newLayout,
+    uint32_t mipLevels = 1)
 {
-    VkCommandBuffer commandBuffer = BeginCommandBuffer(device,commandPool);
-
     VkImageMemoryBarrier imageMemoryBarrier{};
     imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     imageMemoryBarrier.oldLayout = oldLayout;
@@ -230,7 +347,7 @@ static void TransitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
     imageMemoryBarrier.image = image;
     imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-    imageMemoryBarrier.subresourceRange.levelCount = 1;
+    imageMemoryBarrier.subresourceRange.levelCount = mipLevels;
     imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
     imageMemoryBarrier.subresourceRange.layerCount = 1;
 
@@ -256,6 +373,15 @@ static void TransitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
             srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
             dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
         }
+        //Texture about to be copied from: earlier draws only read it, so they just have to be done
+        else if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+        {
+            imageMemoryBarrier.srcAccessMask = 0;
+            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+            srcStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        }
     }
 
     vkCmdPipelineBarrier(commandBuffer,
@@ -264,7 +390,13 @@ static void TransitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
         0,nullptr,
         0,nullptr,
         1,&imageMemoryBarrier);
-    
+}
+
+static void TransitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool,VkImage image,VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    VkCommandBuffer commandBuffer = BeginCommandBuffer(device,commandPool);
+
+    RecordImageLayoutTransition(commandBuffer,image,oldLayout,newLayout);
     
     EndAndSubmitCommandBuffer(device,commandPool,queue,commandBuffer);
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+﻿#include "VertexLayout.h"
+
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+static uint32_t GetPositionSize(VertexPositionFormat format)
+{
+    //16 bit positions are padded to 4 components, 3 component 16 bit formats aren't guaranteed for vertex buffers
+    return format == VertexPositionFormat::Float32 ? sizeof(glm::vec3) : 4 * sizeof(uint16_t);
+}
+
+static uint32_t GetUvSize(VertexUvFormat format)
+{
+    return format == VertexUvFormat::Float32 ? sizeof(glm::vec2) : 2 * sizeof(uint16_t);
+}
+
+VkFormat GetPositionFormat(VertexPositionFormat format)
+{
+    switch (format)
+    {
+    case VertexPositionFormat::Half16:
+        return VK_FORMAT_R16G16B16A16_SFLOAT;
+    case VertexPositionFormat::Unorm16:
+        return VK_FORMAT_R16G16B16A16_UNORM;
+    default:
+        return VK_FORMAT_R32G32B32_SFLOAT;
+    }
+}
+
+VkFormat GetUvFormat(VertexUvFormat format)
+{
+    return format == VertexUvFormat::Half16 ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+}
+
+uint32_t GetVertexStride(const VertexLayout& layout)
+{
+    return GetPositionSize(layout.position) + GetUvSize(layout.uv);
+}
+
+void GetVertexInputDescriptions(const VertexLayout& layout, std::vector<VkVertexInputBindingDescription>& bindings,
+    std::vector<VkVertexInputAttributeDescription>& attributes)
+{
+    bindings.resize(2);
+    //Per vertex data, position then UV
+    bindings[0].binding = VERTEX_BINDING;
+    bindings[0].stride = GetVertexStride(layout);
+    bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    //Colour is the same for every vertex, so it advances per instance and we only draw one
+    bindings[1].binding = COLOUR_BINDING;
+    bindings[1].stride = sizeof(glm::vec3);
+    bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    attributes.resize(3);
+    //Position attribute (shader reads a vec3, the 4th component of the 16 bit formats is ignored)
+    attributes[0].binding = VERTEX_BINDING;
+    attributes[0].location = 0;
+    attributes[0].format = GetPositionFormat(layout.position);
+    attributes[0].offset = 0;
+
+    //Color attribute
+    attributes[1].binding = COLOUR_BINDING;
+    attributes[1].location = 1;
+    attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributes[1].offset = 0;
+
+    //Texture attribute
+    attributes[2].binding = VERTEX_BINDING;
+    attributes[2].location = 2;
+    attributes[2].format = GetUvFormat(layout.uv);
+    attributes[2].offset = GetPositionSize(layout.position);
+}
+
+glm::mat4 PackVertices(const VertexLayout& layout, const Vertex* vertices, size_t vertexCount, uint8_t* packed)
+{
+    uint32_t stride = GetVertexStride(layout);
+    uint32_t uvOffset = GetPositionSize(layout.position);
+
+    glm::vec3 minPos(0.0f);
+    glm::vec3 maxPos(0.0f);
+    if(vertexCount > 0)
+    {
+        minPos = maxPos = vertices[0].pos;
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            minPos = glm::min(minPos,vertices[i].pos);
+            maxPos = glm::max(maxPos,vertices[i].pos);
+        }
+    }
+
+    //Flat meshes would divide by zero, any scale works on an axis with no extent
+    glm::vec3 extent = maxPos - minPos;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if(extent[axis] <= 0.0f)
+            extent[axis] = 1.0f;
+    }
+    glm::vec3 center = (minPos + maxPos) * 0.5f;
+
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        uint8_t* vertex = packed + i * stride;
+        const glm::vec3& pos = vertices[i].pos;
+
+        switch (layout.position)
+        {
+        case VertexPositionFormat::Half16:
+            {
+                glm::vec3 local = pos - center;
+                uint16_t values[4] = {glm::packHalf1x16(local.x),glm::packHalf1x16(local.y),glm::packHalf1x16(local.z),0};
+                memcpy(vertex,values,sizeof(values));
+                break;
+            }
+        case VertexPositionFormat::Unorm16:
+            {
+                glm::vec3 local = (pos - minPos) / extent;
+                uint16_t values[4] = {glm::packUnorm1x16(local.x),glm::packUnorm1x16(local.y),glm::packUnorm1x16(local.z),0};
+                memcpy(vertex,values,sizeof(values));
+                break;
+            }
+        default:
+            memcpy(vertex,&pos,sizeof(pos));
+            break;
+        }
+
+        if(layout.uv == VertexUvFormat::Half16)
+        {
+            uint16_t values[2] = {glm::packHalf1x16(vertices[i].tex.x),glm::packHalf1x16(vertices[i].tex.y)};
+            memcpy(vertex + uvOffset,values,sizeof(values));
+        }
+        else
+        {
+            memcpy(vertex + uvOffset,&vertices[i].tex,sizeof(vertices[i].tex));
+        }
+    }
+
+    //Undo the quantisation in the vertex shader by folding it into the model matrix
+    switch (layout.position)
+    {
+    case VertexPositionFormat::Half16:
+        return glm::translate(glm::mat4(1.0f),center);
+    case VertexPositionFormat::Unorm16:
+        return glm::scale(glm::translate(glm::mat4(1.0f),minPos),extent);
+    default:
+        return glm::mat4(1.0f);
+    }
+}
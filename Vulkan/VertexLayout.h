@@ -0,0 +1,44 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+#include "Utilities.h"
+
+//How vertex positions are stored in the vertex buffer
+enum class VertexPositionFormat
+{
+    Float32, //12 bytes, exact
+    Half16,  //8 bytes, half floats relative to the centre of the mesh bounding box
+    Unorm16  //8 bytes, 16 bit fixed point across the mesh bounding box
+};
+
+//How texture coordinates are stored in the vertex buffer
+enum class VertexUvFormat
+{
+    Float32, //8 bytes
+    Half16   //4 bytes, precise enough for textures up to ~2048 wide in the 0-1 range
+};
+
+//GPU side vertex layout, Vertex stays the full precision format used while loading
+struct VertexLayout
+{
+    VertexPositionFormat position;
+    VertexUvFormat uv;
+};
+
+const VertexLayout DEFAULT_VERTEX_LAYOUT = {VertexPositionFormat::Unorm16,VertexUvFormat::Half16};
+
+//The constant vertex colour is read from its own binding, one value for the whole draw
+const uint32_t VERTEX_BINDING = 0;
+const uint32_t COLOUR_BINDING = 1;
+
+VkFormat GetPositionFormat(VertexPositionFormat format);
+VkFormat GetUvFormat(VertexUvFormat format);
+uint32_t GetVertexStride(const VertexLayout& layout);
+
+//Bindings and attributes matching the layout for the graphics pipeline
+void GetVertexInputDescriptions(const VertexLayout& layout, std::vector<VkVertexInputBindingDescription>& bindings,
+    std::vector<VkVertexInputAttributeDescription>& attributes);
+
+//Convert vertices to the layout into packed (GetVertexStride * vertexCount bytes, e.g. straight into staging memory),
+//returns the transform that takes the stored positions back to model space
+glm::mat4 PackVertices(const VertexLayout& layout, const Vertex* vertices, size_t vertexCount, uint8_t* packed);
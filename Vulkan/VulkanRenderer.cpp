@@ -2,36 +2,64 @@
 
 #include <algorithm>
 #include <array>
+#include <cctype>
+#include <cstdlib>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/glm.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <cassert>
+#include <chrono>
+#include "AllocationCounter.h"
+#include "MeshletBuilder.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include "Utilities.h"
 #include "stb_image.h" 
 #include <iostream>
 #include <optional>
 #include <vector>
+#include <future>
 #include <set>
+#include <unordered_map>
 #include <stdbool.h>
 
-
 VulkanRenderer::VulkanRenderer():
-    window(nullptr), uboViewProjection(), instance(nullptr),
+    window(nullptr), framebufferResized(false), uboViewProjection(), instance(nullptr),
     mainDevice(), graphicsQueue(nullptr),
     presentationQueue(nullptr), surface(nullptr),
     swapchainKhr(nullptr), descriptorSetLayout(nullptr),
     pushConstantRange(),
-    descriptorPool(nullptr), graphicsPipeline(nullptr),
-    pipelineLayout(nullptr), renderPass(nullptr),
+    descriptorPool(nullptr), graphicsPipeline(nullptr), depthPrePassPipeline(nullptr), reverseDepth(false), depthPrePass(false),
+    pipelineLayout(nullptr), renderPass(nullptr), timelineSemaphoreSupported(false),
     graphicsCommandPool(nullptr), swapChainImageFormat(),
-    swapChainExtent()
+    swapChainExtent(), textureStreamer(threadPool),
+    placeholderTextureId(0), textureMemoryBudget(DEFAULT_TEXTURE_MEMORY_BUDGET),
+    textureStreamingBudget(DEFAULT_TEXTURE_MEMORY_BUDGET), memoryBudgetSupported(false),
+    vertexLayout(DEFAULT_VERTEX_LAYOUT), vertexColourBuffer(nullptr), vertexColourBufferMemory(nullptr),
+    uboCulling(), meshletCulling(true), drawIndirectCountSupported(false), multiDrawIndirectSupported(false),
+    cmdDrawIndexedIndirectCount(nullptr), cullingSetLayout(nullptr), meshletSetLayout(nullptr),
+    cullingDescriptorPool(nullptr), cullingPipelineLayout(nullptr), cullingPipeline(nullptr),
+    gpuCulling(true), meshCullingPipelineLayout(nullptr), meshCullingPipeline(nullptr), culledInstanceCount(0),
+    secondCullingRenderPass(nullptr),
+    depthBufferFormat(VK_FORMAT_UNDEFINED), depthBufferSampled(false),
+    msaaColourView(nullptr),
+    requestedMsaaSamples(VK_SAMPLE_COUNT_1_BIT), msaaSamples(VK_SAMPLE_COUNT_1_BIT), renderTargetsDirty(false),
+    depthPyramidImage(nullptr), depthPyramidImageMemory(nullptr), depthPyramidImageView(nullptr),
+    depthPyramidWidth(1), depthPyramidHeight(1), depthPyramidLevels(1), depthPyramidSampler(nullptr), depthPyramidBuilt(false),
+    depthReduceSetLayout(nullptr), depthReducePipelineLayout(nullptr), depthReducePipeline(nullptr),
+    depthReduceDescriptorPool(nullptr), frameStats(), recordingStats(), pipelineStatisticsSupported(false),
+    pipelineStatisticsQueryPool(nullptr)
 {
 }
 
 int32_t VulkanRenderer::Init(GLFWwindow* newWindow)
 {
     window = newWindow;
+    renderThreadId = std::this_thread::get_id();
+    glfwSetWindowUserPointer(window,this);
+    glfwSetFramebufferSizeCallback(window,FramebufferResizeCallback);
     try
     {
         CreateInstance();
@@ -39,25 +67,35 @@ int32_t VulkanRenderer::Init(GLFWwindow* newWindow)
         GetPhysicalDevice();
         CreateLogicalDevice();   
         CreateSwapChain();
+        ChooseRenderTargetFormats();
         CreateRenderPass();
         CreateDescriptorSetLayout();
         CreatePushConstantRange();
+        CheckVertexLayoutSupport();
         CreateGraphicsPipeline();
+        CreateCullingPipeline();
         CreateDepthBufferImage();
         CreateFramebuffers();
         CreateCommandPool();    
         CreateCommandBuffers();
+        CreatePipelineStatisticsQueryPool();
         CreateTextureSampler();
+        CreateDepthPyramid();
+        CreateDepthReducePipeline();
+        CreateDepthReduceDescriptorSets();
         //AllocateDynamicBufferTransferSpace();
         CreateUniformBuffers();
+        CreateVertexColourBuffer();
+        CreateCullingBuffers();
         CreateDescriptorPool();
         CreateDescriptorSets();
+        CreateCullingDescriptorSets();
+        CreatePlaceholderTexture();
         CreateSynchronisation();
+        frameGraph.Init(mainDevice.physicalDevice,mainDevice.logicalDevice,MAX_FRAME_DRAWS);
 
-        uboViewProjection.projection = glm::perspective(glm::radians(45.0f),(float) swapChainExtent.width/(float)swapChainExtent.height,0.1f,100.0f);
+        UpdateProjection();
         uboViewProjection.view = glm::lookAt(glm::vec3(0.0f,25.0f,20.0f),glm::vec3(0.0f,0.0f,0.0f),glm::vec3(0.0f,1.0f,0.0f));
-
-        uboViewProjection.projection[1][1] *= -1;
         //Create a mesh
         //Vertex data
         /*std::vector<Vertex> meshVertices ={
@@ -97,19 +135,91 @@ void VulkanRenderer::UpdateModel(int modelId,glm::mat4 newModel)
 {
     if(modelId >= modelList.size()) return;
 
-    modelList[modelId].SetModel(newModel);
+    transformStore.SetMatrix(modelId,newModel);
+}
+
+void VulkanRenderer::UpdateModels(int firstModelId, size_t count, const glm::vec3* positions, const glm::quat* rotations,
+    const glm::vec3* scales)
+{
+    if(firstModelId < 0 || firstModelId + count > modelList.size()) return;
+
+    transformStore.SetTransforms(firstModelId,count,positions,rotations,scales);
+}
+
+void VulkanRenderer::UpdateModelNode(int modelId, const std::string& nodeName, glm::mat4 newTransform)
+{
+    if(modelId >= modelList.size()) return;
+
+    //Still loading, its slot only holds an empty model without nodes, so the last transform of each node is kept for later
+    for (ModelLoad& load : modelLoads)
+    {
+        if(load.modelId != modelId)
+            continue;
+
+        for (std::pair<std::string,glm::mat4>& nodeTransform : load.nodeTransforms)
+        {
+            if(nodeTransform.first == nodeName)
+            {
+                nodeTransform.second = newTransform;
+                return;
+            }
+        }
+        load.nodeTransforms.emplace_back(nodeName,newTransform);
+        return;
+    }
+
+    SetNodeTransform(modelList[modelId],nodeName,newTransform);
+}
+
+bool VulkanRenderer::SetNodeTransform(MeshModel& model, const std::string& nodeName, const glm::mat4& newTransform)
+{
+    SceneGraph& sceneGraph = model.GetSceneGraph();
+    uint32_t node = sceneGraph.FindNode(nodeName);
+    if(node == SceneGraph::NO_NODE)
+        return false;
+
+    //Only this node and the ones under it get new world transforms
+    sceneGraph.SetLocalTransform(node,newTransform);
+    return true;
 }
 
 void VulkanRenderer::Draw()
 {
+    uint64_t allocationsBefore = AllocationCounter::GetThreadCount();
+
+    //Nothing to draw to while the window is minimised
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window,&width,&height);
+    if(width == 0 || height == 0)
+        return;
+
+    if(framebufferResized)
+        RecreateSwapChain();
+    if(renderTargetsDirty)
+        RecreateRenderTargets();
+
     //1. Get next available image to draw to and set something to signal when we're finish with the image (a semaphore)
-    vkWaitForFences(mainDevice.logicalDevice,1,&drawFences[currentFrame],VK_TRUE,std::numeric_limits<uint64_t>::max());
-    vkResetFences(mainDevice.logicalDevice,1,&drawFences[currentFrame]);
+    //The last submission of this frame slot has to be done before its semaphores and command buffer are reused
+    graphicsTimeline.Wait(frameTimelineValues[currentFrame]);
 
     uint32_t imageIndex;
-    vkAcquireNextImageKHR(mainDevice.logicalDevice,swapchainKhr,
+    VkResult result = vkAcquireNextImageKHR(mainDevice.logicalDevice,swapchainKhr,
         std::numeric_limits<uint64_t>::max(),imageAvailable[currentFrame],VK_NULL_HANDLE,&imageIndex);
+    //Window changed under the swapchain, try again next frame with a new one (suboptimal images can still be drawn)
+    if(result == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        RecreateSwapChain();
+        return;
+    }
+    if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+        throw std::runtime_error("Failed to acquire a swapchain image");
 
+    //Its command buffer (and framebuffer) are about to be replaced, so the last frame that drew to this image has to be done
+    graphicsTimeline.Wait(imageTimelineValues[imageIndex]);
+
+    memoryBudget.Update();
+    UpdateModelLoads();
+    UpdateTextureStreaming();
     RecordCommands(imageIndex);
     UpdateUniformBuffer(imageIndex);
 
@@ -127,9 +237,9 @@ void VulkanRenderer::Draw()
     submitInfo.signalSemaphoreCount = 1; //Number of semaphores to signal
     submitInfo.pSignalSemaphores = &renderFinished[currentFrame]; //Semaphores to signal when command buffer finishes
 
-    VkResult result = vkQueueSubmit(graphicsQueue,1,&submitInfo,drawFences[currentFrame]);
-    if(result != VK_SUCCESS)
-        throw std::runtime_error("Failed to submit command buffer to queue");
+    //Also signals the next timeline value, which is what this frame is waited on with
+    frameTimelineValues[currentFrame] = graphicsTimeline.Submit(submitInfo);
+    imageTimelineValues[imageIndex] = frameTimelineValues[currentFrame];
     //3. Present image to screen when it has signalled finished rendering
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -140,10 +250,49 @@ void VulkanRenderer::Draw()
     presentInfo.pImageIndices = &imageIndex;
 
     result = vkQueuePresentKHR(presentationQueue,&presentInfo);
-    if(result != VK_SUCCESS)
+    if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+        framebufferResized = true;
+    else if(result != VK_SUCCESS)
         throw std::runtime_error("Failed to present image");
 
     currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;
+    frameNumber++;
+
+    //Once nothing has changed for a while every list has grown as big as it gets, and the frame shouldn't touch the heap
+    //(this frame changing something resets steadyFrames, so it isn't checked)
+    if(steadyFrames >= STEADY_STATE_FRAMES)
+        assert(AllocationCounter::GetThreadCount() == allocationsBefore && "Draw allocated from the heap in steady state");
+    steadyFrames++;
+}
+
+void VulkanRenderer::FramebufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+    auto renderer = static_cast<VulkanRenderer*>(glfwGetWindowUserPointer(window));
+    renderer->framebufferResized = true;
+}
+
+void VulkanRenderer::UpdateProjection()
+{
+    float aspect = (float) swapChainExtent.width/(float)swapChainExtent.height;
+    if(reverseDepth)
+        uboViewProjection.projection = ReverseInfinitePerspective(glm::radians(45.0f),aspect,0.1f);
+    else
+        uboViewProjection.projection = glm::perspective(glm::radians(45.0f),aspect,0.1f,100.0f);
+
+    uboViewProjection.projection[1][1] *= -1;
+}
+
+void VulkanRenderer::SetTextureMemoryBudget(VkDeviceSize budget)
+{
+    //Applied gradually by UpdateTextureStreaming
+    textureMemoryBudget = budget;
+}
+
+void VulkanRenderer::SetMsaaSamples(VkSampleCountFlagBits samples)
+{
+    requestedMsaaSamples = samples;
+    //Before Init there is nothing to rebuild yet
+    renderTargetsDirty = graphicsPipeline != nullptr;
 }
 
 void VulkanRenderer::CreateInstance()
@@ -177,6 +326,17 @@ void VulkanRenderer::CreateInstance()
     std::vector<const char*> instanceExtensions(glfwExtensions,glfwExtensions+glfwExtensionCount);
     instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
+    //Optional, needed to ask the driver for its memory budget
+    physicalDeviceProperties2Supported = IsInstanceExtensionSupported(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if(physicalDeviceProperties2Supported)
+        instanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
+    //Optional, gives each GPU a UUID it can be picked by
+    deviceIdPropertiesSupported = physicalDeviceProperties2Supported &&
+        IsInstanceExtensionSupported(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+    if(deviceIdPropertiesSupported)
+        instanceExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+
     //Check instance extension supported...
     if(!CheckInstanceExtensionSupport(instanceExtensions))
     {
@@ -223,20 +383,61 @@ void VulkanRenderer::GetPhysicalDevice()
     std::vector<VkPhysicalDevice> deviceList(deviceCount);
     vkEnumeratePhysicalDevices(instance,&deviceCount,deviceList.data());
 
-    for (const VkPhysicalDevice& device: deviceList)
+    //A GPU asked for by name or UUID, the environment variable wins over SetPreferredDevice
+    std::string requestedDevice = preferredDevice;
+    const char* requestedBy = "SetPreferredDevice";
+    if(const char* environmentDevice = std::getenv("VULKAN_DEVICE"))
+    {
+        requestedDevice = environmentDevice;
+        requestedBy = "VULKAN_DEVICE";
+    }
+
+    //Otherwise the suitable one with the highest score, the first one listed on a tie
+    VkPhysicalDevice requestedMatch = nullptr;
+    uint64_t bestScore = 0;
+    for (size_t i = 0; i < deviceList.size(); ++i)
     {
-        if(CheckDeviceSuitable(device))
+        VkPhysicalDeviceProperties deviceProperties{};
+        vkGetPhysicalDeviceProperties(deviceList[i],&deviceProperties);
+        std::string uuid = GetDeviceUuid(deviceList[i]);
+
+        std::cout << "Vulkan device " << i << ": " << deviceProperties.deviceName << " (" << GetDeviceTypeName(deviceProperties.deviceType);
+        if(!uuid.empty())
+            std::cout << ", " << uuid;
+        std::cout << ")";
+
+        if(!CheckDeviceSuitable(deviceList[i]))
         {
-            mainDevice.physicalDevice = device;
-            break;
+            std::cout << " not suitable" << std::endl;
+            continue;
         }
+
+        uint64_t score = RateDevice(deviceList[i]);
+        std::cout << " score " << score << std::endl;
+        if(!mainDevice.physicalDevice || score > bestScore)
+        {
+            mainDevice.physicalDevice = deviceList[i];
+            bestScore = score;
+        }
+        if(!requestedMatch && !requestedDevice.empty() && MatchesDevice(deviceProperties.deviceName,uuid,requestedDevice))
+            requestedMatch = deviceList[i];
     }
 
     if(!mainDevice.physicalDevice)
         throw std::runtime_error("No physical device found");
 
+    if(requestedMatch)
+        mainDevice.physicalDevice = requestedMatch;
+    else if(!requestedDevice.empty())
+        std::cout << "No suitable Vulkan device matches \"" << requestedDevice << "\" (" << requestedBy << "), using the highest score" << std::endl;
+
     VkPhysicalDeviceProperties deviceProperties{};
     vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+    std::cout << "Using Vulkan device: " << deviceProperties.deviceName;
+    if(requestedMatch)
+        std::cout << " (requested by " << requestedBy << ")" << std::endl;
+    else
+        std::cout << " (highest score)" << std::endl;
     
     //minUniformBufferOffset = deviceProperties.limits.minUniformBufferOffsetAlignment;
 }
@@ -273,16 +474,49 @@ void VulkanRenderer::CreateLogicalDevice()
     }
 
     //Physical device features the logical device will be using
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice,&supportedFeatures);
+
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    //Optional, meshlet draws fall back to one indirect draw per meshlet without it
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+    //Optional, frame stats go without GPU counts
+    deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+    pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+
+    //Optional too, lets the GPU decide how many meshlet draws to read
+    std::vector<const char*> enabledExtensions = deviceExtensions;
+    drawIndirectCountSupported = IsDeviceExtensionSupported(mainDevice.physicalDevice,VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if(drawIndirectCountSupported)
+        enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+    //Optional, without it memory usage is only what we allocated ourselves
+    memoryBudgetSupported = physicalDeviceProperties2Supported &&
+        IsDeviceExtensionSupported(mainDevice.physicalDevice,VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if(memoryBudgetSupported)
+        enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    //Optional, frames and uploads are tracked with fences standing in for it otherwise
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures{};
+    timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineSemaphoreSupported = IsDeviceExtensionSupported(mainDevice.physicalDevice,VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    if(timelineSemaphoreSupported)
+    {
+        GetPhysicalDeviceFeatures2(&timelineSemaphoreFeatures);
+        timelineSemaphoreSupported = timelineSemaphoreFeatures.timelineSemaphore == VK_TRUE;
+    }
+    if(timelineSemaphoreSupported)
+        enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
     
     //Information to create logical device (sometimes called "device")
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()); //Number of queue create infos
     deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data(); //List of queue create infos so device can create required queues
-    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()); //Number of enabled logical device extensions
-    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data(); //List of enabled logical device extensions
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()); //Number of enabled logical device extensions
+    deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data(); //List of enabled logical device extensions
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures; //Physical device features logical device will use
 
     //Add validation layers to the logic device
@@ -292,6 +526,11 @@ void VulkanRenderer::CreateLogicalDevice()
     deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
     deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
     deviceCreateInfo.pNext = static_cast<VkDebugUtilsMessengerCreateInfoEXT*>(&debugCreateInfo);
+    if(timelineSemaphoreSupported)
+    {
+        timelineSemaphoreFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+        deviceCreateInfo.pNext = &timelineSemaphoreFeatures;
+    }
 
     //Create the logical device for the given physical device
     VkResult result = vkCreateDevice(mainDevice.physicalDevice,&deviceCreateInfo,nullptr,&mainDevice.logicalDevice);
@@ -300,6 +539,30 @@ void VulkanRenderer::CreateLogicalDevice()
         throw std::runtime_error("Failed to create a logical device");
     }
 
+    if(drawIndirectCountSupported)
+    {
+        cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+            vkGetDeviceProcAddr(mainDevice.logicalDevice,"vkCmdDrawIndexedIndirectCountKHR"));
+        drawIndirectCountSupported = cmdDrawIndexedIndirectCount != nullptr;
+    }
+
+    memoryBudget.Init(instance,mainDevice.physicalDevice,memoryBudgetSupported);
+
+    //When an allocation runs out of device memory texture streaming gives back at least that much over the next frames.
+    //On the render thread textures replaced in earlier frames can also go right away once the GPU is idle,
+    //other threads (model loading) must not touch them and fall back to what their allocation does without
+    MemoryBudget::SetReclaimHandler([this](VkDeviceSize size)
+    {
+        reclaimRequestBytes += size;
+        if(std::this_thread::get_id() != renderThreadId)
+            return false;
+
+        size_t retiredCount = retiredTextures.size();
+        vkDeviceWaitIdle(mainDevice.logicalDevice);
+        DestroyRetiredTextures(graphicsTimeline.GetCompletedValue());
+        return retiredTextures.size() < retiredCount;
+    });
+
     //Queues are created at the same time as the device...
     //So we want to handle the queues
     //From given logical device, of given Queue family, of given queue index (0 since only one queue), place reference in given VkQueue
@@ -318,7 +581,7 @@ void VulkanRenderer::CreateSurface()
     
 }
 
-void VulkanRenderer::CreateSwapChain()
+void VulkanRenderer::CreateSwapChain(VkSwapchainKHR oldSwapchain)
 {
     //Get swap chain details so we can pick best settings
     SwapChainDetails swapChainDetails = GetSwapChainDetails(mainDevice.physicalDevice);
@@ -370,7 +633,7 @@ void VulkanRenderer::CreateSwapChain()
         swapchainCreateInfoKhr.pQueueFamilyIndices = nullptr;
     }
     //If old swap chain been destroyed and this one replaces it, then link old one to quickly hand over responsibilities
-    swapchainCreateInfoKhr.oldSwapchain = VK_NULL_HANDLE;
+    swapchainCreateInfoKhr.oldSwapchain = oldSwapchain;
 
     //Create swapchain
     VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice,&swapchainCreateInfoKhr,nullptr,&swapchainKhr);
@@ -398,35 +661,65 @@ void VulkanRenderer::CreateSwapChain()
     
 }
 
+void VulkanRenderer::ChooseRenderTargetFormats()
+{
+    msaaSamples = ChooseMsaaSamples(requestedMsaaSamples);
+
+    //Reverse depth needs float depth to pay off, and nothing uses stencil
+    depthBufferFormat = ChooseSupportedFormat(
+        reverseDepth ? std::vector<VkFormat>{VK_FORMAT_D32_SFLOAT,VK_FORMAT_D32_SFLOAT_S8_UINT,VK_FORMAT_D24_UNORM_S8_UINT} :
+                       std::vector<VkFormat>{VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT,VK_FORMAT_D24_UNORM_S8_UINT},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+    //The depth pyramid reads it when the format can be sampled.
+    //A multisampled depth buffer would have to be resolved first (Vulkan 1.2), so with MSAA it stays inside the render pass
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice,depthBufferFormat,&formatProperties);
+    depthBufferSampled = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0 &&
+        msaaSamples == VK_SAMPLE_COUNT_1_BIT;
+}
+
 void VulkanRenderer::CreateRenderPass()
 {
+    bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
     //Color attachment of render pass
+    //With MSAA it is the multisampled colour buffer, which is only needed until it is resolved
     VkAttachmentDescription colorAttachment{};
     colorAttachment.format = swapChainImageFormat;    //Format to use for attachment
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;     //Number of samples to write for multisampling
+    colorAttachment.samples = msaaSamples;     //Number of samples to write for multisampling
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;    //Describes what do with attachment before rendering
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;    //Describes what to do with attachment after rendering
+    colorAttachment.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;    //Describes what to do with attachment after rendering
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; //Describes what to do with stencil after rendering
 
     //Famebuffer data will be stored as an image, but images can be given different data layouts
     //to give optimal use for certain operations
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; //Image data layout before render pass starts
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //Image data layout after render pass (to change to)
+    colorAttachment.finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //Image data layout after render pass (to change to)
 
     VkAttachmentDescription depthAttachment{};
-    depthAttachment.format = ChooseSupportedFormat(
-        {VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT,VK_FORMAT_D24_UNORM_S8_UINT},
-        VK_IMAGE_TILING_OPTIMAL,
-        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
-    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.format = depthBufferFormat;
+    depthAttachment.samples = msaaSamples;
     depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.storeOp = depthBufferSampled ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE; //Kept for the depth pyramid
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+    //Swapchain image the multisampled colour is resolved into, nothing is drawn to it directly
+    VkAttachmentDescription resolveAttachment{};
+    resolveAttachment.format = swapChainImageFormat;
+    resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    resolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    resolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resolveAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
     
     //Attachment reference uses an attachment index tha refers to index in the attachment list passed to renderPassCreateInfo
     VkAttachmentReference colorAttachmentReference{};
@@ -437,15 +730,20 @@ void VulkanRenderer::CreateRenderPass()
     depthAttachmentReference.attachment = 1;
     depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+    VkAttachmentReference resolveAttachmentReference{};
+    resolveAttachmentReference.attachment = 2;
+    resolveAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
     //Information about a particular subpass the render pass is using
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS; //Pipeline type subpass is to be bound to
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentReference;
     subpass.pDepthStencilAttachment = &depthAttachmentReference;
+    subpass.pResolveAttachments = multisampled ? &resolveAttachmentReference : nullptr; //Resolved at the end of the subpass
 
     //Need to determine when layout transition occur using subpass dependencies
-    std::array<VkSubpassDependency,2> subpassDependencies;
+    std::array<VkSubpassDependency,3> subpassDependencies;
 
     //Conversion from layout undefined to layout color attachment 
     //Transition must happen after...
@@ -470,7 +768,18 @@ void VulkanRenderer::CreateRenderPass()
     subpassDependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
     subpassDependencies[1].dependencyFlags = 0;
 
-    std::array<VkAttachmentDescription,2> renderPassAttachments = {colorAttachment,depthAttachment};
+    //Depth buffer is cleared and written only after the last frame's depth pyramid has been built from it
+    subpassDependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    subpassDependencies[2].srcAccessMask = 0;
+    subpassDependencies[2].dstSubpass = 0;
+    subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpassDependencies[2].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpassDependencies[2].dependencyFlags = 0;
+
+    std::vector<VkAttachmentDescription> renderPassAttachments = {colorAttachment,depthAttachment};
+    if(multisampled)
+        renderPassAttachments.push_back(resolveAttachment);
     //Create info for render pass
     VkRenderPassCreateInfo renderPassCreateInfo{};
     renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -484,7 +793,24 @@ void VulkanRenderer::CreateRenderPass()
     VkResult result = vkCreateRenderPass(mainDevice.logicalDevice,& renderPassCreateInfo,nullptr,&renderPass);
     if(result != VK_SUCCESS)
         throw std::runtime_error("Error creating render pass");
-    
+
+    //Same attachments for the meshes the second culling pass finds, drawn on top of what the first render pass left.
+    //Not with MSAA, there is no depth pyramid to cull against a second time then
+    if(!multisampled)
+    {
+        renderPassAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        renderPassAttachments[0].initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        renderPassAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        renderPassAttachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        //After the first render pass has written the colour
+        subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        subpassDependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        result = vkCreateRenderPass(mainDevice.logicalDevice,&renderPassCreateInfo,nullptr,&secondCullingRenderPass);
+        if(result != VK_SUCCESS)
+            throw std::runtime_error("Error creating render pass");
+    }
 }
 
 void VulkanRenderer::CreateDescriptorSetLayout()
@@ -573,37 +899,16 @@ void VulkanRenderer::CreateGraphicsPipeline()
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertexShaderCreateInfo, fragmentShaderCreateInfo};
 
     //How the data for a single vertex(including info such as position, color, texture uv, normals, etc.) is as  a whole
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0; //Can bind multiple streams of data, this defines which one
-    bindingDescription.stride = sizeof(Vertex); //Size of a single vertex object
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; //How to move between data after each vertex. Move on to the next vertex
-
-    //How the data for an attribute is defined within a vertex
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions;
-    //Position attribute
-    attributeDescriptions[0].binding = 0; //Which binding the data is at. Same as above 
-    attributeDescriptions[0].location = 0; //Location in shader where data will be read from
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT; //Format the data will take (also helps define the size of data)
-    attributeDescriptions[0].offset = offsetof(Vertex,pos); //Where this attribute is defined in the data for a single vertex
-
-    //Color attribute
-    attributeDescriptions[1].binding = 0; //Which binding the data is at. Same as above 
-    attributeDescriptions[1].location = 1; //Location in shader where data will be read from
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT; //Format the data will take (also helps define the size of data)
-    attributeDescriptions[1].offset = offsetof(Vertex,col); //Where this attribute is defined in the data for a single vertex
-
-    //Texture attribute
-    attributeDescriptions[2].binding = 0; //Which binding the data is at. Same as above 
-    attributeDescriptions[2].location = 2; //Location in shader where data will be read from
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT; //Format the data will take (also helps define the size of data)
-    attributeDescriptions[2].offset = offsetof(Vertex,tex); //Where this attribute is defined in the data for a single vertex
-    
+    //and how the data for an attribute is defined within a vertex, both depend on the chosen vertex layout
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+    GetVertexInputDescriptions(vertexLayout,bindingDescriptions,attributeDescriptions);
 
     //--Vertex input--
     VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo{};
     vertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputStateCreateInfo.vertexBindingDescriptionCount = 1;
-    vertexInputStateCreateInfo.pVertexBindingDescriptions = &bindingDescription; //List of vertex binding descriptions (data spacing/ stride information)
+    vertexInputStateCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputStateCreateInfo.pVertexBindingDescriptions = bindingDescriptions.data(); //List of vertex binding descriptions (data spacing/ stride information)
     vertexInputStateCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
     vertexInputStateCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data(); //List of vertex attribute descriptions (data format and where to bind to/from)
 
@@ -614,37 +919,24 @@ void VulkanRenderer::CreateGraphicsPipeline()
     inputAssembly.primitiveRestartEnable = VK_FALSE; //Allow overriding of strip topology to start new primitives
 
     //--Viewport & scissor --
-    //Create  a viewport info struct
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(swapChainExtent.width);
-    viewport.height = static_cast<float>(swapChainExtent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    //Create a scissor info struct
-    VkRect2D scissor {};
-    scissor.offset ={0,0}; //Offset to use region from 
-    scissor.extent = swapChainExtent; //Extent to describe region to use, starting at offset
-
+    //Both are set in the command buffer (see dynamic state), so the pipeline doesn't depend on the window size
     VkPipelineViewportStateCreateInfo viewportStateCreateInfo{};
     viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportStateCreateInfo.viewportCount = 1;
-    viewportStateCreateInfo.pViewports = &viewport;
+    viewportStateCreateInfo.pViewports = nullptr;
     viewportStateCreateInfo.scissorCount = 1;
-    viewportStateCreateInfo.pScissors = &scissor;
+    viewportStateCreateInfo.pScissors = nullptr;
 
-    // //--Dynamic state-- alterable things in pipeline
-    // std::vector<VkDynamicState> dynamicStatesEnables;
-    // dynamicStatesEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT); //Dynamic Viewport : Can resize in command buffer width vkCmdSetViewport(commandbuffer, 0, 1, &viewport)
-    // dynamicStatesEnables.push_back(VK_DYNAMIC_STATE_SCISSOR); //Dynamic Scissor : Can resize in command buffer with vkCmdSetScissor(commandbuffer, 0,1, &scissor)
-    //
-    // //Dynamic state creation info
-    // VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
-    // dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    // dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStatesEnables.size());
-    // dynamicStateCreateInfo.pDynamicStates = dynamicStatesEnables.data();
+    //--Dynamic state-- alterable things in pipeline
+    std::vector<VkDynamicState> dynamicStatesEnables;
+    dynamicStatesEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT); //Dynamic Viewport : Can resize in command buffer width vkCmdSetViewport(commandbuffer, 0, 1, &viewport)
+    dynamicStatesEnables.push_back(VK_DYNAMIC_STATE_SCISSOR); //Dynamic Scissor : Can resize in command buffer with vkCmdSetScissor(commandbuffer, 0,1, &scissor)
+
+    //Dynamic state creation info
+    VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+    dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStatesEnables.size());
+    dynamicStateCreateInfo.pDynamicStates = dynamicStatesEnables.data();
 
     //--Rasterizer--
     VkPipelineRasterizationStateCreateInfo rasterizationStateCreateInfo{};
@@ -661,7 +953,7 @@ void VulkanRenderer::CreateGraphicsPipeline()
     VkPipelineMultisampleStateCreateInfo multisampleStateCreateInfo{};
     multisampleStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
     multisampleStateCreateInfo.sampleShadingEnable = VK_FALSE;
-    multisampleStateCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampleStateCreateInfo.rasterizationSamples = msaaSamples; //Has to match the render pass attachments
 
     // --Blending --
     VkPipelineColorBlendAttachmentState colorState{};
@@ -706,10 +998,32 @@ void VulkanRenderer::CreateGraphicsPipeline()
     depthStencilStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
     depthStencilStateCreateInfo.depthTestEnable = VK_TRUE;
     depthStencilStateCreateInfo.depthWriteEnable = VK_TRUE;
-    depthStencilStateCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencilStateCreateInfo.depthCompareOp = reverseDepth ? VK_COMPARE_OP_GREATER : VK_COMPARE_OP_LESS; //Closer is bigger with reverse depth
     depthStencilStateCreateInfo.depthBoundsTestEnable = VK_FALSE;
     depthStencilStateCreateInfo.stencilTestEnable = VK_FALSE;
 
+    //Optional position only shader for the depth pre-pass
+    std::vector<char> depthShaderCode;
+    if(depthPrePass)
+    {
+        try
+        {
+            depthShaderCode = ReadFile("Shaders/depth.spv");
+        }
+        catch (const std::runtime_error&)
+        {
+            std::cerr << "Shaders/depth.spv not found, depth pre-pass disabled (run compile_shaders.bat)" << std::endl;
+        }
+    }
+
+    //After a pre-pass the depth buffer already holds the closest surface, only fragments exactly on it are shaded
+    VkPipelineDepthStencilStateCreateInfo mainDepthStencilStateCreateInfo = depthStencilStateCreateInfo;
+    if(!depthShaderCode.empty())
+    {
+        mainDepthStencilStateCreateInfo.depthWriteEnable = VK_FALSE;
+        mainDepthStencilStateCreateInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
+
     //--Graphics pipeline creation --
     VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
     pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -718,11 +1032,11 @@ void VulkanRenderer::CreateGraphicsPipeline()
     pipelineCreateInfo.pVertexInputState = &vertexInputStateCreateInfo; //All the fixed function pipeline states
     pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
     pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-    pipelineCreateInfo.pDynamicState = nullptr;
+    pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
     pipelineCreateInfo.pRasterizationState = &rasterizationStateCreateInfo;
     pipelineCreateInfo.pMultisampleState = &multisampleStateCreateInfo;
     pipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
-    pipelineCreateInfo.pDepthStencilState = &depthStencilStateCreateInfo;
+    pipelineCreateInfo.pDepthStencilState = &mainDepthStencilStateCreateInfo;
     pipelineCreateInfo.layout = pipelineLayout; //Pipeline layout pipeline should use 
     pipelineCreateInfo.renderPass = renderPass; // Render pass description the pipeline is compatible with
     pipelineCreateInfo.subpass = 0; //Subpass of render pass to use with pipeline
@@ -740,46 +1054,384 @@ void VulkanRenderer::CreateGraphicsPipeline()
     vkDestroyShaderModule(mainDevice.logicalDevice,vertexShaderModule,nullptr);
     vkDestroyShaderModule(mainDevice.logicalDevice,fragmentShaderModule,nullptr);
 
+    if(depthShaderCode.empty())
+        return;
+
+    //Depth pre-pass: same state, but only the vertex stage reading positions (the first binding and attribute) and no colour
+    VkShaderModule depthShaderModule = CreateShaderModule(depthShaderCode);
+    VkPipelineShaderStageCreateInfo depthShaderCreateInfo = vertexShaderCreateInfo;
+    depthShaderCreateInfo.module = depthShaderModule;
+
+    VkPipelineVertexInputStateCreateInfo positionInputStateCreateInfo = vertexInputStateCreateInfo;
+    positionInputStateCreateInfo.vertexBindingDescriptionCount = 1;
+    positionInputStateCreateInfo.vertexAttributeDescriptionCount = 1;
+
+    VkPipelineColorBlendAttachmentState noColorState{};
+    noColorState.colorWriteMask = 0;
+    noColorState.blendEnable = VK_FALSE;
+    VkPipelineColorBlendStateCreateInfo noColorBlendingCreateInfo = colorBlendingCreateInfo;
+    noColorBlendingCreateInfo.pAttachments = &noColorState;
+
+    pipelineCreateInfo.stageCount = 1;
+    pipelineCreateInfo.pStages = &depthShaderCreateInfo;
+    pipelineCreateInfo.pVertexInputState = &positionInputStateCreateInfo;
+    pipelineCreateInfo.pColorBlendState = &noColorBlendingCreateInfo;
+    pipelineCreateInfo.pDepthStencilState = &depthStencilStateCreateInfo;
+
+    result = vkCreateGraphicsPipelines(mainDevice.logicalDevice,VK_NULL_HANDLE,1,&pipelineCreateInfo,nullptr,&depthPrePassPipeline);
+    vkDestroyShaderModule(mainDevice.logicalDevice,depthShaderModule,nullptr);
+
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create the depth pre-pass pipeline");
+
+}
+
+void VulkanRenderer::CreateCullingPipeline()
+{
+    //Set 0: per frame culling data and the draw commands/counts written by the shader
+    //plus the depth pyramid and the instances culled as whole meshes
+    std::array<VkDescriptorSetLayoutBinding,5> cullingBindings{};
+    cullingBindings[0].binding = 0;
+    cullingBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    cullingBindings[0].descriptorCount = 1;
+    cullingBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    cullingBindings[1].binding = 1;
+    cullingBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    cullingBindings[1].descriptorCount = 1;
+    cullingBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    cullingBindings[2].binding = 2;
+    cullingBindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    cullingBindings[2].descriptorCount = 1;
+    cullingBindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    cullingBindings[3].binding = 3;
+    cullingBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    cullingBindings[3].descriptorCount = 1;
+    cullingBindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    cullingBindings[4].binding = 4;
+    cullingBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    cullingBindings[4].descriptorCount = 1;
+    cullingBindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.bindingCount = static_cast<uint32_t>(cullingBindings.size());
+    layoutCreateInfo.pBindings = cullingBindings.data();
+
+    VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice,&layoutCreateInfo,nullptr,&cullingSetLayout);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a culling descriptor set layout");
+
+    //Set 1: meshlets of the mesh being culled
+    VkDescriptorSetLayoutBinding meshletBinding{};
+    meshletBinding.binding = 0;
+    meshletBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    meshletBinding.descriptorCount = 1;
+    meshletBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    layoutCreateInfo.bindingCount = 1;
+    layoutCreateInfo.pBindings = &meshletBinding;
+
+    result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice,&layoutCreateInfo,nullptr,&meshletSetLayout);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a meshlet descriptor set layout");
+
+    std::array<VkDescriptorSetLayout,2> setLayouts = {cullingSetLayout,meshletSetLayout};
+
+    VkPushConstantRange cullingPushConstantRange{};
+    cullingPushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    cullingPushConstantRange.offset = 0;
+    cullingPushConstantRange.size = sizeof(PushCulling);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &cullingPushConstantRange;
+
+    result = vkCreatePipelineLayout(mainDevice.logicalDevice,&pipelineLayoutCreateInfo,nullptr,&cullingPipelineLayout);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create culling Pipeline Layout!");
+
+    //Without the compiled shader everything is still drawn, just without meshlet culling
+    cullingPipeline = CreateComputePipeline("Shaders/cull.spv",cullingPipelineLayout);
+    if(!cullingPipeline)
+    {
+        std::cerr << "Shaders/cull.spv not found, GPU culling disabled (run compile_shaders.bat)" << std::endl;
+        meshletCulling = false;
+        gpuCulling = false;
+        return;
+    }
+
+    //Whole mesh culling only uses set 0, with the instance range in push constants
+    VkPushConstantRange meshCullingPushConstantRange{};
+    meshCullingPushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    meshCullingPushConstantRange.offset = 0;
+    meshCullingPushConstantRange.size = sizeof(PushMeshCulling);
+
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &cullingSetLayout;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &meshCullingPushConstantRange;
+
+    result = vkCreatePipelineLayout(mainDevice.logicalDevice,&pipelineLayoutCreateInfo,nullptr,&meshCullingPipelineLayout);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create mesh culling Pipeline Layout!");
+
+    //Without it meshes are culled against the frustum on the CPU
+    meshCullingPipeline = CreateComputePipeline("Shaders/cullmesh.spv",meshCullingPipelineLayout);
+    if(!meshCullingPipeline)
+    {
+        std::cerr << "Shaders/cullmesh.spv not found, meshes are culled on the CPU (run compile_shaders.bat)" << std::endl;
+        gpuCulling = false;
+    }
 }
 
 void VulkanRenderer::CreateDepthBufferImage()
 {
-    VkFormat depthFormat = ChooseSupportedFormat(
-        {VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT,VK_FORMAT_D24_UNORM_S8_UINT},
-        VK_IMAGE_TILING_OPTIMAL,
-        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+    //Unless the depth pyramid reads it, depth only lives inside the render pass
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    VkMemoryPropertyFlags memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if(depthBufferSampled)
+        usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    else
+    {
+        usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        memoryProperties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    }
+
+    depthBufferImage = CreateImage(swapChainExtent.width,swapChainExtent.height,depthBufferFormat,VK_IMAGE_TILING_OPTIMAL
+        , usage,memoryProperties,&depthBufferImageMemory,1,msaaSamples);
+
+    depthBufferImageView = CreateImageView(depthBufferImage,depthBufferFormat,VK_IMAGE_ASPECT_DEPTH_BIT);
+}
+
+void VulkanRenderer::CreateDepthPyramid()
+{
+    //Top level is the depth buffer rounded down to a power of two, so every level after it is exactly half the size
+    depthPyramidWidth = 1;
+    while (depthPyramidWidth * 2 <= swapChainExtent.width)
+        depthPyramidWidth *= 2;
+    depthPyramidHeight = 1;
+    while (depthPyramidHeight * 2 <= swapChainExtent.height)
+        depthPyramidHeight *= 2;
+    depthPyramidLevels = 1;
+    while ((std::max(depthPyramidWidth,depthPyramidHeight) >> depthPyramidLevels) > 0)
+        depthPyramidLevels++;
+
+    //Created even when it can't be built, the culling shaders always have it bound (they skip the occlusion test)
+    depthPyramidImage = CreateImage(depthPyramidWidth,depthPyramidHeight,VK_FORMAT_R32_SFLOAT,VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,&depthPyramidImageMemory,
+        depthPyramidLevels);
+    depthPyramidImageView = CreateImageView(depthPyramidImage,VK_FORMAT_R32_SFLOAT,VK_IMAGE_ASPECT_COLOR_BIT,depthPyramidLevels);
+
+    //One view for each level to write it
+    depthPyramidMipViews.resize(depthPyramidLevels);
+    for (uint32_t level = 0; level < depthPyramidLevels; ++level)
+        depthPyramidMipViews[level] = CreateImageView(depthPyramidImage,VK_FORMAT_R32_SFLOAT,VK_IMAGE_ASPECT_COLOR_BIT,1,level);
+
+    //Only compute shaders use it, so it stays in the general layout
+    VkCommandBuffer commandBuffer = BeginCommandBuffer(mainDevice.logicalDevice,graphicsCommandPool);
+
+    VkImageMemoryBarrier imageMemoryBarrier{};
+    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.image = depthPyramidImage;
+    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageMemoryBarrier.subresourceRange.levelCount = depthPyramidLevels;
+    imageMemoryBarrier.subresourceRange.layerCount = 1;
+    imageMemoryBarrier.srcAccessMask = 0;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,0,
+        0,nullptr,0,nullptr,1,&imageMemoryBarrier);
+
+    EndAndSubmitCommandBuffer(mainDevice.logicalDevice,graphicsCommandPool,graphicsQueue,commandBuffer);
+
+    //Shaders read exact texels with texelFetch, no filtering
+    VkSamplerCreateInfo samplerCreateInfo{};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+    samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCreateInfo.minLod = 0.0f;
+    samplerCreateInfo.maxLod = static_cast<float>(depthPyramidLevels);
 
-    depthBufferImage = CreateImage(swapChainExtent.width,swapChainExtent.height,depthFormat,VK_IMAGE_TILING_OPTIMAL
-        , VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,&depthBufferImageMemory);
+    VkResult result = vkCreateSampler(mainDevice.logicalDevice,&samplerCreateInfo,nullptr,&depthPyramidSampler);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a depth pyramid sampler");
+}
+
+void VulkanRenderer::CreateDepthReducePipeline()
+{
+    if(!cullingPipeline)
+        return;
+
+    //Each level is built by reading the one above it (the depth buffer for the top level)
+    std::array<VkDescriptorSetLayoutBinding,2> reduceBindings{};
+    reduceBindings[0].binding = 0;
+    reduceBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    reduceBindings[0].descriptorCount = 1;
+    reduceBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    reduceBindings[1].binding = 1;
+    reduceBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    reduceBindings[1].descriptorCount = 1;
+    reduceBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.bindingCount = static_cast<uint32_t>(reduceBindings.size());
+    layoutCreateInfo.pBindings = reduceBindings.data();
+
+    VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice,&layoutCreateInfo,nullptr,&depthReduceSetLayout);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a depth reduce descriptor set layout");
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &depthReduceSetLayout;
+
+    result = vkCreatePipelineLayout(mainDevice.logicalDevice,&pipelineLayoutCreateInfo,nullptr,&depthReducePipelineLayout);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create depth reduce Pipeline Layout!");
+
+    //Without it meshes are still culled against the frustum, just not against what hides them
+    //Constant 0 says which depth is farthest, the pyramid keeps the farthest one
+    VkBool32 reverseDepthConstant = reverseDepth ? VK_TRUE : VK_FALSE;
+    VkSpecializationMapEntry specializationEntry{};
+    specializationEntry.constantID = 0;
+    specializationEntry.offset = 0;
+    specializationEntry.size = sizeof(VkBool32);
+
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &specializationEntry;
+    specializationInfo.dataSize = sizeof(VkBool32);
+    specializationInfo.pData = &reverseDepthConstant;
+
+    depthReducePipeline = CreateComputePipeline("Shaders/depthreduce.spv",depthReducePipelineLayout,&specializationInfo);
+    if(!depthReducePipeline)
+    {
+        std::cerr << "Shaders/depthreduce.spv not found, occlusion culling disabled (run compile_shaders.bat)" << std::endl;
+    }
+}
+
+void VulkanRenderer::CreateDepthReduceDescriptorSets()
+{
+    if(!depthReducePipeline)
+        return;
+
+    //One set for each level of the pyramid, so they are remade with it when the window is resized
+    std::array<VkDescriptorPoolSize,2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = depthPyramidLevels;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = depthPyramidLevels;
+
+    VkDescriptorPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.maxSets = depthPyramidLevels;
+    poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolCreateInfo.pPoolSizes = poolSizes.data();
+
+    VkResult result = vkCreateDescriptorPool(mainDevice.logicalDevice,&poolCreateInfo,nullptr,&depthReduceDescriptorPool);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a depth reduce Descriptor Pool!");
+
+    std::vector<VkDescriptorSetLayout> setLayouts(depthPyramidLevels,depthReduceSetLayout);
+    depthReduceDescriptorSets.resize(depthPyramidLevels);
+
+    VkDescriptorSetAllocateInfo setAllocInfo{};
+    setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setAllocInfo.descriptorPool = depthReduceDescriptorPool;
+    setAllocInfo.descriptorSetCount = depthPyramidLevels;
+    setAllocInfo.pSetLayouts = setLayouts.data();
+
+    result = vkAllocateDescriptorSets(mainDevice.logicalDevice,&setAllocInfo,depthReduceDescriptorSets.data());
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate depth reduce Descriptor Sets!");
+
+    //The top level reads the depth buffer, which is rewritten whenever the render targets are rebuilt
+    for (uint32_t level = depthBufferSampled ? 0 : 1; level < depthPyramidLevels; ++level)
+        WriteDepthReduceDescriptor(level);
+}
 
-    depthBufferImageView = CreateImageView(depthBufferImage,depthFormat,VK_IMAGE_ASPECT_DEPTH_BIT);
+void VulkanRenderer::WriteDepthReduceDescriptor(uint32_t level)
+{
+    VkDescriptorImageInfo inputInfo{};
+    inputInfo.sampler = depthPyramidSampler;
+    inputInfo.imageView = level == 0 ? depthBufferImageView : depthPyramidMipViews[level-1];
+    inputInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+    VkDescriptorImageInfo outputInfo{};
+    outputInfo.imageView = depthPyramidMipViews[level];
+    outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkWriteDescriptorSet,2> setWrites{};
+    setWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    setWrites[0].dstSet = depthReduceDescriptorSets[level];
+    setWrites[0].dstBinding = 0;
+    setWrites[0].descriptorCount = 1;
+    setWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    setWrites[0].pImageInfo = &inputInfo;
+    setWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    setWrites[1].dstSet = depthReduceDescriptorSets[level];
+    setWrites[1].dstBinding = 1;
+    setWrites[1].descriptorCount = 1;
+    setWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    setWrites[1].pImageInfo = &outputInfo;
+
+    UpdateDescriptorSets(mainDevice.logicalDevice,static_cast<uint32_t>(setWrites.size()),setWrites.data());
 }
 
 void VulkanRenderer::CreateFramebuffers()
 {
     //Resize framebuffer count to equal swap chain image count
-    swapchainFramebuffers.resize(swapchainImages.size());
+    swapchainFramebuffers.assign(swapchainImages.size(),VK_NULL_HANDLE);
+    framebufferGraphVersions.assign(swapchainImages.size(),0);
 
-    for (size_t i = 0; i < swapchainFramebuffers.size(); ++i)
+    //With MSAA the render graph only has the multisampled colour once a frame is recorded, they're made then
+    if(msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+        return;
+
+    for (uint32_t i = 0; i < swapchainFramebuffers.size(); ++i)
     {
-        std::array<VkImageView, 2> attachments = {
-            swapchainImages[i].imageView,
-            depthBufferImageView 
-        };
-        
-        VkFramebufferCreateInfo framebufferCreateInfo{};
-        framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferCreateInfo.renderPass = renderPass;    //Render pass layout the framebuffer will be used with
-        framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size()); 
-        framebufferCreateInfo.pAttachments = attachments.data(); //list of attachments (1:1 with render pass)
-        framebufferCreateInfo.width = swapChainExtent.width; //Framebuffer width
-        framebufferCreateInfo.height = swapChainExtent.height; //Framebuffer height
-        framebufferCreateInfo.layers = 1; //Framebuffer layers
-
-        VkResult result  = vkCreateFramebuffer(mainDevice.logicalDevice,&framebufferCreateInfo,nullptr, &swapchainFramebuffers[i]);
-        if(result != VK_SUCCESS)
-            throw std::runtime_error("Failed to create a framebuffer");
+        CreateFramebuffer(i,VK_NULL_HANDLE);
+    }
+}
+
+void VulkanRenderer::CreateFramebuffer(uint32_t imageIndex, VkImageView colourView)
+{
+    vkDestroyFramebuffer(mainDevice.logicalDevice,swapchainFramebuffers[imageIndex],nullptr);
+    swapchainFramebuffers[imageIndex] = VK_NULL_HANDLE;
+
+    //With MSAA the swapchain image is only the resolve target
+    std::array<VkImageView,3> attachments = {swapchainImages[imageIndex].imageView,depthBufferImageView,VK_NULL_HANDLE};
+    uint32_t attachmentCount = 2;
+    if(colourView)
+    {
+        attachments = {colourView,depthBufferImageView,swapchainImages[imageIndex].imageView};
+        attachmentCount = 3;
     }
+
+    VkFramebufferCreateInfo framebufferCreateInfo{};
+    framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferCreateInfo.renderPass = renderPass;    //Render pass layout the framebuffer will be used with
+    framebufferCreateInfo.attachmentCount = attachmentCount;
+    framebufferCreateInfo.pAttachments = attachments.data(); //list of attachments (1:1 with render pass)
+    framebufferCreateInfo.width = swapChainExtent.width; //Framebuffer width
+    framebufferCreateInfo.height = swapChainExtent.height; //Framebuffer height
+    framebufferCreateInfo.layers = 1; //Framebuffer layers
+
+    VkResult result  = vkCreateFramebuffer(mainDevice.logicalDevice,&framebufferCreateInfo,nullptr, &swapchainFramebuffers[imageIndex]);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a framebuffer");
 }
 
 void VulkanRenderer::CreateCommandPool()
@@ -800,8 +1452,9 @@ void VulkanRenderer::CreateCommandPool()
 
 void VulkanRenderer::CreateCommandBuffers()
 {
-    //Resize command buffer count to have one for each framebuffer
-    commandBuffers.resize(swapchainFramebuffers.size());
+    //Resize command buffer count to have one for each swapchain image
+    commandBuffers.resize(swapchainImages.size());
+    imageTimelineValues.assign(swapchainImages.size(),0);
 
     VkCommandBufferAllocateInfo cbAllocInfo{};
     cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -817,27 +1470,63 @@ void VulkanRenderer::CreateCommandBuffers()
     }
 }
 
+void VulkanRenderer::CreatePipelineStatisticsQueryPool()
+{
+    if(!pipelineStatisticsSupported)
+        return;
+
+    //One query for each command buffer, covering everything it draws and dispatches
+    VkQueryPoolCreateInfo queryPoolCreateInfo{};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    queryPoolCreateInfo.queryCount = static_cast<uint32_t>(commandBuffers.size());
+    queryPoolCreateInfo.pipelineStatistics = PIPELINE_STATISTICS;
+
+    if(vkCreateQueryPool(mainDevice.logicalDevice,&queryPoolCreateInfo,nullptr,&pipelineStatisticsQueryPool) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a pipeline statistics query pool");
+    pipelineStatisticsRecorded.assign(commandBuffers.size(),false);
+}
+
+void VulkanRenderer::ReadPipelineStatistics(uint32_t currentImage)
+{
+    if(!pipelineStatisticsQueryPool || !pipelineStatisticsRecorded[currentImage])
+        return;
+
+    //In the order of the PIPELINE_STATISTICS bits, left as last read if the GPU isn't done with them yet
+    std::array<uint64_t,6> results{};
+    VkResult result = vkGetQueryPoolResults(mainDevice.logicalDevice,pipelineStatisticsQueryPool,currentImage,1,
+        sizeof(results),results.data(),sizeof(results),VK_QUERY_RESULT_64_BIT);
+    if(result != VK_SUCCESS)
+        return;
+
+    recordingStats.pipelineStatisticsValid = true;
+    recordingStats.inputAssemblyPrimitives = results[0];
+    recordingStats.vertexShaderInvocations = results[1];
+    recordingStats.clippingInvocations = results[2];
+    recordingStats.clippingPrimitives = results[3];
+    recordingStats.fragmentShaderInvocations = results[4];
+    recordingStats.computeShaderInvocations = results[5];
+}
+
 void VulkanRenderer::CreateSynchronisation()
 {
     imageAvailable.resize(MAX_FRAME_DRAWS);
     renderFinished.resize(MAX_FRAME_DRAWS);
-    drawFences.resize(MAX_FRAME_DRAWS);
+    //Nothing submitted yet, value 0 counts as done
+    frameTimelineValues.assign(MAX_FRAME_DRAWS,0);
     //Semaphore creation information
     VkSemaphoreCreateInfo semaphoreCreateInfo{};
     semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    //Fence creation information
-    VkFenceCreateInfo fenceCreateInfo{};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    
+    //The swapchain only works with binary semaphores, everything else waits on the queue's timeline
     for(size_t i = 0; i< MAX_FRAME_DRAWS; i++)
     {
         if(vkCreateSemaphore(mainDevice.logicalDevice,&semaphoreCreateInfo,nullptr,&imageAvailable[i]) != VK_SUCCESS ||
-            vkCreateSemaphore(mainDevice.logicalDevice,&semaphoreCreateInfo,nullptr,&renderFinished[i]) != VK_SUCCESS ||
-            vkCreateFence(mainDevice.logicalDevice,&fenceCreateInfo, nullptr,&drawFences[i]) != VK_SUCCESS)
+            vkCreateSemaphore(mainDevice.logicalDevice,&semaphoreCreateInfo,nullptr,&renderFinished[i]) != VK_SUCCESS)
                 throw std::runtime_error("Error creating semaphores or fence");
     }
+
+    graphicsTimeline.Init(mainDevice.logicalDevice,graphicsQueue,timelineSemaphoreSupported);
 }
 
 void VulkanRenderer::CreateTextureSampler()
@@ -855,7 +1544,7 @@ void VulkanRenderer::CreateTextureSampler()
     samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerCreateInfo.mipLodBias = 0.0f;
     samplerCreateInfo.minLod = 0.0f;
-    samplerCreateInfo.maxLod = 0.0f;
+    samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE; //Streamed textures can have any number of mips resident
     samplerCreateInfo.anisotropyEnable = VK_TRUE;
     samplerCreateInfo.maxAnisotropy = 16;
 
@@ -892,44 +1581,235 @@ void VulkanRenderer::CreateUniformBuffers()
     }
 }
 
-void VulkanRenderer::CreateDescriptorPool()
+void VulkanRenderer::CreateVertexColourBuffer()
 {
-    //Create uniform descriptor pool       
-    
-    //View projection pool
-    VkDescriptorPoolSize vpPoolSize{};
-    vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffer.size());
+    //Every mesh is drawn white, so one colour is enough for all of them
+    glm::vec3 colour(1.0f,1.0f,1.0f);
+    VkDeviceSize bufferSize = sizeof(colour);
 
-    //Model pool (dynamic)
-    /*VkDescriptorPoolSize modelPoolSize{};
-    modelPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    modelPoolSize.descriptorCount = static_cast<uint32_t>(modelUniformBuffer.size());
-    */
+    //Small and never changes, no need for a staging buffer
+    CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,bufferSize,VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,&vertexColourBuffer,&vertexColourBufferMemory);
+
+    void* data;
+    vkMapMemory(mainDevice.logicalDevice,vertexColourBufferMemory,0,bufferSize,0,&data);
+    memcpy(data,&colour,sizeof(colour));
+    vkUnmapMemory(mainDevice.logicalDevice,vertexColourBufferMemory);
+}
+
+void VulkanRenderer::CreateCullingBuffers()
+{
+    if(!cullingPipeline)
+        return;
+
+    //Like the VP uniform buffers, one set for each image
+    size_t size = swapchainImages.size();
+    cullingUniformBuffer.resize(size);
+    cullingUniformBufferMemory.resize(size);
+    drawCommandBuffer.resize(size);
+    drawCommandBufferMemory.resize(size);
+    drawCountBuffer.resize(size);
+    drawCountBufferMemory.resize(size);
+    cullingInstanceBuffer.resize(size);
+    cullingInstanceBufferMemory.resize(size);
+    visibilityBuffer.resize(size);
+    visibilityBufferMemory.resize(size);
+    visibilityCountIndices.resize(size);
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,sizeof(UboCulling),VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,&cullingUniformBuffer[i],&cullingUniformBufferMemory[i]);
+
+        //Written by the culling shaders, read by the indirect draws, meshlet ranges are cleared with vkCmdFillBuffer
+        //Meshlet commands and counts come first, then one for each mesh culled as a whole, then the same again for the second pass
+        CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,
+            (MAX_MESHLET_DRAWS + 2 * MAX_CULLED_MESHES) * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,&drawCommandBuffer[i],&drawCommandBufferMemory[i]);
+
+        VkDeviceSize countsSize = (MAX_MESHLET_MESHES + 2 * MAX_CULLED_MESHES) * sizeof(uint32_t);
+        CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,countsSize,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,&drawCountBuffer[i],&drawCountBufferMemory[i]);
+
+        //The counts again where the CPU can read them, for texture streaming
+        CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,countsSize,VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,&visibilityBuffer[i],&visibilityBufferMemory[i]);
+
+        //Model matrix, bounds and index range of every mesh culled as a whole, written each frame
+        CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,MAX_CULLED_MESHES * sizeof(CullingInstance),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &cullingInstanceBuffer[i],&cullingInstanceBufferMemory[i]);
+    }
+}
+
+void VulkanRenderer::CreateCullingDescriptorSets()
+{
+    if(!cullingPipeline)
+        return;
+
+    uint32_t frameSets = static_cast<uint32_t>(swapchainImages.size());
+
+    //Per frame sets plus one meshlet set per mesh, meshlet sets are freed with their model
+    std::array<VkDescriptorPoolSize,3> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = frameSets;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = frameSets * 3 + MAX_MESHLET_MESHES;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[2].descriptorCount = frameSets;
 
-    std::vector<VkDescriptorPoolSize> pools ={vpPoolSize};
-    
-    //Data to create descriptor pool
     VkDescriptorPoolCreateInfo poolCreateInfo{};
     poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolCreateInfo.maxSets = static_cast<uint32_t>(swapchainImages.size());
-    poolCreateInfo.poolSizeCount = static_cast<uint32_t>(pools.size());
-    poolCreateInfo.pPoolSizes = pools.data();
+    poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolCreateInfo.maxSets = frameSets + MAX_MESHLET_MESHES;
+    poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolCreateInfo.pPoolSizes = poolSizes.data();
 
-    //Create descriptor pool
-    VkResult result = vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo,nullptr,&descriptorPool);
+    VkResult result = vkCreateDescriptorPool(mainDevice.logicalDevice,&poolCreateInfo,nullptr,&cullingDescriptorPool);
     if(result != VK_SUCCESS)
-        throw std::runtime_error("Error creating descriptor pool");
+        throw std::runtime_error("Failed to create a culling Descriptor Pool!");
 
-    //Create sampler descriptor pool
-    //Texture sampler pool
-    VkDescriptorPoolSize samplerPoolSize{};
-    samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerPoolSize.descriptorCount = MAX_OBJECTS;
+    std::vector<VkDescriptorSetLayout> setLayouts(frameSets,cullingSetLayout);
+    cullingDescriptorSets.resize(frameSets);
+
+    VkDescriptorSetAllocateInfo setAllocInfo{};
+    setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setAllocInfo.descriptorPool = cullingDescriptorPool;
+    setAllocInfo.descriptorSetCount = frameSets;
+    setAllocInfo.pSetLayouts = setLayouts.data();
+
+    result = vkAllocateDescriptorSets(mainDevice.logicalDevice,&setAllocInfo,cullingDescriptorSets.data());
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate culling Descriptor Sets!");
+
+    for (size_t i = 0; i < frameSets; ++i)
+    {
+        std::array<VkDescriptorBufferInfo,5> bufferInfos{};
+        bufferInfos[0].buffer = cullingUniformBuffer[i];
+        bufferInfos[0].range = sizeof(UboCulling);
+        bufferInfos[1].buffer = drawCommandBuffer[i];
+        bufferInfos[1].range = VK_WHOLE_SIZE;
+        bufferInfos[2].buffer = drawCountBuffer[i];
+        bufferInfos[2].range = VK_WHOLE_SIZE;
+        bufferInfos[4].buffer = cullingInstanceBuffer[i];
+        bufferInfos[4].range = VK_WHOLE_SIZE;
+
+        //Binding 3 is the depth pyramid, written below
+        std::array<VkWriteDescriptorSet,4> setWrites{};
+        std::array<uint32_t,4> bindings = {0,1,2,4};
+        for (size_t write = 0; write < setWrites.size(); ++write)
+        {
+            setWrites[write].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            setWrites[write].dstSet = cullingDescriptorSets[i];
+            setWrites[write].dstBinding = bindings[write];
+            setWrites[write].descriptorCount = 1;
+            setWrites[write].descriptorType = bindings[write] == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            setWrites[write].pBufferInfo = &bufferInfos[bindings[write]];
+        }
+
+        UpdateDescriptorSets(mainDevice.logicalDevice,static_cast<uint32_t>(setWrites.size()),setWrites.data());
+    }
+
+    WriteCullingDepthPyramidDescriptors();
+}
+
+void VulkanRenderer::WriteCullingDepthPyramidDescriptors()
+{
+    VkDescriptorImageInfo depthPyramidInfo{};
+    depthPyramidInfo.sampler = depthPyramidSampler;
+    depthPyramidInfo.imageView = depthPyramidImageView;
+    depthPyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    for (VkDescriptorSet descriptorSet : cullingDescriptorSets)
+    {
+        VkWriteDescriptorSet setWrite{};
+        setWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        setWrite.dstSet = descriptorSet;
+        setWrite.dstBinding = 3;
+        setWrite.descriptorCount = 1;
+        setWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        setWrite.pImageInfo = &depthPyramidInfo;
+
+        UpdateDescriptorSets(mainDevice.logicalDevice,1,&setWrite);
+    }
+}
+
+void VulkanRenderer::CreateMeshletDescriptorSet(Mesh* mesh)
+{
+    if(!cullingPipeline || mesh->GetMeshletCount() == 0)
+        return;
+
+    VkDescriptorSetAllocateInfo setAllocInfo{};
+    setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setAllocInfo.descriptorPool = cullingDescriptorPool;
+    setAllocInfo.descriptorSetCount = 1;
+    setAllocInfo.pSetLayouts = &meshletSetLayout;
+
+    //Pool full: the mesh is just drawn without meshlet culling
+    VkDescriptorSet descriptorSet;
+    if(vkAllocateDescriptorSets(mainDevice.logicalDevice,&setAllocInfo,&descriptorSet) != VK_SUCCESS)
+        return;
+
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = mesh->GetMeshletBuffer();
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet setWrite{};
+    setWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    setWrite.dstSet = descriptorSet;
+    setWrite.dstBinding = 0;
+    setWrite.descriptorCount = 1;
+    setWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    setWrite.pBufferInfo = &bufferInfo;
+
+    UpdateDescriptorSets(mainDevice.logicalDevice,1,&setWrite);
+    mesh->SetMeshletDescriptorSet(cullingDescriptorPool,descriptorSet);
+}
+
+void VulkanRenderer::CreateDescriptorPool()
+{
+    //Create uniform descriptor pool       
+    
+    //View projection pool
+    VkDescriptorPoolSize vpPoolSize{};
+    vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffer.size());
+
+    //Model pool (dynamic)
+    /*VkDescriptorPoolSize modelPoolSize{};
+    modelPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    modelPoolSize.descriptorCount = static_cast<uint32_t>(modelUniformBuffer.size());
+    */
+
+    std::vector<VkDescriptorPoolSize> pools ={vpPoolSize};
+    
+    //Data to create descriptor pool
+    VkDescriptorPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.maxSets = static_cast<uint32_t>(swapchainImages.size());
+    poolCreateInfo.poolSizeCount = static_cast<uint32_t>(pools.size());
+    poolCreateInfo.pPoolSizes = pools.data();
+
+    //Create descriptor pool
+    VkResult result = vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo,nullptr,&descriptorPool);
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Error creating descriptor pool");
+
+    //Create sampler descriptor pool
+    //Texture sampler pool
+    VkDescriptorPoolSize samplerPoolSize{};
+    samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    //Textures changing residency hold an extra set until the frames using the old one are finished
+    uint32_t maxTextureSets = MAX_OBJECTS + MAX_TEXTURE_UPDATES_PER_FRAME * (MAX_FRAME_DRAWS + 1);
+    samplerPoolSize.descriptorCount = maxTextureSets;
 
     VkDescriptorPoolCreateInfo  samplerCreateInfo{};
     samplerCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    samplerCreateInfo.maxSets = MAX_OBJECTS;
+    samplerCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT; //Texture sets are freed when the texture is released
+    samplerCreateInfo.maxSets = maxTextureSets;
     samplerCreateInfo.poolSizeCount = 1;
     samplerCreateInfo.pPoolSizes = &samplerPoolSize;
 
@@ -995,7 +1875,7 @@ void VulkanRenderer::CreateDescriptorSets()
         std::vector<VkWriteDescriptorSet> setWrites{vpSetWrite};
 
         //Update the descriptor set with new buffer/binding info
-        vkUpdateDescriptorSets(mainDevice.logicalDevice,static_cast<uint32_t>(setWrites.size()),setWrites.data(),0,nullptr);
+        UpdateDescriptorSets(mainDevice.logicalDevice,static_cast<uint32_t>(setWrites.size()),setWrites.data());
     }
 }
 
@@ -1008,6 +1888,19 @@ void VulkanRenderer::UpdateUniformBuffer(uint32_t imageIndex)
     memcpy(data,&uboViewProjection,sizeof(UboViewProjection));
     vkUnmapMemory(mainDevice.logicalDevice,vpUniformBufferMemory[imageIndex]);
 
+    //Copy culling data
+    if(!cullingUniformBuffer.empty())
+    {
+        ExtractFrustumPlanes(uboViewProjection.projection * uboViewProjection.view,uboCulling.frustumPlanes);
+        uboCulling.cameraPosition = glm::vec4(glm::vec3(glm::inverse(uboViewProjection.view)[3]),1.0f);
+        uboCulling.view = uboViewProjection.view;
+        uboCulling.projection = uboViewProjection.projection;
+
+        vkMapMemory(mainDevice.logicalDevice, cullingUniformBufferMemory[imageIndex],0,sizeof(UboCulling),0,&data);
+        memcpy(data,&uboCulling,sizeof(UboCulling));
+        vkUnmapMemory(mainDevice.logicalDevice,cullingUniformBufferMemory[imageIndex]);
+    }
+
     //Copy model data
     // for (size_t i = 0; i < meshList.size(); ++i)
     // {
@@ -1022,6 +1915,9 @@ void VulkanRenderer::UpdateUniformBuffer(uint32_t imageIndex)
 
 void VulkanRenderer::RecordCommands(uint32_t currentImage)
 {
+    //Last frame's lists were only used while it was recorded
+    frameArena.Reset();
+
     //Information about how to begin each command buffer
     VkCommandBufferBeginInfo bufferBeginInfo{};
     bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1035,14 +1931,83 @@ void VulkanRenderer::RecordCommands(uint32_t currentImage)
     renderPassBeginInfo.renderArea.extent = swapChainExtent; //Size of region to run render pass on (starting at offset)
     std::array<VkClearValue,2> clearValues{};
     clearValues[0].color ={0.6f,0.65f,0.4f,1.0f};
-    clearValues[1].depthStencil.depth = 1.0f;
+    clearValues[1].depthStencil.depth = reverseDepth ? 0.0f : 1.0f; //Farthest possible depth
     
     renderPassBeginInfo.pClearValues = clearValues.data(); //List of clear values
     renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     
    
     renderPassBeginInfo.framebuffer = swapchainFramebuffers[currentImage];
+
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(uboViewProjection.view)[3]);
+
+    //World transforms of models and nodes that moved since last frame
+    for (size_t i = 0; i < modelList.size(); ++i)
+    {
+        modelList[i].SetModel(transformStore.GetMatrix(static_cast<uint32_t>(i)));
+        modelList[i].UpdateTransforms();
+    }
+
+    //Meshes are culled on the GPU when the culling shaders are there,
+    //otherwise against the frustum on the CPU first so meshes outside cost nothing from here on
+    bool cullOnGpu = gpuCulling && meshCullingPipeline;
+    size_t meshCount = 0;
+    for (MeshModel& meshModel : modelList)
+        meshCount += meshModel.GetMeshCount();
+    if(!cullOnGpu)
+    {
+        frustumCuller.Resize(meshCount);
+
+        size_t boundsIndex = 0;
+        for (MeshModel& meshModel : modelList)
+        {
+            for (size_t k = 0; k < meshModel.GetMeshCount(); ++k)
+            {
+                const Mesh* mesh = meshModel.GetMesh(k);
+                frustumCuller.SetBounds(boundsIndex++,meshModel.GetMeshTransform(k),mesh->GetBoundsMin(),mesh->GetBoundsMax(),
+                    mesh->GetBoundsCenter(),mesh->GetBoundsRadius());
+            }
+        }
+        frustumCuller.Cull(uboViewProjection.projection * uboViewProjection.view,meshVisible);
+    }
+
+    //Then pick the visible meshes' level of detail, the GPU culls them (or their meshlets) before the render pass.
+    //Meshes culled as a whole on the GPU get theirs from the culling shader, only meshlet culling (full detail only) needs it here
+    ArenaVector<MeshDraw> meshDraws{ArenaAllocator<MeshDraw>(frameArena)};
+    meshDraws.reserve(meshCount);
+    for (MeshModel& meshModel : modelList)
+    {
+        for (size_t k = 0; k < meshModel.GetMeshCount(); ++k)
+        {
+            const Mesh* mesh = meshModel.GetMesh(k);
+            bool lodOnGpu = cullOnGpu && !(meshletCulling && mesh->GetMeshletDescriptorSet());
+
+            MeshDraw meshDraw{};
+            meshDraw.visible = cullOnGpu || meshVisible[meshDraws.size()] != 0;
+            meshDraw.textureUsed = meshDraw.visible;
+            meshDraw.culledAsWhole = false;
+            meshDraw.lod = meshDraw.visible && !lodOnGpu ? GetLodLevel(meshModel.GetMeshTransform(k),mesh,cameraPosition) : 0;
+            meshDraw.commandOffset = -1;
+            meshDraws.push_back(meshDraw);
+        }
+    }
+
+    //The CPU doesn't know which meshes the GPU culls this frame, texture streaming goes by what it drew the last time
+    if(cullOnGpu)
+        ReadVisibility(currentImage,meshDraws);
     
+    //Counted from here on, GPU counts are from the last time this command buffer ran
+    FrameStats lastStats = frameStats;
+    recordingStats = FrameStats{};
+    recordingStats.pipelineStatisticsValid = lastStats.pipelineStatisticsValid;
+    recordingStats.inputAssemblyPrimitives = lastStats.inputAssemblyPrimitives;
+    recordingStats.vertexShaderInvocations = lastStats.vertexShaderInvocations;
+    recordingStats.clippingInvocations = lastStats.clippingInvocations;
+    recordingStats.clippingPrimitives = lastStats.clippingPrimitives;
+    recordingStats.fragmentShaderInvocations = lastStats.fragmentShaderInvocations;
+    recordingStats.computeShaderInvocations = lastStats.computeShaderInvocations;
+    ReadPipelineStatistics(currentImage);
+
     //Start recording commands to command buffer!
     VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage],&bufferBeginInfo);
     if(result)
@@ -1050,43 +2015,174 @@ void VulkanRenderer::RecordCommands(uint32_t currentImage)
         throw std::runtime_error("Failed to start recording a Command Buffer");
     }
 
-    
-    vkCmdBeginRenderPass(commandBuffers[currentImage],&renderPassBeginInfo,VK_SUBPASS_CONTENTS_INLINE);
+    if(pipelineStatisticsQueryPool)
+    {
+        vkCmdResetQueryPool(commandBuffers[currentImage],pipelineStatisticsQueryPool,currentImage,1);
+        vkCmdBeginQuery(commandBuffers[currentImage],pipelineStatisticsQueryPool,currentImage,0);
+    }
 
-        //Bind pipeline to be used in render pass
-        vkCmdBindPipeline(commandBuffers[currentImage],VK_PIPELINE_BIND_POINT_GRAPHICS,graphicsPipeline);
+    //Streamed texture mips are copied before the render pass that samples them
+    RecordTextureUploads(commandBuffers[currentImage]);
 
-                for(size_t j = 0; j< modelList.size(); j++)
-                {
-                    MeshModel* thisModel = &modelList[j];
-                    vkCmdPushConstants(commandBuffers[currentImage], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
-                                       sizeof(Model), &thisModel->GetModel());
+    //The rest of the frame as passes, the graph works out the barriers between them from what each one reads and writes
+    frameGraph.Reset();
 
-                    for (size_t k = 0; k < thisModel->GetMeshCount(); ++k)
-                    {
-                        VkBuffer vertexBuffers[] = {thisModel->GetMesh(k)->GetVertexBuffer()}; // Buffers to bind
-                        VkDeviceSize offsets[] ={0}; //Offsets into buffers being bound
-                        vkCmdBindVertexBuffers(commandBuffers[currentImage],0,1, vertexBuffers,offsets);
+    //Cleared every frame (so its old contents don't matter), but last frame's passes may still be using it
+    VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if(depthBufferFormat == VK_FORMAT_D32_SFLOAT_S8_UINT || depthBufferFormat == VK_FORMAT_D24_UNORM_S8_UINT)
+        depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    RenderGraph::ResourceId depthBuffer = frameGraph.ImportImage("Depth buffer",depthBufferImage,depthBufferImageView,depthAspect,
+        VK_IMAGE_LAYOUT_UNDEFINED,VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+    //Built at the end of last frame, read by this frame's culling and rebuilt for the next one
+    RenderGraph::ResourceId depthPyramid = 0;
+    if(depthPyramidImage)
+    {
+        depthPyramid = frameGraph.ImportImage("Depth pyramid",depthPyramidImage,depthPyramidImageView,VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_GENERAL,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_ACCESS_SHADER_WRITE_BIT);
+        frameGraph.MarkOutput(depthPyramid);
+    }
 
-                        vkCmdBindIndexBuffer(commandBuffers[currentImage],thisModel->GetMesh(k)->GetIndexBuffer(),0,VK_INDEX_TYPE_UINT32);
+    RenderGraph::ResourceId drawCommands = 0;
+    RenderGraph::ResourceId drawCounts = 0;
+    if(cullingPipeline)
+    {
+        //Only this image's frame uses them, and it's finished before they're recorded again
+        drawCommands = frameGraph.ImportBuffer("Draw commands",drawCommandBuffer[currentImage],0,0);
+        drawCounts = frameGraph.ImportBuffer("Draw counts",drawCountBuffer[currentImage],0,0);
 
-                        //Dynamic offset amount
-                        //uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment)*j;
+        RenderGraph::PassBuilder cullingPass = frameGraph.AddPass("Culling",[&](VkCommandBuffer)
+        {
+            RecordCulling(currentImage,meshDraws,cameraPosition);
+        });
+        cullingPass.Write(drawCommands,RenderGraph::Usage::ComputeWrite).Write(drawCounts,RenderGraph::Usage::ComputeWrite);
+        if(depthPyramidImage)
+            cullingPass.Read(depthPyramid,RenderGraph::Usage::ComputeRead);
+    }
 
-                        std::array<VkDescriptorSet,2> descriptorSetGroup  = {descriptorSets[currentImage],
-                            samplerDescriptorSets[thisModel->GetMesh(k)->GetTexId()]};
-                    
-                    
+    //With MSAA the scene is drawn to a multisampled colour image that is resolved before the pass ends, so the graph
+    //can create it for the pass (and give its memory to other images that aren't used at the same time)
+    bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+    RenderGraph::ResourceId msaaColour = 0;
+    if(multisampled)
+    {
+        RenderGraph::ImageDesc colourDesc{};
+        colourDesc.format = swapChainImageFormat;
+        colourDesc.width = swapChainExtent.width;
+        colourDesc.height = swapChainExtent.height;
+        colourDesc.mipLevels = 1;
+        colourDesc.samples = msaaSamples;
+        colourDesc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        colourDesc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        msaaColour = frameGraph.CreateImage("MSAA colour",colourDesc);
+    }
 
-                        vkCmdBindDescriptorSets(commandBuffers[currentImage],VK_PIPELINE_BIND_POINT_GRAPHICS,pipelineLayout,
-                            0,static_cast<uint32_t>(descriptorSetGroup.size()),descriptorSetGroup.data(),0,nullptr);
+    //Both scene passes, the second one draws the meshes the second culling pass found on top of the first one's
+    VkRenderPassBeginInfo secondRenderPassBeginInfo = renderPassBeginInfo;
+    secondRenderPassBeginInfo.renderPass = secondCullingRenderPass;
+    auto recordScene = [&](VkCommandBuffer commandBuffer, bool secondPass)
+    {
+        //The graph has placed its images by now
+        msaaColourView = multisampled ? frameGraph.GetImageView(msaaColour) : VK_NULL_HANDLE;
 
-                        //Execute pipeline
-                        vkCmdDrawIndexed(commandBuffers[currentImage],thisModel->GetMesh(k)->GetIndicesCount(),1,0,0,0);
-                    }
-                }
-    
-    vkCmdEndRenderPass(commandBuffers[currentImage]);
+        //A new multisampled colour image (the graph only replaces it when the frame changes) needs a new framebuffer
+        if(multisampled && (!swapchainFramebuffers[currentImage] ||
+            framebufferGraphVersions[currentImage] != frameGraph.GetTransientImageVersion()))
+        {
+            CreateFramebuffer(currentImage,msaaColourView);
+            framebufferGraphVersions[currentImage] = frameGraph.GetTransientImageVersion();
+            renderPassBeginInfo.framebuffer = swapchainFramebuffers[currentImage];
+            steadyFrames = 0;
+        }
+        vkCmdBeginRenderPass(commandBuffer,secondPass ? &secondRenderPassBeginInfo : &renderPassBeginInfo,VK_SUBPASS_CONTENTS_INLINE);
+
+        //Whole swapchain image, set here so pipelines don't have to be rebuilt when it's resized
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = static_cast<float>(swapChainExtent.width);
+        viewport.height = static_cast<float>(swapChainExtent.height);
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer,0,1,&viewport);
+
+        VkRect2D scissor{};
+        scissor.offset = {0,0};
+        scissor.extent = swapChainExtent;
+        vkCmdSetScissor(commandBuffer,0,1,&scissor);
+
+        //Depth of everything first, then the main pass only shades the surface that ends up visible in each pixel
+        if(depthPrePassPipeline)
+            RecordMeshDraws(currentImage,meshDraws,cameraPosition,true,secondPass);
+        RecordMeshDraws(currentImage,meshDraws,cameraPosition,false,secondPass);
+
+        vkCmdEndRenderPass(commandBuffer);
+    };
+
+    RenderGraph::PassBuilder scenePass = frameGraph.AddPass("Scene",[&](VkCommandBuffer commandBuffer)
+    {
+        recordScene(commandBuffer,false);
+    });
+    //Presented, so always kept
+    scenePass.Write(depthBuffer,RenderGraph::Usage::DepthAttachment).SideEffects();
+    if(multisampled)
+        scenePass.Write(msaaColour,RenderGraph::Usage::ColourAttachment);
+    if(cullingPipeline)
+        scenePass.Read(drawCommands,RenderGraph::Usage::IndirectRead).Read(drawCounts,RenderGraph::Usage::IndirectRead);
+
+    //Next frame culls against what was drawn in this one, only worth building for culling shaders that will read it
+    bool culledOnGpu = meshletCulling || cullOnGpu;
+    bool buildDepthPyramid = depthPyramidImage && depthReducePipeline && depthBufferSampled && culledOnGpu;
+    if(buildDepthPyramid)
+    {
+        frameGraph.AddPass("Depth pyramid",[&](VkCommandBuffer)
+        {
+            RecordDepthPyramid(currentImage);
+        }).Read(depthBuffer,RenderGraph::Usage::ComputeSampled).Write(depthPyramid,RenderGraph::Usage::ComputeWrite);
+    }
+
+    //Meshes culled as a whole that last frame's depth hid are tested again against this frame's and drawn on top,
+    //so nothing coming out from behind another mesh shows up a frame late
+    bool secondCullingPass = buildDepthPyramid && cullOnGpu && secondCullingRenderPass;
+    if(secondCullingPass)
+    {
+        frameGraph.AddPass("Second culling",[&](VkCommandBuffer)
+        {
+            RecordSecondCulling(currentImage);
+        }).Read(depthPyramid,RenderGraph::Usage::ComputeRead).Write(drawCommands,RenderGraph::Usage::ComputeWrite)
+          .Write(drawCounts,RenderGraph::Usage::ComputeWrite);
+
+        frameGraph.AddPass("Second scene",[&](VkCommandBuffer commandBuffer)
+        {
+            recordScene(commandBuffer,true);
+        }).Write(depthBuffer,RenderGraph::Usage::DepthAttachment).Read(drawCommands,RenderGraph::Usage::IndirectRead)
+          .Read(drawCounts,RenderGraph::Usage::IndirectRead).SideEffects();
+    }
+
+    if(cullOnGpu)
+    {
+        frameGraph.AddPass("Visibility readback",[&](VkCommandBuffer)
+        {
+            RecordVisibilityReadback(currentImage,secondCullingPass);
+        }).Read(drawCounts,RenderGraph::Usage::TransferRead).SideEffects();
+    }
+
+    frameGraph.Compile();
+    frameGraph.Execute(commandBuffers[currentImage]);
+
+    if(!buildDepthPyramid)
+        depthPyramidBuilt = false;
+
+    if(pipelineStatisticsQueryPool)
+    {
+        vkCmdEndQuery(commandBuffers[currentImage],pipelineStatisticsQueryPool,currentImage);
+        pipelineStatisticsRecorded[currentImage] = true;
+    }
+
+    //Uploads and descriptor updates since the last frame
+    FrameCounters::Collect(recordingStats);
+    frameStats = recordingStats;
 
     //Stop recording to command buffer
     result = vkEndCommandBuffer(commandBuffers[currentImage]);
@@ -1095,6 +2191,356 @@ void VulkanRenderer::RecordCommands(uint32_t currentImage)
 
 }
 
+void VulkanRenderer::RecordMeshDraws(uint32_t currentImage, const ArenaVector<MeshDraw>& meshDraws, const glm::vec3& cameraPosition,
+    bool depthOnly, bool secondPass)
+{
+    CommandRecorder recorder(commandBuffers[currentImage],recordingStats);
+
+    //Bind pipeline to be used in render pass
+    recorder.BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS,depthOnly ? depthPrePassPipeline : graphicsPipeline);
+
+    size_t drawIndex = 0;
+    for(size_t j = 0; j< modelList.size(); j++)
+    {
+        MeshModel* thisModel = &modelList[j];
+
+        for (size_t k = 0; k < thisModel->GetMeshCount(); ++k)
+        {
+            const MeshDraw& meshDraw = meshDraws[drawIndex++];
+            if(!meshDraw.visible || (secondPass && !meshDraw.culledAsWhole))
+                continue;
+
+            //Mesh positions are quantised, the model matrix also has to undo that
+            glm::mat4 meshModel = thisModel->GetMeshTransform(k) * thisModel->GetMesh(k)->GetPositionTransform();
+            recorder.PushConstants(pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(Model), &meshModel);
+
+            //The pre-pass only reads positions
+            VkBuffer vertexBuffers[] = {thisModel->GetMesh(k)->GetVertexBuffer(),vertexColourBuffer}; // Buffers to bind
+            VkDeviceSize offsets[] ={0,0}; //Offsets into buffers being bound
+            recorder.BindVertexBuffers(VERTEX_BINDING,depthOnly ? 1 : 2, vertexBuffers,offsets);
+
+            recorder.BindIndexBuffer(thisModel->GetMesh(k)->GetIndexBuffer(),0,
+                thisModel->GetMesh(k)->GetIndexType());
+
+            if(depthOnly)
+            {
+                recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,pipelineLayout,
+                    0,1,&descriptorSets[currentImage]);
+            }
+            else
+            {
+                //Tell the streamer how much detail this texture needs (once a frame, and only for meshes that get drawn)
+                if(meshDraw.textureUsed && !secondPass)
+                {
+                    textureStreamer.MarkUsed(thisModel->GetMesh(k)->GetTexId(),
+                        GetProjectedSize(thisModel->GetMeshTransform(k),thisModel->GetMesh(k),cameraPosition),frameNumber);
+                }
+
+                std::array<VkDescriptorSet,2> descriptorSetGroup  = {descriptorSets[currentImage],
+                    samplerDescriptorSets[thisModel->GetMesh(k)->GetTexId()]};
+
+                recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS,pipelineLayout,
+                    0,static_cast<uint32_t>(descriptorSetGroup.size()),descriptorSetGroup.data());
+            }
+
+            //Execute pipeline, with the least detail that still looks the same at this distance
+            //(both passes draw exactly the same triangles, so the depths match)
+            if(meshDraw.commandOffset >= 0)
+            {
+                RecordCulledDraw(currentImage,meshDraw,secondPass);
+            }
+            else
+            {
+                const MeshLod& lod = thisModel->GetMesh(k)->GetLod(meshDraw.lod);
+                recorder.DrawIndexed(lod.indexCount,1,lod.indexOffset,0,0);
+            }
+        }
+    }
+}
+
+void VulkanRenderer::RecordCulling(uint32_t currentImage, ArenaVector<MeshDraw>& meshDraws, const glm::vec3& cameraPosition)
+{
+    culledInstanceCount = 0;
+    if(!cullingPipeline)
+        return;
+
+    //Meshes drawn at full detail get a range of draw commands, one for each of their meshlets
+    ArenaVector<PushCulling> dispatches{ArenaAllocator<PushCulling>(frameArena)};
+    ArenaVector<VkDescriptorSet> dispatchSets{ArenaAllocator<VkDescriptorSet>(frameArena)};
+    dispatches.reserve(std::min<size_t>(meshDraws.size(),MAX_MESHLET_MESHES));
+    dispatchSets.reserve(dispatches.capacity());
+    uint32_t commandCount = 0;
+
+    //Every other mesh gets a single draw command after the meshlet ones, and is culled as a whole
+    CullingInstance* instances = nullptr;
+    uint32_t instanceCount = 0;
+    if(gpuCulling && meshCullingPipeline)
+    {
+        vkMapMemory(mainDevice.logicalDevice,cullingInstanceBufferMemory[currentImage],0,
+            MAX_CULLED_MESHES * sizeof(CullingInstance),0,reinterpret_cast<void**>(&instances));
+    }
+
+    //Which count says whether each mesh was drawn, read back the next time this image is recorded
+    std::vector<uint32_t>& countIndices = visibilityCountIndices[currentImage];
+    countIndices.resize(meshDraws.size());
+
+    size_t drawIndex = 0;
+    for (MeshModel& meshModel : modelList)
+    {
+        for (size_t k = 0; k < meshModel.GetMeshCount(); ++k)
+        {
+            countIndices[drawIndex] = NO_COUNT;
+            MeshDraw& meshDraw = meshDraws[drawIndex++];
+            const Mesh* mesh = meshModel.GetMesh(k);
+            if(!meshDraw.visible)
+                continue;
+
+            if(meshletCulling && meshDraw.lod == 0 && mesh->GetMeshletDescriptorSet() && dispatches.size() < MAX_MESHLET_MESHES &&
+               commandCount + mesh->GetMeshletCount() <= MAX_MESHLET_DRAWS)
+            {
+                PushCulling pushCulling{};
+                pushCulling.model = meshModel.GetMeshTransform(k);
+                pushCulling.meshletCount = mesh->GetMeshletCount();
+                pushCulling.commandOffset = commandCount;
+                pushCulling.countIndex = static_cast<uint32_t>(dispatches.size());
+                pushCulling.scale = GetMaxAxisScale(pushCulling.model);
+
+                meshDraw.commandOffset = commandCount;
+                meshDraw.countIndex = pushCulling.countIndex;
+                meshDraw.drawCount = mesh->GetMeshletCount();
+                commandCount += mesh->GetMeshletCount();
+                countIndices[drawIndex-1] = meshDraw.countIndex;
+
+                dispatches.push_back(pushCulling);
+                dispatchSets.push_back(mesh->GetMeshletDescriptorSet());
+            }
+            else if(instances && instanceCount < MAX_CULLED_MESHES)
+            {
+                CullingInstance& instance = instances[instanceCount];
+                instance.model = meshModel.GetMeshTransform(k);
+                instance.sphere = glm::vec4(mesh->GetBoundsCenter(),mesh->GetBoundsRadius());
+                instance.lodCount = static_cast<uint32_t>(std::min<size_t>(mesh->GetLodCount(),MAX_MESH_LODS));
+                for (uint32_t lodIndex = 0; lodIndex < instance.lodCount; ++lodIndex)
+                {
+                    const MeshLod& lod = mesh->GetLod(lodIndex);
+                    instance.lods[lodIndex] = {lod.indexOffset,lod.indexCount,lod.error,0};
+                }
+
+                meshDraw.culledAsWhole = true;
+                meshDraw.commandOffset = MAX_MESHLET_DRAWS + instanceCount;
+                meshDraw.countIndex = MAX_MESHLET_MESHES + instanceCount;
+                meshDraw.drawCount = 1;
+                countIndices[drawIndex-1] = meshDraw.countIndex;
+                instanceCount++;
+            }
+            else
+            {
+                //No room on the GPU, drawn as it is with a level picked here
+                meshDraw.lod = GetLodLevel(meshModel.GetMeshTransform(k),mesh,cameraPosition);
+            }
+        }
+    }
+    culledInstanceCount = instanceCount;
+
+    if(instances)
+        vkUnmapMemory(mainDevice.logicalDevice,cullingInstanceBufferMemory[currentImage]);
+
+    //Occlusion is tested against the pyramid built at the end of the last frame
+    uboCulling.depthPyramidSize = glm::vec4(static_cast<float>(depthPyramidWidth),static_cast<float>(depthPyramidHeight),
+        depthPyramidBuilt ? 1.0f : 0.0f,reverseDepth ? 1.0f : 0.0f);
+
+    if(dispatches.empty() && instanceCount == 0)
+        return;
+
+    VkCommandBuffer commandBuffer = commandBuffers[currentImage];
+    CommandRecorder recorder(commandBuffer,recordingStats);
+
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+    if(!dispatches.empty())
+    {
+        //Counts start at zero, and commands nobody writes draw nothing (for when the count isn't read by the GPU)
+        vkCmdFillBuffer(commandBuffer,drawCountBuffer[currentImage],0,dispatches.size() * sizeof(uint32_t),0);
+        vkCmdFillBuffer(commandBuffer,drawCommandBuffer[currentImage],0,commandCount * sizeof(VkDrawIndexedIndirectCommand),0);
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,0,
+            1,&memoryBarrier,0,nullptr,0,nullptr);
+
+        recorder.BindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE,cullingPipeline);
+        recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE,cullingPipelineLayout,0,1,&cullingDescriptorSets[currentImage]);
+
+        for (size_t i = 0; i < dispatches.size(); ++i)
+        {
+            recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE,cullingPipelineLayout,1,1,&dispatchSets[i]);
+            recorder.PushConstants(cullingPipelineLayout,VK_SHADER_STAGE_COMPUTE_BIT,0,sizeof(PushCulling),&dispatches[i]);
+
+            //64 meshlets per work group (local_size_x in the shader)
+            recorder.Dispatch((dispatches[i].meshletCount + 63) / 64,1,1);
+        }
+    }
+
+    if(instanceCount > 0)
+    {
+        //Every command and count of the instances is written by the shader, so nothing to clear
+        PushMeshCulling pushMeshCulling{};
+        pushMeshCulling.instanceCount = instanceCount;
+        pushMeshCulling.commandOffset = MAX_MESHLET_DRAWS;
+        pushMeshCulling.countOffset = MAX_MESHLET_MESHES;
+        pushMeshCulling.secondPass = 0;
+        pushMeshCulling.lodPixelScale = GetLodPixelScale();
+        pushMeshCulling.maxLodPixelError = MAX_LOD_PIXEL_ERROR;
+
+        recorder.BindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE,meshCullingPipeline);
+        recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE,meshCullingPipelineLayout,0,1,&cullingDescriptorSets[currentImage]);
+        recorder.PushConstants(meshCullingPipelineLayout,VK_SHADER_STAGE_COMPUTE_BIT,0,sizeof(PushMeshCulling),&pushMeshCulling);
+
+        //64 meshes per work group
+        recorder.Dispatch((instanceCount + 63) / 64,1,1);
+    }
+}
+
+void VulkanRenderer::RecordSecondCulling(uint32_t currentImage)
+{
+    if(culledInstanceCount == 0)
+        return;
+
+    //Same instances as the first pass, their commands and counts go after the first pass's
+    PushMeshCulling pushMeshCulling{};
+    pushMeshCulling.instanceCount = culledInstanceCount;
+    pushMeshCulling.commandOffset = MAX_MESHLET_DRAWS + MAX_CULLED_MESHES;
+    pushMeshCulling.countOffset = MAX_MESHLET_MESHES + MAX_CULLED_MESHES;
+    pushMeshCulling.firstPassCountOffset = MAX_MESHLET_MESHES;
+    pushMeshCulling.secondPass = 1;
+    pushMeshCulling.lodPixelScale = GetLodPixelScale();
+    pushMeshCulling.maxLodPixelError = MAX_LOD_PIXEL_ERROR;
+
+    CommandRecorder recorder(commandBuffers[currentImage],recordingStats);
+    recorder.BindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE,meshCullingPipeline);
+    recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE,meshCullingPipelineLayout,0,1,&cullingDescriptorSets[currentImage]);
+    recorder.PushConstants(meshCullingPipelineLayout,VK_SHADER_STAGE_COMPUTE_BIT,0,sizeof(PushMeshCulling),&pushMeshCulling);
+
+    //64 meshes per work group
+    recorder.Dispatch((culledInstanceCount + 63) / 64,1,1);
+}
+
+void VulkanRenderer::RecordVisibilityReadback(uint32_t currentImage, bool secondPass)
+{
+    VkCommandBuffer commandBuffer = commandBuffers[currentImage];
+
+    //Without a second pass this frame its counts are left from an older one, they count as nothing drawn
+    VkDeviceSize firstPassSize = (MAX_MESHLET_MESHES + MAX_CULLED_MESHES) * sizeof(uint32_t);
+    VkDeviceSize secondPassSize = MAX_CULLED_MESHES * sizeof(uint32_t);
+    VkBufferCopy copyRegion{};
+    copyRegion.size = secondPass ? firstPassSize + secondPassSize : firstPassSize;
+    vkCmdCopyBuffer(commandBuffer,drawCountBuffer[currentImage],visibilityBuffer[currentImage],1,&copyRegion);
+    if(!secondPass)
+        vkCmdFillBuffer(commandBuffer,visibilityBuffer[currentImage],firstPassSize,secondPassSize,0);
+
+    //Read on the CPU once the frame is done
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_HOST_BIT,0,1,&memoryBarrier,0,nullptr,0,nullptr);
+}
+
+void VulkanRenderer::ReadVisibility(uint32_t currentImage, ArenaVector<MeshDraw>& meshDraws)
+{
+    //Nothing recorded for this image yet, or the meshes have changed since: every mesh counts as used until there is
+    const std::vector<uint32_t>& countIndices = visibilityCountIndices[currentImage];
+    if(countIndices.size() != meshDraws.size())
+        return;
+
+    //This image's last frame is done, so its readback is there
+    void* data = nullptr;
+    vkMapMemory(mainDevice.logicalDevice,visibilityBufferMemory[currentImage],0,VK_WHOLE_SIZE,0,&data);
+    const uint32_t* counts = static_cast<const uint32_t*>(data);
+    for (size_t i = 0; i < meshDraws.size(); ++i)
+    {
+        uint32_t countIndex = countIndices[i];
+        if(countIndex == NO_COUNT)
+            continue;
+
+        //Visible meshlets, or the mesh drawn by either culling pass
+        bool drawn = counts[countIndex] != 0;
+        if(countIndex >= MAX_MESHLET_MESHES)
+            drawn = drawn || counts[countIndex + MAX_CULLED_MESHES] != 0;
+        meshDraws[i].textureUsed = drawn;
+    }
+    vkUnmapMemory(mainDevice.logicalDevice,visibilityBufferMemory[currentImage]);
+}
+
+float VulkanRenderer::GetLodPixelScale() const
+{
+    //Pixels per world unit at distance 1, GetLodLevel divides it by the distance
+    return std::abs(uboViewProjection.projection[1][1]) * 0.5f * static_cast<float>(swapChainExtent.height);
+}
+
+void VulkanRenderer::RecordCulledDraw(uint32_t currentImage, const MeshDraw& meshDraw, bool secondPass)
+{
+    CommandRecorder recorder(commandBuffers[currentImage],recordingStats);
+
+    //The second culling pass's commands and counts are after the first pass's
+    int64_t secondPassOffset = secondPass ? MAX_CULLED_MESHES : 0;
+    VkDeviceSize commandOffset = (meshDraw.commandOffset + secondPassOffset) * sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize countOffset = (meshDraw.countIndex + secondPassOffset) * sizeof(uint32_t);
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+    if(drawIndirectCountSupported)
+    {
+        //Only the visible draws, packed at the front by the culling shader
+        recorder.DrawIndexedIndirectCount(cmdDrawIndexedIndirectCount,drawCommandBuffer[currentImage],commandOffset,
+            drawCountBuffer[currentImage],countOffset,meshDraw.drawCount,stride);
+    }
+    else if(multiDrawIndirectSupported)
+    {
+        //Every slot, the ones after the visible draws are empty
+        recorder.DrawIndexedIndirect(drawCommandBuffer[currentImage],commandOffset,meshDraw.drawCount,stride);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < meshDraw.drawCount; ++i)
+            recorder.DrawIndexedIndirect(drawCommandBuffer[currentImage],commandOffset + i * stride,1,stride);
+    }
+}
+
+void VulkanRenderer::RecordDepthPyramid(uint32_t currentImage)
+{
+    //The frame graph has the depth buffer readable and last frame's culling done with the pyramid by now
+    VkCommandBuffer commandBuffer = commandBuffers[currentImage];
+    CommandRecorder recorder(commandBuffer,recordingStats);
+
+    recorder.BindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE,depthReducePipeline);
+
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    for (uint32_t level = 0; level < depthPyramidLevels; ++level)
+    {
+        recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE,depthReducePipelineLayout,0,1,&depthReduceDescriptorSets[level]);
+
+        //8x8 texels per work group (local_size in the shader)
+        uint32_t levelWidth = std::max(depthPyramidWidth >> level,1u);
+        uint32_t levelHeight = std::max(depthPyramidHeight >> level,1u);
+        recorder.Dispatch((levelWidth + 7) / 8,(levelHeight + 7) / 8,1);
+
+        //Each level is read by the next one (next frame's culling reading the last one is the frame graph's)
+        if(level + 1 < depthPyramidLevels)
+        {
+            vkCmdPipelineBarrier(commandBuffer,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,0,
+                1,&memoryBarrier,0,nullptr,0,nullptr);
+        }
+    }
+
+    depthPyramidBuilt = true;
+}
+
 bool VulkanRenderer::CheckInstanceExtensionSupport(const std::vector<const char*>& checkExtensions) const
 {
     //Need to get number of extension to create array of correct size to hold extensions
@@ -1157,6 +2603,54 @@ bool VulkanRenderer::CheckDeviceExtensionSupport(const VkPhysicalDevice& device)
     return true;
 }
 
+bool VulkanRenderer::IsDeviceExtensionSupported(const VkPhysicalDevice& device, const char* extensionName) const
+{
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device,nullptr,&extensionCount,nullptr);
+
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device,nullptr,&extensionCount,extensions.data());
+
+    for (const auto& extension : extensions)
+    {
+        if(strcmp(extensionName,extension.extensionName) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool VulkanRenderer::IsInstanceExtensionSupported(const char* extensionName) const
+{
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr,&extensionCount,nullptr);
+
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr,&extensionCount,extensions.data());
+
+    for (const auto& extension : extensions)
+    {
+        if(strcmp(extensionName,extension.extensionName) == 0)
+            return true;
+    }
+    return false;
+}
+
+void VulkanRenderer::GetPhysicalDeviceFeatures2(void* featureChain) const
+{
+    if(!physicalDeviceProperties2Supported)
+        return;
+
+    auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+        vkGetInstanceProcAddr(instance,"vkGetPhysicalDeviceFeatures2KHR"));
+    if(!getFeatures2)
+        return;
+
+    VkPhysicalDeviceFeatures2KHR features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = featureChain;
+    getFeatures2(mainDevice.physicalDevice,&features2);
+}
+
 bool VulkanRenderer::CheckDeviceSuitable(const VkPhysicalDevice& device) const
 {
     /*//Information about the device itself (ID, name, type, vendor, etc)
@@ -1179,24 +2673,147 @@ bool VulkanRenderer::CheckDeviceSuitable(const VkPhysicalDevice& device) const
     return indices.IsValid() && extensionsSupported && swapChainValid && deviceFeatures.samplerAnisotropy;
 }
 
-bool VulkanRenderer::CheckValidationLayerSupport() const
+uint64_t VulkanRenderer::RateDevice(const VkPhysicalDevice& device) const
 {
-    uint32_t layerCount;
-    vkEnumerateInstanceLayerProperties(&layerCount,nullptr);
+    VkPhysicalDeviceProperties deviceProperties{};
+    vkGetPhysicalDeviceProperties(device,&deviceProperties);
 
-    std::vector<VkLayerProperties> availableLayers(layerCount);
-    vkEnumerateInstanceLayerProperties(&layerCount,availableLayers.data());
+    //Type counts most: any discrete GPU beats an integrated one, and software renderers (lavapipe, SwiftShader) come last
+    uint64_t score = 0;
+    switch (deviceProperties.deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        score += 1000000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        score += 100000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        score += 10000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        break;
+    default:
+        score += 1000;
+        break;
+    }
 
-    for (const char* layerName : validationLayers)
+    //Then video memory, a MiB a point (capped so it can't make up for the type)
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    vkGetPhysicalDeviceMemoryProperties(device,&memoryProperties);
+    VkDeviceSize deviceLocalSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
     {
-        bool layerFound = false;
-        for (const auto& layerProperties : availableLayers)
-        {
-            if(strcmp(layerName,layerProperties.layerName))
-            {
-                layerFound = true;
-                break;
-            }
+        if(memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            deviceLocalSize += memoryProperties.memoryHeaps[i].size;
+    }
+    score += std::min<uint64_t>(deviceLocalSize / (1024 * 1024),65535);
+
+    //Then the optional features the renderer uses when they're there
+    VkPhysicalDeviceFeatures deviceFeatures{};
+    vkGetPhysicalDeviceFeatures(device,&deviceFeatures);
+    if(deviceFeatures.multiDrawIndirect)
+        score += 1000;
+    const char* optionalExtensions[] = {VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+        VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME};
+    for (const char* extension : optionalExtensions)
+    {
+        if(IsDeviceExtensionSupported(device,extension))
+            score += 1000;
+    }
+
+    //Drawing and presenting on the same queue family, so swapchain images don't have to be shared between two
+    QueueFamilyIndices indices = GetQueueFamilies(device);
+    if(indices.graphicsFamily == indices.presentationFamily)
+        score += 2000;
+
+    return score;
+}
+
+std::string VulkanRenderer::GetDeviceUuid(const VkPhysicalDevice& device) const
+{
+    if(!deviceIdPropertiesSupported)
+        return std::string();
+
+    auto getProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+        vkGetInstanceProcAddr(instance,"vkGetPhysicalDeviceProperties2KHR"));
+    if(!getProperties2)
+        return std::string();
+
+    VkPhysicalDeviceIDPropertiesKHR idProperties{};
+    idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+    VkPhysicalDeviceProperties2KHR properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties2.pNext = &idProperties;
+    getProperties2(device,&properties2);
+
+    //Lower case hex without dashes
+    std::string uuid;
+    const char* digits = "0123456789abcdef";
+    for (uint8_t byte : idProperties.deviceUUID)
+    {
+        uuid += digits[byte >> 4];
+        uuid += digits[byte & 0xf];
+    }
+    return uuid;
+}
+
+bool VulkanRenderer::MatchesDevice(const std::string& deviceName, const std::string& uuid, const std::string& requested)
+{
+    //Case doesn't matter
+    auto toLower = [](std::string text)
+    {
+        for (char& c : text)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return text;
+    };
+    std::string lowerRequested = toLower(requested);
+
+    //A UUID can be written with or without dashes
+    std::string requestedUuid = lowerRequested;
+    requestedUuid.erase(std::remove(requestedUuid.begin(),requestedUuid.end(),'-'),requestedUuid.end());
+    if(!uuid.empty() && requestedUuid == uuid)
+        return true;
+
+    //Otherwise any part of the name (e.g. "nvidia" or "radeon")
+    return toLower(deviceName).find(lowerRequested) != std::string::npos;
+}
+
+const char* VulkanRenderer::GetDeviceTypeName(VkPhysicalDeviceType deviceType)
+{
+    switch (deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        return "software";
+    default:
+        return "other";
+    }
+}
+
+bool VulkanRenderer::CheckValidationLayerSupport() const
+{
+    uint32_t layerCount;
+    vkEnumerateInstanceLayerProperties(&layerCount,nullptr);
+
+    std::vector<VkLayerProperties> availableLayers(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount,availableLayers.data());
+
+    for (const char* layerName : validationLayers)
+    {
+        bool layerFound = false;
+        for (const auto& layerProperties : availableLayers)
+        {
+            if(strcmp(layerName,layerProperties.layerName))
+            {
+                layerFound = true;
+                break;
+            }
         }
 
         if(!layerFound)
@@ -1208,6 +2825,19 @@ bool VulkanRenderer::CheckValidationLayerSupport() const
     
 }
 
+void VulkanRenderer::CheckVertexLayoutSupport()
+{
+    //Fall back to full floats for anything the device can't read from a vertex buffer
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice,GetPositionFormat(vertexLayout.position),&properties);
+    if(!(properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT))
+        vertexLayout.position = VertexPositionFormat::Float32;
+
+    vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice,GetUvFormat(vertexLayout.uv),&properties);
+    if(!(properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT))
+        vertexLayout.uv = VertexUvFormat::Float32;
+}
+
 void VulkanRenderer::PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo)
 {
     createInfo = {};
@@ -1217,7 +2847,7 @@ void VulkanRenderer::PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreat
     createInfo.pfnUserCallback = DebugCallback;
 }
 
-QueueFamilyIndices& VulkanRenderer::GetQueueFamilies(const VkPhysicalDevice& device) const
+QueueFamilyIndices VulkanRenderer::GetQueueFamilies(const VkPhysicalDevice& device) const
 {
     QueueFamilyIndices indices;
 
@@ -1334,7 +2964,7 @@ VkExtent2D VulkanRenderer::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& surf
 
     //Surface also defines max and min, so make sure within boundaries by clamping value.
     newExtent.width =std::max(surfaceCapabilities.minImageExtent.width,std::min(surfaceCapabilities.maxImageExtent.width, newExtent.width));
-    newExtent.width =std::max(surfaceCapabilities.minImageExtent.height,std::min(surfaceCapabilities.maxImageExtent.height, newExtent.height));
+    newExtent.height =std::max(surfaceCapabilities.minImageExtent.height,std::min(surfaceCapabilities.maxImageExtent.height, newExtent.height));
     return newExtent;
 }
 
@@ -1360,8 +2990,26 @@ VkFormat VulkanRenderer::ChooseSupportedFormat(const std::vector<VkFormat>& form
     throw std::runtime_error("Failed to find a matching format");
 }
 
+VkSampleCountFlagBits VulkanRenderer::ChooseMsaaSamples(VkSampleCountFlagBits requested) const
+{
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(mainDevice.physicalDevice,&deviceProperties);
+
+    //Colour and depth are both multisampled, so both have to support the count
+    VkSampleCountFlags supported = deviceProperties.limits.framebufferColorSampleCounts &
+        deviceProperties.limits.framebufferDepthSampleCounts;
+
+    for (VkSampleCountFlagBits samples : {VK_SAMPLE_COUNT_8_BIT,VK_SAMPLE_COUNT_4_BIT,VK_SAMPLE_COUNT_2_BIT})
+    {
+        if(samples <= requested && (supported & samples))
+            return samples;
+    }
+    return VK_SAMPLE_COUNT_1_BIT;
+}
+
 VkImage VulkanRenderer::CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
-                                    VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory)
+                                    VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory,
+                                    uint32_t mipLevels, VkSampleCountFlagBits samples)
 {
     VkImageCreateInfo imageCreateInfo{};
     imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1369,13 +3017,13 @@ VkImage VulkanRenderer::CreateImage(uint32_t width, uint32_t height, VkFormat fo
     imageCreateInfo.extent.width = width;
     imageCreateInfo.extent.height = height;
     imageCreateInfo.extent.depth = 1;
-    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.mipLevels = mipLevels;
     imageCreateInfo.arrayLayers = 1;
     imageCreateInfo.format = format;
     imageCreateInfo.tiling = tiling;
     imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageCreateInfo.usage = useFlags;
-    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.samples = samples;
     imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
     VkImage image;
@@ -1390,10 +3038,19 @@ VkImage VulkanRenderer::CreateImage(uint32_t width, uint32_t height, VkFormat fo
     memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     memoryAllocateInfo.allocationSize = memoryRequirements.size;
     memoryAllocateInfo.memoryTypeIndex = FindMemoryTypeIndex(mainDevice.physicalDevice,memoryRequirements.memoryTypeBits,propFlags);
+    //Lazily allocated memory is mostly found on tile based GPUs, elsewhere transient attachments get ordinary memory
+    if(memoryAllocateInfo.memoryTypeIndex == std::numeric_limits<uint32_t>::max() && (propFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+    {
+        memoryAllocateInfo.memoryTypeIndex = FindMemoryTypeIndex(mainDevice.physicalDevice,memoryRequirements.memoryTypeBits,
+            propFlags & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+    }
 
-    result = vkAllocateMemory(mainDevice.logicalDevice,&memoryAllocateInfo,nullptr,imageMemory);
+    result = MemoryBudget::Allocate(mainDevice.physicalDevice,mainDevice.logicalDevice,memoryAllocateInfo,imageMemory);
     if(result != VK_SUCCESS)
+    {
+        vkDestroyImage(mainDevice.logicalDevice,image,nullptr);
         throw std::runtime_error("Failed to allocate memory for image");
+    }
 
     //Connect memory to image
     vkBindImageMemory(mainDevice.logicalDevice,image,*imageMemory,0);
@@ -1401,7 +3058,8 @@ VkImage VulkanRenderer::CreateImage(uint32_t width, uint32_t height, VkFormat fo
     return image;
 }
 
-VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) const
+VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels,
+    uint32_t baseMipLevel) const
 {
     VkImageViewCreateInfo viewCreateInfo{};
     viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1415,8 +3073,8 @@ VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format, VkIm
 
     //Sub-resources allow the view to view only a part of an image
     viewCreateInfo.subresourceRange.aspectMask = aspectFlags;
-    viewCreateInfo.subresourceRange.baseMipLevel = 0; //Start mipmap level to view from
-    viewCreateInfo.subresourceRange.levelCount = 1; // Number of mipmap levels to view
+    viewCreateInfo.subresourceRange.baseMipLevel = baseMipLevel; //Start mipmap level to view from
+    viewCreateInfo.subresourceRange.levelCount = mipLevels; // Number of mipmap levels to view
     viewCreateInfo.subresourceRange.baseArrayLayer = 0; // Start array level to view from
     viewCreateInfo.subresourceRange.layerCount = 1; // Number of array levels to view
  
@@ -1444,89 +3102,503 @@ VkShaderModule VulkanRenderer::CreateShaderModule(const std::vector<char>& code)
     return shaderModule;
 }
 
+VkPipeline VulkanRenderer::CreateComputePipeline(const std::string& shaderFile, VkPipelineLayout layout,
+    const VkSpecializationInfo* specializationInfo)
+{
+    std::vector<char> shaderCode;
+    try
+    {
+        shaderCode = ReadFile(shaderFile);
+    }
+    catch (const std::runtime_error&)
+    {
+        return nullptr;
+    }
+
+    VkShaderModule shaderModule = CreateShaderModule(shaderCode);
+
+    VkComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.module = shaderModule;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.stage.pSpecializationInfo = specializationInfo;
+    pipelineCreateInfo.layout = layout;
+
+    VkPipeline pipeline;
+    VkResult result = vkCreateComputePipelines(mainDevice.logicalDevice,VK_NULL_HANDLE,1,&pipelineCreateInfo,nullptr,&pipeline);
+
+    vkDestroyShaderModule(mainDevice.logicalDevice,shaderModule,nullptr);
+
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a compute Pipeline!");
+
+    return pipeline;
+}
 
-stbi_uc* VulkanRenderer::LoadTextureFile(const std::string& fileName, int* width, int* height, VkDeviceSize* imageSize) const
+
+//Wait for every job, even after one has failed, so none is left running with references to the caller's locals
+template<typename T>
+static std::vector<T> WaitForJobs(ThreadPool& jobPool, std::vector<std::future<T>>& jobs, std::string& error)
 {
-    //Number of channels image uses
-    int channels;
+    std::vector<T> results(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        try
+        {
+            jobPool.Wait(jobs[i]);
+            results[i] = jobs[i].get();
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+        }
+    }
+    return results;
+}
 
-    //Load pixel data for image
-    std::string fileLoc = "Textures/"+fileName;
-    stbi_uc* image = stbi_load(fileLoc.c_str(),width,height,&channels,STBI_rgb_alpha);
+int VulkanRenderer::CreateTexture(const std::string& fileName)
+{
+    return CreateTextures({fileName})[0];
+}
 
-    if(!image)
+VulkanRenderer::TextureFile VulkanRenderer::ReadTextureFile(const std::string& fileName)
+{
+    TextureFile file{};
+    try
+    {
+        file.content = ReadFile(TextureCache::ResolvePath("Textures/"+fileName));
+    }
+    catch (const std::runtime_error&)
+    {
         throw std::runtime_error("Failed to load a texture file "+fileName);
+    }
+    file.contentHash = TextureCache::HashContent(file.content);
+    return file;
+}
 
-    *imageSize = *width* *height *4; //4 is all the channels
+std::vector<int> VulkanRenderer::CreateTextures(const std::vector<std::string>& fileNames, std::vector<TextureFile>* readFiles)
+{
+    std::vector<int> textureIds(fileNames.size(),-1);
+    if(fileNames.empty())
+        return textureIds;
+
+    //1. Anything already loaded from the same path only needs another reference
+    std::vector<std::string> resolvedPaths(fileNames.size());
+    std::unordered_map<std::string,size_t> firstWithPath;
+    std::vector<size_t> filesToRead;
+    for (size_t i = 0; i < fileNames.size(); ++i)
+    {
+        resolvedPaths[i] = TextureCache::ResolvePath("Textures/"+fileNames[i]);
 
-    return image;
+        int existing = textureCache.FindByPath(resolvedPaths[i]);
+        if(existing >= 0)
+        {
+            textureCache.AddRef(existing);
+            textureIds[i] = existing;
+        }
+        else if(firstWithPath.emplace(resolvedPaths[i],i).second)
+        {
+            filesToRead.push_back(i);
+        }
+    }
+
+    //2. Read and hash the new files on the worker threads, unless a model load already did
+    std::vector<TextureFile> textureFiles;
+    if(readFiles)
+    {
+        textureFiles.reserve(filesToRead.size());
+        for (size_t fileIndex : filesToRead)
+            textureFiles.push_back(std::move((*readFiles)[fileIndex]));
+    }
+    else
+    {
+        std::vector<std::future<TextureFile>> readJobs;
+        readJobs.reserve(filesToRead.size());
+        for (size_t fileIndex : filesToRead)
+        {
+            readJobs.push_back(threadPool.Submit([&fileNames,fileIndex]()
+            {
+                return ReadTextureFile(fileNames[fileIndex]);
+            }));
+        }
+
+        std::string loadError;
+        textureFiles = WaitForJobs(threadPool,readJobs,loadError);
+        if(!loadError.empty())
+        {
+            //Give back the references taken above, nothing has been created yet
+            for (int textureId : textureIds)
+            {
+                if(textureId >= 0)
+                    ReleaseTexture(textureId);
+            }
+            throw std::runtime_error(loadError);
+        }
+    }
+
+    //3. Files whose contents match a loaded texture (or an earlier file of this batch) share it instead of being decoded
+    std::vector<size_t> filesToDecode;
+    std::vector<std::pair<size_t,size_t>> sameContent; //(file, file it duplicates) inside this batch
+    for (size_t i = 0; i < filesToRead.size(); ++i)
+    {
+        size_t fileIndex = filesToRead[i];
+        const TextureFile& file = textureFiles[i];
+
+        int existing = textureCache.FindByContent(file.contentHash,file.content);
+        if(existing >= 0)
+        {
+            textureCache.AddPath(resolvedPaths[fileIndex],existing);
+            textureCache.AddRef(existing);
+            textureIds[fileIndex] = existing;
+            continue;
+        }
+
+        bool duplicated = false;
+        for (size_t decodeIndex : filesToDecode)
+        {
+            const TextureFile& other = textureFiles[decodeIndex];
+            if(other.contentHash == file.contentHash && other.content == file.content)
+            {
+                sameContent.emplace_back(fileIndex,filesToRead[decodeIndex]);
+                duplicated = true;
+                break;
+            }
+        }
+
+        if(!duplicated)
+            filesToDecode.push_back(i);
+    }
+
+    //4. Every new texture shows the placeholder until the streamer has decoded it and put mips on the GPU
+    for (size_t decodeIndex : filesToDecode)
+    {
+        size_t fileIndex = filesToRead[decodeIndex];
+        TextureFile& file = textureFiles[decodeIndex];
+
+        int textureId = AllocateTextureSlot();
+        samplerDescriptorSets[textureId] = CreateTextureDescriptor(textureImageViews[placeholderTextureId]);
+
+        //The cache and the streamer share the one copy of the file
+        auto content = std::make_shared<const std::vector<char>>(std::move(file.content));
+        textureCache.Add(resolvedPaths[fileIndex],file.contentHash,content,textureId);
+        textureStreamer.Request(textureId,fileNames[fileIndex],std::move(content));
+        textureIds[fileIndex] = textureId;
+    }
+
+    //5. Point the duplicates of this batch at the textures just created
+    for (const std::pair<size_t,size_t>& duplicate : sameContent)
+    {
+        int textureId = textureIds[duplicate.second];
+        textureCache.AddPath(resolvedPaths[duplicate.first],textureId);
+        textureCache.AddRef(textureId);
+        textureIds[duplicate.first] = textureId;
+    }
+
+    for (size_t i = 0; i < fileNames.size(); ++i)
+    {
+        if(textureIds[i] < 0)
+        {
+            int textureId = textureIds[firstWithPath[resolvedPaths[i]]];
+            textureCache.AddRef(textureId);
+            textureIds[i] = textureId;
+        }
+    }
+
+    return textureIds;
 }
 
-int VulkanRenderer::CreateTextureImage(const std::string& fileName)
+int VulkanRenderer::AllocateTextureSlot()
 {
-    //Load image file
-    int width, height;
-    VkDeviceSize imageSize;
-    stbi_uc* imageData = LoadTextureFile(fileName,&width,&height,&imageSize);
+    //Reuse the slot of a destroyed texture so ids stay small and the lists don't keep growing
+    if(!freeTextureSlots.empty())
+    {
+        int slot = freeTextureSlots.back();
+        freeTextureSlots.pop_back();
+        return slot;
+    }
+
+    textureImages.push_back(VK_NULL_HANDLE);
+    textureImageMemory.push_back(VK_NULL_HANDLE);
+    textureImageViews.push_back(VK_NULL_HANDLE);
+    samplerDescriptorSets.push_back(VK_NULL_HANDLE);
+
+    return static_cast<int>(textureImages.size()-1);
+}
+
+void VulkanRenderer::ReleaseTexture(int textureId)
+{
+    if(!textureCache.Release(textureId))
+        return;
+
+    //Last model using this texture is gone
+    textureStreamer.Remove(textureId);
+
+    vkFreeDescriptorSets(mainDevice.logicalDevice,samplerDescriptorPool,1,&samplerDescriptorSets[textureId]);
+    vkDestroyImageView(mainDevice.logicalDevice,textureImageViews[textureId],nullptr);
+    vkDestroyImage(mainDevice.logicalDevice, textureImages[textureId],nullptr);
+    MemoryBudget::Free(mainDevice.logicalDevice,textureImageMemory[textureId]);
+
+    samplerDescriptorSets[textureId] = VK_NULL_HANDLE;
+    textureImageViews[textureId] = VK_NULL_HANDLE;
+    textureImages[textureId] = VK_NULL_HANDLE;
+    textureImageMemory[textureId] = VK_NULL_HANDLE;
+
+    freeTextureSlots.push_back(textureId);
+}
+
+void VulkanRenderer::CreatePlaceholderTexture()
+{
+    //1x1 white texture, shown while streamed textures have no mips on the GPU and used by untextured materials
+    const uint8_t whitePixel[4] = {255,255,255,255};
+    VkDeviceSize imageSize = sizeof(whitePixel);
 
-    //Create staging buffer to hold loaded data, ready to copy to device
     VkBuffer imageStagingBuffer;
     VkDeviceMemory imageStagingBufferMemory;
     CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,imageSize,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
         &imageStagingBuffer,&imageStagingBufferMemory);
 
-    //Copy image data to staging buffer
     void* data;
     vkMapMemory(mainDevice.logicalDevice,imageStagingBufferMemory,0,imageSize,0,&data);
-    memcpy(data,imageData,static_cast<size_t>(imageSize));
+    memcpy(data,whitePixel,static_cast<size_t>(imageSize));
     vkUnmapMemory(mainDevice.logicalDevice,imageStagingBufferMemory);
 
-    //Free original image data
-    stbi_image_free(imageData);
-
-    //Create image to hold final texture
-    VkImage texImage;
     VkDeviceMemory texImageMemory;
-
-    texImage = CreateImage(width,height,VK_FORMAT_R8G8B8A8_UNORM,VK_IMAGE_TILING_OPTIMAL,
+    VkImage texImage = CreateImage(1,1,VK_FORMAT_R8G8B8A8_UNORM,VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_TRANSFER_DST_BIT |VK_IMAGE_USAGE_SAMPLED_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory);
-    
-    //Copy data to image
 
     TransitionImageLayout(mainDevice.logicalDevice,graphicsQueue,graphicsCommandPool,texImage,
         VK_IMAGE_LAYOUT_UNDEFINED,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    
-    CopyImageBuffer(mainDevice.logicalDevice,graphicsQueue,graphicsCommandPool,imageStagingBuffer,texImage,width,height);
-
+    CopyImageBuffer(mainDevice.logicalDevice,graphicsQueue,graphicsCommandPool,imageStagingBuffer,texImage,1,1);
     TransitionImageLayout(mainDevice.logicalDevice,graphicsQueue,graphicsCommandPool,texImage,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-    //Add texture data to vector for reference
-    textureImages.push_back(texImage);
-    textureImageMemory.push_back(texImageMemory);
-
-    //Destroy staging buffers
     vkDestroyBuffer(mainDevice.logicalDevice,imageStagingBuffer,nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory,nullptr);
+    MemoryBudget::Free(mainDevice.logicalDevice,imageStagingBufferMemory);
 
-    return textureImages.size()-1;
+    placeholderTextureId = AllocateTextureSlot();
+    textureImages[placeholderTextureId] = texImage;
+    textureImageMemory[placeholderTextureId] = texImageMemory;
+    textureImageViews[placeholderTextureId] = CreateImageView(texImage,VK_FORMAT_R8G8B8A8_UNORM,VK_IMAGE_ASPECT_COLOR_BIT);
+    samplerDescriptorSets[placeholderTextureId] = CreateTextureDescriptor(textureImageViews[placeholderTextureId]);
 }
 
-int VulkanRenderer::CreateTexture(const std::string& fileName)
+void VulkanRenderer::UpdateTextureStreaming()
+{
+    DestroyRetiredTextures(graphicsTimeline.GetCompletedValue());
+
+    textureStreamer.CollectDecoded();
+
+    //Over the device memory budget (or after a failed allocation) textures give back what they are over
+    //(top mips, least recently used first). The lowered budget stays until usage is a margin below the device budget
+    //and then only goes up a step per frame, so the same mips aren't dropped and streamed in again every other frame
+    uint64_t overBudget = memoryBudget.GetOverBudgetBytes() + reclaimRequestBytes.exchange(0);
+    if(overBudget > 0)
+    {
+        uint64_t residentBytes = textureStreamer.GetResidentBytes();
+        textureStreamingBudget = std::min(textureStreamingBudget,residentBytes - std::min(residentBytes,overBudget));
+    }
+    else
+    {
+        uint64_t headroom = memoryBudget.GetHeadroomBytes();
+        if(headroom > TEXTURE_BUDGET_MARGIN)
+            textureStreamingBudget += std::min(TEXTURE_BUDGET_STEP,headroom - TEXTURE_BUDGET_MARGIN);
+    }
+    textureStreamingBudget = std::min(textureStreamingBudget,textureMemoryBudget);
+    uint64_t textureBudget = textureStreamingBudget;
+
+    //Only a few textures change per frame so streaming never causes a big hitch
+    textureStreamer.PlanResidency(frameNumber,textureBudget,MAX_TEXTURE_UPDATES_PER_FRAME,residencyChanges);
+    for (const TextureStreamer::ResidencyChange& change : residencyChanges)
+    {
+        ChangeTextureResidency(change.textureId,change.newResidentMip);
+    }
+}
+
+void VulkanRenderer::ChangeTextureResidency(int textureId, uint32_t newResidentMip)
+{
+    //New buffers and images this frame, and the upload lists may have to grow
+    steadyFrames = 0;
+
+    //Frames in flight may still sample the current image, and this frame copies from it and the staging buffer,
+    //so both are destroyed once this frame's submission is done
+    RetiredTexture retired{};
+    retired.image = textureImages[textureId];
+    retired.imageMemory = textureImageMemory[textureId];
+    retired.imageView = textureImageViews[textureId];
+    retired.descriptorSet = samplerDescriptorSets[textureId];
+    retired.timelineValue = graphicsTimeline.GetSubmittedValue() + 1;
+
+    textureImages[textureId] = VK_NULL_HANDLE;
+    textureImageMemory[textureId] = VK_NULL_HANDLE;
+    textureImageViews[textureId] = VK_NULL_HANDLE;
+
+    uint32_t mipCount = textureStreamer.GetMipCount(textureId);
+    uint32_t oldResidentMip = textureStreamer.GetResidentMip(textureId);
+    if(newResidentMip >= mipCount)
+    {
+        //Nothing left on the GPU, back to the placeholder
+        samplerDescriptorSets[textureId] = CreateTextureDescriptor(textureImageViews[placeholderTextureId]);
+    }
+    else
+    {
+        //Mips the old image already has are copied over on the GPU, only new top levels come from the streamer
+        //(they are one block there, so they go up in one go)
+        const TextureStreamer::MipLevel& baseMip = textureStreamer.GetMip(textureId,newResidentMip);
+        uint32_t mipLevels = mipCount - newResidentMip;
+        uint32_t firstCopiedMip = std::max(newResidentMip,oldResidentMip);
+
+        //Copies are recorded into this frame's command buffer by RecordTextureUploads
+        PendingTextureUpload upload{};
+        upload.mipLevels = mipLevels;
+        upload.uploadLevels = firstCopiedMip - newResidentMip;
+        if(upload.uploadLevels > 0)
+        {
+            const TextureStreamer::MipLevel& lastUploadMip = textureStreamer.GetMip(textureId,firstCopiedMip-1);
+            VkDeviceSize stagingSize = lastUploadMip.offset + lastUploadMip.size - baseMip.offset;
+
+            CreateBuffer(mainDevice.physicalDevice,mainDevice.logicalDevice,stagingSize,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &retired.stagingBuffer,&retired.stagingBufferMemory);
+
+            void* data;
+            vkMapMemory(mainDevice.logicalDevice,retired.stagingBufferMemory,0,stagingSize,0,&data);
+            memcpy(data,textureStreamer.GetPixels(textureId) + baseMip.offset,static_cast<size_t>(stagingSize));
+            vkUnmapMemory(mainDevice.logicalDevice,retired.stagingBufferMemory);
+            upload.stagingBuffer = retired.stagingBuffer;
+        }
+        if(firstCopiedMip < mipCount)
+        {
+            upload.sourceImage = retired.image;
+            upload.sourceMip = firstCopiedMip - oldResidentMip;
+            upload.sourceMipLevels = mipCount - oldResidentMip;
+        }
+
+        //Transfer source too, for when it shrinks again
+        VkDeviceMemory texImageMemory;
+        VkImage texImage = CreateImage(baseMip.width,baseMip.height,VK_FORMAT_R8G8B8A8_UNORM,VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory, mipLevels);
+
+        upload.image = texImage;
+        for (uint32_t i = 0; i < mipLevels; ++i)
+        {
+            const TextureStreamer::MipLevel& mip = textureStreamer.GetMip(textureId,newResidentMip + i);
+            if(i < upload.uploadLevels)
+                upload.mipOffsets.push_back(mip.offset - baseMip.offset);
+            upload.mipExtents.push_back({mip.width,mip.height});
+        }
+        pendingTextureUploads.push_back(upload);
+
+        textureImages[textureId] = texImage;
+        textureImageMemory[textureId] = texImageMemory;
+        textureImageViews[textureId] = CreateImageView(texImage,VK_FORMAT_R8G8B8A8_UNORM,VK_IMAGE_ASPECT_COLOR_BIT,mipLevels);
+        samplerDescriptorSets[textureId] = CreateTextureDescriptor(textureImageViews[textureId]);
+    }
+
+    retiredTextures.push_back(retired);
+    textureStreamer.SetResident(textureId,newResidentMip);
+}
+
+void VulkanRenderer::RecordTextureUploads(VkCommandBuffer commandBuffer)
+{
+    for (const PendingTextureUpload& upload : pendingTextureUploads)
+    {
+        RecordImageLayoutTransition(commandBuffer,upload.image,
+            VK_IMAGE_LAYOUT_UNDEFINED,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,upload.mipLevels);
+
+        for (uint32_t i = 0; i < upload.uploadLevels; ++i)
+        {
+            RecordCopyImageBuffer(commandBuffer,upload.stagingBuffer,upload.mipOffsets[i],upload.image,
+                upload.mipExtents[i].width,upload.mipExtents[i].height,i);
+        }
+
+        if(upload.sourceImage != VK_NULL_HANDLE)
+        {
+            //The old image is retired, so it never has to go back to being sampled
+            RecordImageLayoutTransition(commandBuffer,upload.sourceImage,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,upload.sourceMipLevels);
+
+            for (uint32_t i = upload.uploadLevels; i < upload.mipLevels; ++i)
+            {
+                RecordCopyImageMip(commandBuffer,upload.sourceImage,upload.sourceMip + i - upload.uploadLevels,upload.image,i,
+                    upload.mipExtents[i].width,upload.mipExtents[i].height);
+            }
+        }
+
+        RecordImageLayoutTransition(commandBuffer,upload.image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,upload.mipLevels);
+    }
+    pendingTextureUploads.clear();
+}
+
+void VulkanRenderer::DestroyRetiredTextures(uint64_t completedValue)
 {
-    int textureImageLoc = CreateTextureImage(fileName);
+    for (size_t i = 0; i < retiredTextures.size();)
+    {
+        const RetiredTexture& retired = retiredTextures[i];
+        if(retired.timelineValue > completedValue)
+        {
+            ++i;
+            continue;
+        }
 
-    VkImageView imageView = CreateImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-    textureImageViews.push_back(imageView);
+        if(retired.descriptorSet != VK_NULL_HANDLE)
+            vkFreeDescriptorSets(mainDevice.logicalDevice,samplerDescriptorPool,1,&retired.descriptorSet);
+        vkDestroyImageView(mainDevice.logicalDevice,retired.imageView,nullptr);
+        vkDestroyImage(mainDevice.logicalDevice,retired.image,nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,retired.imageMemory);
+        vkDestroyBuffer(mainDevice.logicalDevice,retired.stagingBuffer,nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,retired.stagingBufferMemory);
 
-    int descriptorLoc = CreateTextureDescriptor(imageView);
+        retiredTextures[i] = retiredTextures.back();
+        retiredTextures.pop_back();
+    }
+}
 
-    return descriptorLoc;
+float VulkanRenderer::GetProjectedSize(const glm::mat4& model, const Mesh* mesh, const glm::vec3& cameraPosition) const
+{
+    glm::vec3 worldCenter = glm::vec3(model * glm::vec4(mesh->GetBoundsCenter(),1.0f));
+    float scale = GetMaxAxisScale(model);
+    float radius = mesh->GetBoundsRadius() * scale;
+
+    //Camera inside the bounds, it can cover the whole screen
+    float distance = glm::length(worldCenter - cameraPosition);
+    if(distance <= radius)
+        return static_cast<float>(swapChainExtent.height);
+
+    //Diameter in pixels: 2r/d scaled by the projection's 1/tan(fov/2) and half the screen height
+    return radius / distance * std::abs(uboViewProjection.projection[1][1]) * static_cast<float>(swapChainExtent.height);
+}
+
+size_t VulkanRenderer::GetLodLevel(const glm::mat4& model, const Mesh* mesh, const glm::vec3& cameraPosition) const
+{
+    glm::vec3 worldCenter = glm::vec3(model * glm::vec4(mesh->GetBoundsCenter(),1.0f));
+    float scale = GetMaxAxisScale(model);
+
+    //Measure from the nearest point of the bounds, camera inside them needs full detail
+    float distance = glm::length(worldCenter - cameraPosition) - mesh->GetBoundsRadius() * scale;
+    if(distance <= 0.0f)
+        return 0;
+
+    //World units to pixels at that distance
+    float pixelsPerUnit = GetLodPixelScale() / distance;
+
+    //Coarsest level whose error stays under the limit on screen (levels only get worse)
+    size_t level = 0;
+    for (size_t i = 1; i < mesh->GetLodCount(); ++i)
+    {
+        if(mesh->GetLod(i).error * scale * pixelsPerUnit > MAX_LOD_PIXEL_ERROR)
+            break;
+        level = i;
+    }
+    return level;
 }
 
-int VulkanRenderer::CreateTextureDescriptor(VkImageView textureImage)
+VkDescriptorSet VulkanRenderer::CreateTextureDescriptor(VkImageView textureImage)
 {
     VkDescriptorSet descriptorSet{};
 
@@ -1559,59 +3631,577 @@ int VulkanRenderer::CreateTextureDescriptor(VkImageView textureImage)
     descriptorWrite.pImageInfo = &imageInfo;
 
     //Update new descriptor set
-    vkUpdateDescriptorSets(mainDevice.logicalDevice,1,&descriptorWrite,0,nullptr);
+    UpdateDescriptorSets(mainDevice.logicalDevice,1,&descriptorWrite);
 
-    samplerDescriptorSets.push_back(descriptorSet);
-
-    return samplerDescriptorSets.size()-1;
+    return descriptorSet;
 }
 
 void VulkanRenderer::CreateMeshModel(std::string modelFile)
 {
+    ModelData data = LoadModelData(modelFile,threadPool);
+
+    //Every buffer of the model goes up in one transfer
+    StagingBatch stagingBatch(mainDevice.physicalDevice,mainDevice.logicalDevice);
+    MeshModel meshModel = CreateModelFromData(data,stagingBatch);
+    stagingBatch.Submit(graphicsQueue,graphicsCommandPool,&graphicsTimeline);
+
+    modelList.push_back(std::move(meshModel));
+    modelLoadStatuses.push_back(ModelLoadStatus::Ready);
+    transformStore.Add();
+
+    //The frame's lists grow to fit the new meshes over the next few frames
+    steadyFrames = 0;
+}
+
+VulkanRenderer::ModelData VulkanRenderer::LoadModelData(const std::string& modelFile, ThreadPool& jobPool, float priority)
+{
+    ModelData data{};
+
+    //Use the processed meshes from a previous run if the model hasn't changed, Assimp is slow on big files
+    data.meshCache = std::make_unique<MeshCache>();
+    if(data.meshCache->Open(modelFile))
+    {
+        data.textureNames = data.meshCache->GetTextureNames();
+        data.sceneGraph = data.meshCache->GetSceneGraph();
+        return data;
+    }
+    data.meshCache.reset();
+
+    //Lists that are only needed while loading come out of one arena, all freed together at the end
+    LinearArena loadArena(LOAD_ARENA_SIZE);
+
     //Import model scene
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(modelFile,aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
     if(!scene)
         throw std::runtime_error("Failed to load model "+modelFile);
 
-    std::vector<std::string> textureNames = MeshModel::LoadMaterials(scene);
+    data.textureNames = MeshModel::LoadMaterials(scene);
+    //Nodes usually hold a mesh each, more if they share them
+    ArenaVector<aiMesh*> sceneMeshes{ArenaAllocator<aiMesh*>(loadArena)};
+    ArenaVector<uint32_t> sceneMeshNodes{ArenaAllocator<uint32_t>(loadArena)};
+    sceneMeshes.reserve(scene->mNumMeshes);
+    sceneMeshNodes.reserve(scene->mNumMeshes);
+    MeshModel::LoadNode(scene->mRootNode,scene,SceneGraph::NO_NODE,data.sceneGraph,sceneMeshes,sceneMeshNodes);
+
+    //Convert each mesh and reorder it for the GPU caches on the worker threads
+    //(before the result is cached, so it only happens on the first load)
+    struct ConvertedMesh
+    {
+        MeshData mesh;
+        MeshOptimizer::VertexCacheStats before;
+        MeshOptimizer::VertexCacheStats after;
+        size_t vertexCountBefore;
+    };
+
+    std::vector<std::future<ConvertedMesh>> convertJobs;
+    convertJobs.reserve(sceneMeshes.size());
+    for (size_t i = 0; i < sceneMeshes.size(); ++i)
+    {
+        convertJobs.push_back(jobPool.Submit([sceneMesh = sceneMeshes[i],node = sceneMeshNodes[i]]()
+        {
+            ConvertedMesh converted{};
+            converted.mesh = MeshModel::LoadMesh(sceneMesh);
+            converted.mesh.node = node;
+            converted.vertexCountBefore = converted.mesh.vertices.size();
+            if(LOG_MESH_OPTIMIZATION)
+                converted.before = MeshOptimizer::AnalyzeVertexCache(converted.mesh.indices,converted.mesh.vertices.size());
+
+            MeshOptimizer::Optimize(converted.mesh);
+
+            if(LOG_MESH_OPTIMIZATION)
+                converted.after = MeshOptimizer::AnalyzeVertexCache(converted.mesh.indices,converted.mesh.vertices.size());
+            return converted;
+        },priority));
+    }
+
+    std::string convertError;
+    std::vector<ConvertedMesh> convertedMeshes = WaitForJobs(jobPool,convertJobs,convertError);
+    if(!convertError.empty())
+        throw std::runtime_error(convertError);
+
+    MeshOptimizer::VertexCacheStats before{};
+    MeshOptimizer::VertexCacheStats after{};
+    size_t triangleCount = 0;
+    size_t vertexCountBefore = 0;
+    size_t vertexCountAfter = 0;
+    data.meshData.reserve(convertedMeshes.size());
+    for (ConvertedMesh& converted : convertedMeshes)
+    {
+        //Weighted by size so the totals are for the whole model
+        size_t meshTriangles = converted.mesh.indices.size() / 3;
+        before.acmr += converted.before.acmr * meshTriangles;
+        before.atvr += converted.before.atvr * converted.vertexCountBefore;
+        vertexCountBefore += converted.vertexCountBefore;
+        after.acmr += converted.after.acmr * meshTriangles;
+        after.atvr += converted.after.atvr * converted.mesh.vertices.size();
+        vertexCountAfter += converted.mesh.vertices.size();
+        triangleCount += meshTriangles;
+
+        data.meshData.push_back(std::move(converted.mesh));
+    }
+    if(LOG_MESH_OPTIMIZATION && triangleCount > 0)
+    {
+        //One write, models loading on other threads may be printing too
+        std::string line = "Optimized " + modelFile + ": ACMR " + std::to_string(before.acmr / triangleCount) + " -> " +
+            std::to_string(after.acmr / triangleCount) + ", ATVR " + std::to_string(before.atvr / vertexCountBefore) + " -> " +
+            std::to_string(after.atvr / vertexCountAfter) + "\n";
+        std::cout << line << std::flush;
+    }
+
+    //Big meshes in pieces that 16 bit indices can draw (before LODs and meshlets, which each piece gets its own of)
+    MeshOptimizer::SplitForShortIndices(data.meshData);
+
+    //Lower detail versions for when the meshes are small on screen
+    //and clusters of the full detail level for GPU culling, also one mesh per job
+    std::vector<std::future<MeshData>> lodJobs;
+    lodJobs.reserve(data.meshData.size());
+    for (MeshData& mesh : data.meshData)
+    {
+        lodJobs.push_back(jobPool.Submit([mesh = std::move(mesh)]() mutable
+        {
+            MeshSimplifier::GenerateLods(mesh);
+            mesh.meshlets = MeshletBuilder::Build(mesh.vertices,mesh.indices.data(),mesh.lods[0].indexCount);
+            return std::move(mesh);
+        },priority));
+    }
+
+    std::string lodError;
+    data.meshData = WaitForJobs(jobPool,lodJobs,lodError);
+    if(!lodError.empty())
+        throw std::runtime_error(lodError);
 
-    //Conversion from the amterials list Ids to our descriptor array ids
-    std::vector<int> matToTex(textureNames.size(),0);
+    //Not being able to write the cache only means the next load is slow again
+    if(!MeshCache::Write(modelFile,data.textureNames,data.sceneGraph,data.meshData))
+        std::cerr << "Failed to write mesh cache for " << modelFile << std::endl;
+
+    return data;
+}
 
-    //Loop over textureNames and create textures for them
+MeshModel VulkanRenderer::CreateModelFromData(ModelData& data, StagingBatch& stagingBatch)
+{
+    //Lists that are only needed while creating it come out of one arena, all freed together at the end
+    LinearArena loadArena(LOAD_ARENA_SIZE);
+    const std::vector<std::string>& textureNames = data.textureNames;
+
+    //Conversion from the materials list Ids to our descriptor array ids (untextured materials use the placeholder)
+    ArenaVector<int> matToTex(textureNames.size(),placeholderTextureId,ArenaAllocator<int>(loadArena));
+
+    //Gather the materials that have a texture so they can all be created in one batch
+    ArenaVector<size_t> texturedMaterials{ArenaAllocator<size_t>(loadArena)};
+    std::vector<std::string> textureFiles;
+    texturedMaterials.reserve(textureNames.size());
+    textureFiles.reserve(textureNames.size());
     for (size_t i = 0; i < textureNames.size(); ++i)
     {
-        if(textureNames[i].empty())
+        if(!textureNames[i].empty())
         {
-            matToTex[i] = 0;
+            texturedMaterials.push_back(i);
+            textureFiles.push_back(textureNames[i]);
+        }
+    }
+
+    //Each textured material holds one reference to its texture, shared textures are only created once
+    std::vector<int> textureIds = CreateTextures(textureFiles,data.textureFiles.empty() ? nullptr : &data.textureFiles);
+    for (size_t i = 0; i < texturedMaterials.size(); ++i)
+    {
+        matToTex[texturedMaterials[i]] = textureIds[i];
+    }
+
+    //Load in all our meshes, every buffer of the model goes up in the batch
+    //The model takes both over as they are, so they're sized exactly
+    size_t meshCount = data.meshCache ? data.meshCache->GetMeshCount() : data.meshData.size();
+    std::vector<Mesh> modelMeshes;
+    std::vector<uint32_t> meshNodes;
+    modelMeshes.reserve(meshCount);
+    meshNodes.reserve(meshCount);
+    try
+    {
+        if(data.meshCache)
+        {
+            //Read straight from the mapped file into the mapped staging memory
+            const Vertex* vertices = data.meshCache->GetVertices();
+            const uint32_t* indices = data.meshCache->GetIndices();
+            for (uint32_t i = 0; i < data.meshCache->GetMeshCount(); ++i)
+            {
+                const MeshCache::MeshRange& range = data.meshCache->GetMeshRange(i);
+                modelMeshes.emplace_back(mainDevice.physicalDevice,mainDevice.logicalDevice,graphicsQueue,graphicsCommandPool,
+                    vertices + range.vertexOffset,range.vertexCount,indices + range.indexOffset,range.indexCount,matToTex[range.materialIndex],
+                    vertexLayout,&stagingBatch);
+                modelMeshes.back().SetLods(data.meshCache->GetMeshLods(i));
+                modelMeshes.back().SetMeshlets(graphicsQueue,graphicsCommandPool,data.meshCache->GetMeshlets(i),range.meshletCount,&stagingBatch);
+                CreateMeshletDescriptorSet(&modelMeshes.back());
+                meshNodes.push_back(range.node);
+            }
         }
         else
         {
-            matToTex[i] = CreateTexture(textureNames[i]);
+            for (const MeshData& mesh : data.meshData)
+            {
+                modelMeshes.emplace_back(mainDevice.physicalDevice,mainDevice.logicalDevice,graphicsQueue,graphicsCommandPool,
+                    &mesh.vertices,&mesh.indices,matToTex[mesh.materialIndex],vertexLayout,&stagingBatch);
+                modelMeshes.back().SetLods(mesh.lods);
+                modelMeshes.back().SetMeshlets(graphicsQueue,graphicsCommandPool,mesh.meshlets.data(),mesh.meshlets.size(),&stagingBatch);
+                CreateMeshletDescriptorSet(&modelMeshes.back());
+                meshNodes.push_back(mesh.node);
+            }
         }
     }
+    catch (...)
+    {
+        //Nothing of it has been submitted yet, so it can all go straight away
+        //(a mesh that failed half way through its constructor has already freed its own buffers)
+        for (Mesh& mesh : modelMeshes)
+            mesh.DestroyBuffers();
+        for (int textureId : textureIds)
+            ReleaseTexture(textureId);
+        stagingBatch.Release();
+        throw;
+    }
 
-    //Load in all our meshes
-    std::vector<Mesh> modelMeshes = MeshModel::LoadNode(mainDevice.physicalDevice,mainDevice.logicalDevice,graphicsQueue,graphicsCommandPool,
-        scene->mRootNode,scene,matToTex);
+    MeshModel meshModel(std::move(modelMeshes),data.sceneGraph,meshNodes);
+    meshModel.SetTextureIds(std::move(textureIds));
+    return meshModel;
+}
 
-    MeshModel  meshModel  = MeshModel(modelMeshes);
-    modelList.push_back(meshModel);
-    
+void VulkanRenderer::DestroyMeshModel(int modelId)
+{
+    if(modelId >= modelList.size()) return;
+
+    //Still loading, there is nothing to destroy yet
+    if(CancelModelLoad(modelId))
+        return;
+
+    //Frames in flight may still be reading the buffers and textures
+    vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+    //The model keeps its slot (so other model ids stay valid) but has nothing left to draw
+    DestroyModelResources(modelList[modelId]);
+    steadyFrames = 0;
+}
+
+void VulkanRenderer::DestroyModelResources(MeshModel& model)
+{
+    //Meshes free their meshlet descriptor sets too
+    model.DestroyMeshModel();
+
+    for (int textureId : model.GetTextureIds())
+        ReleaseTexture(textureId);
+    model.SetTextureIds({});
+}
+
+int VulkanRenderer::LoadModelAsync(const std::string& modelFile, float priority)
+{
+    //The id is taken now, with an empty model in its slot until the real one is ready
+    int modelId = static_cast<int>(modelList.size());
+    modelList.emplace_back();
+    modelLoadStatuses.push_back(ModelLoadStatus::Queued);
+    transformStore.Add();
+
+    ModelLoad load{};
+    load.modelId = modelId;
+    load.flags = std::make_shared<ModelLoadFlags>();
+    load.uploading = false;
+    load.cancelled = false;
+    load.uploadValue = 0;
+
+    //Import and reading the textures start on one worker, which hands the per mesh processing to the others
+    //and helps with it. Only the GPU side is left for UpdateModelLoads
+    load.data = threadPool.Submit([modelFile,priority,flags = load.flags,jobPool = &threadPool]()
+    {
+        if(flags->cancelled)
+            return ModelData{};
+        flags->started = true;
+
+        ModelData data = LoadModelData(modelFile,*jobPool,priority);
+        for (const std::string& textureName : data.textureNames)
+        {
+            if(flags->cancelled)
+                break;
+            if(!textureName.empty())
+                data.textureFiles.push_back(ReadTextureFile(textureName));
+        }
+        return data;
+    },priority);
+
+    modelLoads.push_back(std::move(load));
+    steadyFrames = 0;
+    return modelId;
+}
+
+ModelLoadStatus VulkanRenderer::GetModelLoadStatus(int modelId) const
+{
+    if(modelId < 0 || modelId >= modelLoadStatuses.size())
+        throw std::runtime_error("No model with id "+std::to_string(modelId));
+
+    //A worker may have started it since the last UpdateModelLoads, its flag says so straight away
+    if(modelLoadStatuses[modelId] == ModelLoadStatus::Queued)
+    {
+        for (const ModelLoad& load : modelLoads)
+        {
+            if(load.modelId == modelId && load.flags->started)
+                return ModelLoadStatus::Loading;
+        }
+    }
+    return modelLoadStatuses[modelId];
+}
+
+bool VulkanRenderer::CancelModelLoad(int modelId)
+{
+    for (size_t i = 0; i < modelLoads.size(); ++i)
+    {
+        ModelLoad& load = modelLoads[i];
+        if(load.modelId != modelId)
+            continue;
+
+        modelLoadStatuses[modelId] = ModelLoadStatus::Cancelled;
+        if(load.uploading)
+        {
+            //The GPU may still be copying into its buffers
+            load.cancelled = true;
+            return true;
+        }
+
+        //A worker that hasn't started skips it, one that has finishes on its own and the result is dropped
+        load.flags->cancelled = true;
+        modelLoads.erase(modelLoads.begin()+i);
+        steadyFrames = 0;
+        return true;
+    }
+    return false;
+}
+
+void VulkanRenderer::UpdateModelLoads()
+{
+    if(modelLoads.empty())
+        return;
+
+    uint64_t completedValue = graphicsTimeline.GetCompletedValue();
+    uint32_t uploadsStarted = 0;
+    size_t i = 0;
+    while (i < modelLoads.size())
+    {
+        ModelLoad& load = modelLoads[i];
+
+        //1. Uploaded, the model takes its slot (or goes if it was cancelled meanwhile)
+        if(load.uploading)
+        {
+            if(load.uploadValue > completedValue)
+            {
+                ++i;
+                continue;
+            }
+
+            load.stagingBatch->Release();
+            if(load.cancelled)
+            {
+                DestroyModelResources(load.model);
+            }
+            else
+            {
+                modelList[load.modelId] = std::move(load.model);
+                modelLoadStatuses[load.modelId] = ModelLoadStatus::Ready;
+                for (const std::pair<std::string,glm::mat4>& nodeTransform : load.nodeTransforms)
+                    SetNodeTransform(modelList[load.modelId],nodeTransform.first,nodeTransform.second);
+            }
+            modelLoads.erase(modelLoads.begin()+i);
+            steadyFrames = 0;
+            continue;
+        }
+
+        //2. Still on a worker
+        if(load.data.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if(load.flags->started)
+                modelLoadStatuses[load.modelId] = ModelLoadStatus::Loading;
+            ++i;
+            continue;
+        }
+
+        //3. Loaded, create its textures and buffers and send the data on its way without waiting for it.
+        //Only a few per frame, creating them all at once would make for one long frame
+        if(uploadsStarted == MAX_MODEL_UPLOADS_PER_FRAME)
+        {
+            ++i;
+            continue;
+        }
+
+        try
+        {
+            ModelData data = load.data.get();
+            load.stagingBatch = std::make_unique<StagingBatch>(mainDevice.physicalDevice,mainDevice.logicalDevice);
+            load.model = CreateModelFromData(data,*load.stagingBatch);
+            load.uploadValue = load.stagingBatch->SubmitAsync(graphicsCommandPool,graphicsTimeline);
+        }
+        catch (const std::exception& e)
+        {
+            //The slot stays empty, the rest of the scene carries on.
+            //CreateModelFromData cleans up after itself, the model is only still there if the submit failed
+            std::cerr << "Failed to load model " << load.modelId << ": " << e.what() << std::endl;
+            DestroyModelResources(load.model);
+            if(load.stagingBatch)
+                load.stagingBatch->Release();
+            modelLoadStatuses[load.modelId] = ModelLoadStatus::Failed;
+            modelLoads.erase(modelLoads.begin()+i);
+            continue;
+        }
+
+        load.uploading = true;
+        modelLoadStatuses[load.modelId] = ModelLoadStatus::Uploading;
+        uploadsStarted++;
+        steadyFrames = 0;
+        ++i;
+    }
+}
+
+void VulkanRenderer::CreateFramebufferAttachments()
+{
+    CreateDepthBufferImage();
+    CreateFramebuffers();
+}
+
+void VulkanRenderer::DestroyFramebufferAttachments()
+{
+    for (auto framebuffer : swapchainFramebuffers)
+    {
+        vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer,nullptr);
+    }
+    swapchainFramebuffers.clear();
+    framebufferGraphVersions.clear();
+
+    vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView,nullptr);
+    vkDestroyImage(mainDevice.logicalDevice,depthBufferImage,nullptr);
+    MemoryBudget::Free(mainDevice.logicalDevice,depthBufferImageMemory);
+    depthBufferImageView = nullptr;
+    depthBufferImage = nullptr;
+    depthBufferImageMemory = nullptr;
+}
+
+void VulkanRenderer::DestroyRenderTargets()
+{
+    DestroyFramebufferAttachments();
+
+    vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
+    vkDestroyPipeline(mainDevice.logicalDevice, depthPrePassPipeline, nullptr);
+    vkDestroyPipelineLayout(mainDevice.logicalDevice,pipelineLayout,nullptr);
+    vkDestroyRenderPass(mainDevice.logicalDevice,renderPass,nullptr);
+    vkDestroyRenderPass(mainDevice.logicalDevice,secondCullingRenderPass,nullptr);
+    graphicsPipeline = nullptr;
+    depthPrePassPipeline = nullptr;
+    pipelineLayout = nullptr;
+    renderPass = nullptr;
+    secondCullingRenderPass = nullptr;
+}
+
+void VulkanRenderer::RecreateRenderTargets()
+{
+    //Nothing in flight may still use the old ones
+    vkDeviceWaitIdle(mainDevice.logicalDevice);
+    DestroyRenderTargets();
+
+    ChooseRenderTargetFormats();
+    CreateRenderPass();
+    CreateGraphicsPipeline();
+    CreateFramebufferAttachments();
+
+    //The pyramid of the old depth buffer doesn't match what the new one will hold
+    if(depthBufferSampled && !depthReduceDescriptorSets.empty())
+        WriteDepthReduceDescriptor(0);
+    depthPyramidBuilt = false;
+    renderTargetsDirty = false;
+    steadyFrames = 0;
+}
+
+void VulkanRenderer::RecreateSwapChain()
+{
+    vkDeviceWaitIdle(mainDevice.logicalDevice);
+    framebufferResized = false;
+
+    DestroyFramebufferAttachments();
+    for (auto image : swapchainImages)
+    {
+        vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
+    }
+    size_t imageCount = swapchainImages.size();
+    swapchainImages.clear();
+
+    //The old swapchain is handed over so the new one can reuse its resources, and is only destroyed after
+    VkSwapchainKHR oldSwapchain = swapchainKhr;
+    VkFormat oldFormat = swapChainImageFormat;
+    CreateSwapChain(oldSwapchain);
+    vkDestroySwapchainKHR(mainDevice.logicalDevice,oldSwapchain,nullptr);
+
+    //Command buffers, uniform buffers and descriptor sets are made for each swapchain image
+    if(swapchainImages.size() != imageCount)
+        throw std::runtime_error("Swapchain image count changed when it was recreated");
+
+    //Pipelines don't depend on the size (viewport and scissor are dynamic), only on the format through the render pass
+    if(swapChainImageFormat != oldFormat)
+        RecreateRenderTargets();
+    else
+        CreateFramebufferAttachments();
+
+    //The depth pyramid is sized like the depth buffer
+    DestroyDepthPyramid();
+    CreateDepthPyramid();
+    CreateDepthReduceDescriptorSets();
+    WriteCullingDepthPyramidDescriptors();
+    depthPyramidBuilt = false;
+    steadyFrames = 0;
+
+    UpdateProjection();
+}
+
+void VulkanRenderer::DestroyDepthPyramid()
+{
+    vkDestroyDescriptorPool(mainDevice.logicalDevice,depthReduceDescriptorPool,nullptr);
+    depthReduceDescriptorPool = nullptr;
+    depthReduceDescriptorSets.clear();
+
+    vkDestroySampler(mainDevice.logicalDevice,depthPyramidSampler,nullptr);
+    for (VkImageView mipView : depthPyramidMipViews)
+        vkDestroyImageView(mainDevice.logicalDevice,mipView,nullptr);
+    depthPyramidMipViews.clear();
+    vkDestroyImageView(mainDevice.logicalDevice,depthPyramidImageView,nullptr);
+    vkDestroyImage(mainDevice.logicalDevice,depthPyramidImage,nullptr);
+    MemoryBudget::Free(mainDevice.logicalDevice,depthPyramidImageMemory);
+    depthPyramidSampler = nullptr;
+    depthPyramidImageView = nullptr;
+    depthPyramidImage = nullptr;
+    depthPyramidImageMemory = nullptr;
 }
 
 void VulkanRenderer::Cleanup() 
 {
     
+    //Queued loads don't start any more, running ones finish before the thread pool is destroyed
+    for (ModelLoad& load : modelLoads)
+        load.flags->cancelled = true;
+
     vkDeviceWaitIdle(mainDevice.logicalDevice);
 
+    for (ModelLoad& load : modelLoads)
+    {
+        if(load.uploading)
+        {
+            load.stagingBatch->Release();
+            load.model.DestroyMeshModel();
+        }
+    }
+    modelLoads.clear();
+
     //_aligned_free(modelTransferSpace);
 
     for (size_t i = 0; i < modelList.size(); ++i)
     {
         modelList[i].DestroyMeshModel();
     }
+    for (Mesh& mesh : meshList)
+        mesh.DestroyBuffers();
+
+    //Everything is idle, including what was retired for a frame that never got submitted
+    DestroyRetiredTextures(std::numeric_limits<uint64_t>::max());
+    MemoryBudget::SetReclaimHandler(nullptr);
 
     vkDestroyDescriptorPool(mainDevice.logicalDevice,samplerDescriptorPool,nullptr);
     vkDestroyDescriptorSetLayout(mainDevice.logicalDevice,samplerSetLayout,nullptr);
@@ -1620,44 +4210,61 @@ void VulkanRenderer::Cleanup()
     {
         vkDestroyImageView(mainDevice.logicalDevice,textureImageViews[i],nullptr);
         vkDestroyImage(mainDevice.logicalDevice, textureImages[i],nullptr);
-        vkFreeMemory(mainDevice.logicalDevice,textureImageMemory[i],nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,textureImageMemory[i]);
     }
     
-    vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView,nullptr);
-    vkDestroyImage(mainDevice.logicalDevice,depthBufferImage,nullptr);
-    vkFreeMemory(mainDevice.logicalDevice,depthBufferImageMemory,nullptr);
-    
+    DestroyDepthPyramid();
+    vkDestroyPipeline(mainDevice.logicalDevice,depthReducePipeline,nullptr);
+    vkDestroyPipelineLayout(mainDevice.logicalDevice,depthReducePipelineLayout,nullptr);
+    vkDestroyDescriptorSetLayout(mainDevice.logicalDevice,depthReduceSetLayout,nullptr);
+
     vkDestroyDescriptorPool(mainDevice.logicalDevice,descriptorPool,nullptr);
     vkDestroyDescriptorSetLayout(mainDevice.logicalDevice,descriptorSetLayout,nullptr);
     for (size_t i = 0; i< swapchainImages.size(); i++)
     {
-        vkFreeMemory(mainDevice.logicalDevice,vpUniformBufferMemory[i],nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,vpUniformBufferMemory[i]);
         vkDestroyBuffer(mainDevice.logicalDevice,vpUniformBuffer[i],nullptr);
 
         //vkFreeMemory(mainDevice.logicalDevice,modelUniformBufferMemory[i],nullptr);
         //vkDestroyBuffer(mainDevice.logicalDevice,modelUniformBuffer[i],nullptr);
     }
+    MemoryBudget::Free(mainDevice.logicalDevice,vertexColourBufferMemory);
+    vkDestroyBuffer(mainDevice.logicalDevice,vertexColourBuffer,nullptr);
 
-    for (Mesh& mesh : meshList)
-        mesh.DestroyBuffers();
+    vkDestroyDescriptorPool(mainDevice.logicalDevice,cullingDescriptorPool,nullptr);
+    for (size_t i = 0; i < cullingUniformBuffer.size(); i++)
+    {
+        MemoryBudget::Free(mainDevice.logicalDevice,cullingUniformBufferMemory[i]);
+        vkDestroyBuffer(mainDevice.logicalDevice,cullingUniformBuffer[i],nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,drawCommandBufferMemory[i]);
+        vkDestroyBuffer(mainDevice.logicalDevice,drawCommandBuffer[i],nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,drawCountBufferMemory[i]);
+        vkDestroyBuffer(mainDevice.logicalDevice,drawCountBuffer[i],nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,cullingInstanceBufferMemory[i]);
+        vkDestroyBuffer(mainDevice.logicalDevice,cullingInstanceBuffer[i],nullptr);
+        MemoryBudget::Free(mainDevice.logicalDevice,visibilityBufferMemory[i]);
+        vkDestroyBuffer(mainDevice.logicalDevice,visibilityBuffer[i],nullptr);
+    }
 
     for (size_t i = 0; i < MAX_FRAME_DRAWS; ++i)
     {
         vkDestroySemaphore(mainDevice.logicalDevice,renderFinished[i],nullptr);
         vkDestroySemaphore(mainDevice.logicalDevice,imageAvailable[i],nullptr);
-        vkDestroyFence(mainDevice.logicalDevice,drawFences[i], nullptr);
     }
+    graphicsTimeline.Destroy();
+    frameGraph.Destroy();
+    vkDestroyQueryPool(mainDevice.logicalDevice,pipelineStatisticsQueryPool,nullptr);
 
     vkDestroyCommandPool(mainDevice.logicalDevice,graphicsCommandPool,nullptr);
 
-    for (auto framebuffer : swapchainFramebuffers)
-    {
-        vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer,nullptr);
-    }
+    DestroyRenderTargets();
 
-    vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(mainDevice.logicalDevice,pipelineLayout,nullptr);
-    vkDestroyRenderPass(mainDevice.logicalDevice,renderPass,nullptr);
+    vkDestroyPipeline(mainDevice.logicalDevice, meshCullingPipeline, nullptr);
+    vkDestroyPipelineLayout(mainDevice.logicalDevice,meshCullingPipelineLayout,nullptr);
+    vkDestroyPipeline(mainDevice.logicalDevice, cullingPipeline, nullptr);
+    vkDestroyPipelineLayout(mainDevice.logicalDevice,cullingPipelineLayout,nullptr);
+    vkDestroyDescriptorSetLayout(mainDevice.logicalDevice,meshletSetLayout,nullptr);
+    vkDestroyDescriptorSetLayout(mainDevice.logicalDevice,cullingSetLayout,nullptr);
 
     for (auto image : swapchainImages)
     {
@@ -3,19 +3,42 @@
 #include <optional>
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <future>
+#include <memory>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 
+#include "FrustumCuller.h"
+#include "LinearArena.h"
 #include "Mesh.h"
+#include "MeshCache.h"
 #include "MeshModel.h"
+#include "QueueTimeline.h"
+#include "RenderGraph.h"
 #include "stb_image.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include "TransformStore.h"
 #include "Utilities.h"
 
 
 
 struct QueueFamilyIndices;
 
+enum class ModelLoadStatus
+{
+    Queued,     //Waiting for a worker thread
+    Loading,    //Being imported and processed on a worker thread
+    Uploading,  //Buffers on their way to the GPU
+    Ready,      //Drawn like any other model
+    Failed,     //The file or one of its textures couldn't be loaded, the model stays empty
+    Cancelled   //Stopped by CancelModelLoad or DestroyMeshModel before it was ready, the model stays empty
+};
+
 class VulkanRenderer
 {
     
@@ -24,18 +47,76 @@ public:
 
     int32_t Init(GLFWwindow * newWindow);
     void UpdateModel(int modelId,glm::mat4 newModel);
+    //Place count models from firstModelId on in one go (e.g. every object of a simulation each frame),
+    //rotations or scales can be null to keep the current ones
+    void UpdateModels(int firstModelId, size_t count, const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales);
+    //Local transform of a node of the model's hierarchy (e.g. to animate one part), by node name.
+    //For a model that is still loading it's applied once the model is ready
+    void UpdateModelNode(int modelId, const std::string& nodeName, glm::mat4 newTransform);
     void Draw();
 
     void CreateMeshModel(std::string modelFile);
+    void DestroyMeshModel(int modelId);
+    //Loads the model on the worker threads (higher priority first) and returns its id straight away.
+    //The id can be placed like any other model's, it draws nothing until the status is Ready
+    int LoadModelAsync(const std::string& modelFile, float priority = 0.0f);
+    ModelLoadStatus GetModelLoadStatus(int modelId) const;
+    //Stops a load that isn't ready yet, false if there was none
+    bool CancelModelLoad(int modelId);
+
+    //GPU memory streamed textures may use, textures give back mips (least recently used first) when it is exceeded
+    void SetTextureMemoryBudget(VkDeviceSize budget);
+    //Most device local memory the renderer may use (0 for what the driver reports as available),
+    //over it textures give back mips until usage is inside the budget again
+    void SetDeviceMemoryBudget(VkDeviceSize budget) {memoryBudget.SetLimit(budget);}
+    const MemoryBudget& GetMemoryBudget() const {return memoryBudget;}
+
+    //GPU vertex format for meshes, has to be set before Init (the pipeline is built for it)
+    void SetVertexLayout(const VertexLayout& layout) {vertexLayout = layout;}
+    //Depth 1 at the near plane and 0 at an infinite far plane, has to be set before Init
+    void SetReverseDepth(bool enabled) {reverseDepth = enabled;}
+    //Draw the depth of every mesh first with a position only pipeline, so the main pass shades each pixel once.
+    //Has to be set before Init, and only used if Shaders/depth.spv is there
+    void SetDepthPrePass(bool enabled) {depthPrePass = enabled;}
+    //Samples per pixel for anti-aliasing (1, 2, 4 or 8), lowered to the most the device supports.
+    //Can be changed at any time, the render targets are rebuilt before the next frame
+    void SetMsaaSamples(VkSampleCountFlagBits samples);
+    VkSampleCountFlagBits GetMsaaSamples() const {return msaaSamples;}
+    //GPU to run on, by any part of its name or by its UUID, instead of the best scoring one.
+    //Has to be set before Init, the VULKAN_DEVICE environment variable wins over it
+    void SetPreferredDevice(const std::string& nameOrUuid) {preferredDevice = nameOrUuid;}
+
+    //Cull meshlets of meshes drawn at full detail on the GPU (only if the culling shader could be loaded)
+    void SetMeshletCulling(bool enabled) {meshletCulling = enabled;}
+
+    //Cull whole meshes on the GPU against the frustum and the last frame's depth instead of on the CPU
+    //(only if the culling shaders could be loaded)
+    void SetGpuCulling(bool enabled) {gpuCulling = enabled;}
+
+    //Draws, binds, uploads and so on of the last recorded frame, with the GPU's pipeline statistics where the device has them
+    const FrameStats& GetFrameStats() const {return frameStats;}
 
     ~VulkanRenderer();
 private:
     GLFWwindow* window;
+    bool framebufferResized; //Set by GLFW when the window size changes, the swapchain is recreated on the next frame
 
     size_t currentFrame = 0;
+    uint64_t frameNumber = 0; //Frames drawn so far, used to know when resources are no longer in flight
+    //Frames drawn since something changed what a frame needs (models, swapchain, texture residency),
+    //debug builds check Draw stops allocating once there have been STEADY_STATE_FRAMES of them
+    uint32_t steadyFrames = 0;
+
+    //Workers for CPU heavy loading work (texture decoding, model import)
+    ThreadPool threadPool;
 
     //Scene objects
     std::vector<Mesh> meshList;
+    VertexLayout vertexLayout;
+
+    //Single white colour read by every vertex, instead of storing the same colour in each one
+    VkBuffer vertexColourBuffer;
+    VkDeviceMemory vertexColourBufferMemory;
 
     //Scene settings
     struct UboViewProjection
@@ -47,6 +128,9 @@ private:
     //Vulkan components
     // - Main
     VkInstance instance;
+    bool physicalDeviceProperties2Supported;
+    bool deviceIdPropertiesSupported;
+    std::string preferredDevice;
     struct 
     {
         VkPhysicalDevice physicalDevice;
@@ -59,11 +143,22 @@ private:
     
     std::vector<SwapchainImage> swapchainImages;
     std::vector<VkFramebuffer> swapchainFramebuffers;
+    std::vector<uint64_t> framebufferGraphVersions; //Render graph transient images each framebuffer was made with (MSAA)
     std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<uint64_t> imageTimelineValues; //Submission that last used each command buffer
 
     VkImage depthBufferImage;
     VkDeviceMemory depthBufferImageMemory;
     VkImageView depthBufferImageView;
+    VkFormat depthBufferFormat;
+    bool depthBufferSampled; //Can be read by the depth pyramid (not every depth format can be sampled, and not with MSAA)
+
+    //Multisampled colour the scene is drawn to, resolved into the swapchain image at the end of the render pass.
+    //Only there with MSAA, it never leaves the scene pass so it's a render graph image, this is the view of the frame being recorded
+    VkImageView msaaColourView;
+    VkSampleCountFlagBits requestedMsaaSamples;
+    VkSampleCountFlagBits msaaSamples; //What the render targets use, clamped to the device
+    bool renderTargetsDirty; //Rebuilt at the start of the next frame
     
     //-Descriptors
     VkDescriptorSetLayout descriptorSetLayout;
@@ -84,16 +179,229 @@ private:
     //-Assets
 
     std::vector<MeshModel> modelList;
+    std::vector<ModelLoadStatus> modelLoadStatuses; //Per model id
+
+    //What a model file holds, loaded without touching the GPU so it can happen on a worker thread
+    struct TextureFile
+    {
+        std::vector<char> content;
+        uint64_t contentHash;
+    };
+    struct ModelData
+    {
+        std::unique_ptr<MeshCache> meshCache; //Only if the cache was up to date, the meshes come straight from it then
+        std::vector<std::string> textureNames;
+        SceneGraph sceneGraph;
+        std::vector<MeshData> meshData;
+        std::vector<TextureFile> textureFiles; //Of the materials with a texture, in order, if they were already read
+    };
+    //Shared with the worker thread, which may still be holding them after the load is gone
+    struct ModelLoadFlags
+    {
+        std::atomic<bool> started{false};
+        std::atomic<bool> cancelled{false};
+    };
+    struct ModelLoad
+    {
+        int modelId;
+        std::shared_ptr<ModelLoadFlags> flags;
+        std::future<ModelData> data;
+        bool uploading;
+        bool cancelled; //While uploading, the model is destroyed once the GPU is done with it
+        MeshModel model;
+        std::unique_ptr<StagingBatch> stagingBatch;
+        uint64_t uploadValue; //On the graphics timeline
+        std::vector<std::pair<std::string,glm::mat4>> nodeTransforms; //UpdateModelNode calls made while it was loading
+    };
+    std::vector<ModelLoad> modelLoads;
     
     VkSampler textureSampler;
     std::vector<VkImage> textureImages;
     std::vector<VkDeviceMemory> textureImageMemory;
     std::vector<VkImageView> textureImageViews;
+    //Texture ids are shared between materials and models, slots of destroyed textures are reused
+    TextureCache textureCache;
+    std::vector<int> freeTextureSlots;
+
+    //Textures are decoded in the background and their mips streamed in/out depending on screen size and budget
+    TextureStreamer textureStreamer;
+    std::vector<TextureStreamer::ResidencyChange> residencyChanges; //Of this frame, reused every frame
+    int placeholderTextureId;
+    VkDeviceSize textureMemoryBudget;
+    //What streaming may use right now, lowered when device memory runs over and raised again step by step
+    VkDeviceSize textureStreamingBudget;
+
+    //Device memory usage per heap, polled every frame
+    MemoryBudget memoryBudget;
+    bool memoryBudgetSupported;
+    //Failed allocations on other threads ask for memory back here, texture streaming gives it on the render thread
+    std::atomic<VkDeviceSize> reclaimRequestBytes{0};
+    std::thread::id renderThreadId; //The one that called Init, and draws
+
+    //Texture resources replaced while frames in flight could still be using them
+    struct RetiredTexture
+    {
+        VkImage image;
+        VkDeviceMemory imageMemory;
+        VkImageView imageView;
+        VkDescriptorSet descriptorSet;
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        uint64_t timelineValue; //Graphics queue submission after which nothing uses it
+    };
+    std::vector<RetiredTexture> retiredTextures;
+
+    //Mip copies to record at the start of this frame's command buffer
+    struct PendingTextureUpload
+    {
+        VkImage image;
+        uint32_t mipLevels;
+        std::vector<VkExtent2D> mipExtents;
+        //Its first uploadLevels levels come from the staging buffer
+        VkBuffer stagingBuffer;
+        uint32_t uploadLevels;
+        std::vector<VkDeviceSize> mipOffsets;
+        //The rest from the image it replaces, from sourceMip on (VK_NULL_HANDLE if that was the placeholder)
+        VkImage sourceImage;
+        uint32_t sourceMip;
+        uint32_t sourceMipLevels;
+    };
+    std::vector<PendingTextureUpload> pendingTextureUploads;
     
+    //- Meshlet culling
+    struct UboCulling
+    {
+        glm::vec4 frustumPlanes[6];
+        glm::vec4 cameraPosition;
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec4 depthPyramidSize; //xy size of the top level, z is 1 when it holds the last frame's depth, w is 1 for reverse depth
+    } uboCulling;
+
+    struct PushCulling
+    {
+        glm::mat4 model;
+        uint32_t meshletCount;
+        uint32_t commandOffset; //First draw command of the mesh
+        uint32_t countIndex; //Where the number of visible meshlets goes
+        float scale;
+    };
+
+    //Mesh culled as a whole on the GPU, in the instance buffer. The shader picks its level of detail too
+    struct CullingLod
+    {
+        uint32_t indexOffset;
+        uint32_t indexCount;
+        float error;
+        uint32_t padding;
+    };
+    struct CullingInstance
+    {
+        glm::mat4 model;
+        glm::vec4 sphere; //Bounds centre and radius in model space
+        CullingLod lods[MAX_MESH_LODS];
+        uint32_t lodCount;
+        uint32_t padding[3];
+    };
+
+    struct PushMeshCulling
+    {
+        uint32_t instanceCount;
+        uint32_t commandOffset; //Draw command of the first instance
+        uint32_t countOffset; //Count of the first instance
+        uint32_t firstPassCountOffset; //Second pass only, where the first pass put the counts
+        uint32_t secondPass;
+        float lodPixelScale; //Pixels per world unit at distance 1
+        float maxLodPixelError;
+    };
+
+    //How a mesh gets drawn this frame
+    struct MeshDraw
+    {
+        bool visible; //Always true when meshes are culled on the GPU
+        bool textureUsed; //Visible, or was the last time the GPU culled it (streamed textures only get detail for these)
+        bool culledAsWhole; //Also gets a draw command in the second culling pass
+        size_t lod; //Picked by the culling shader instead when culled as a whole
+        int64_t commandOffset; //-1 when it isn't culled on the GPU
+        uint32_t countIndex;
+        uint32_t drawCount; //Draw commands it owns (its meshlets, or 1 when culled as a whole)
+    };
+
+    //Model matrix of every model, indexed by model id
+    TransformStore transformStore;
+
+    //World bounds of every mesh, tested against the frustum before anything is recorded (when not culled on the GPU)
+    FrustumCuller frustumCuller;
+    std::vector<uint8_t> meshVisible;
+
+    //Lists built while recording a frame (mesh draws, culling dispatches), all freed at the start of the next one
+    LinearArena frameArena{FRAME_ARENA_SIZE};
+
+    bool meshletCulling;
+    bool gpuCulling;
+    bool drawIndirectCountSupported;
+    bool multiDrawIndirectSupported;
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount;
+
+    VkDescriptorSetLayout cullingSetLayout;
+    VkDescriptorSetLayout meshletSetLayout;
+    VkDescriptorPool cullingDescriptorPool;
+    std::vector<VkDescriptorSet> cullingDescriptorSets;
+    VkPipelineLayout cullingPipelineLayout;
+    VkPipeline cullingPipeline;
+    VkPipelineLayout meshCullingPipelineLayout;
+    VkPipeline meshCullingPipeline;
+
+    std::vector<VkBuffer> cullingUniformBuffer;
+    std::vector<VkDeviceMemory> cullingUniformBufferMemory;
+    std::vector<VkBuffer> drawCommandBuffer;
+    std::vector<VkDeviceMemory> drawCommandBufferMemory;
+    std::vector<VkBuffer> drawCountBuffer;
+    std::vector<VkDeviceMemory> drawCountBufferMemory;
+    std::vector<VkBuffer> cullingInstanceBuffer;
+    std::vector<VkDeviceMemory> cullingInstanceBufferMemory;
+    uint32_t culledInstanceCount; //Of the frame being recorded, the second culling pass tests the same ones
+    //Draw counts copied back at the end of each frame, the next time its image is recorded they say which meshes the GPU drew
+    std::vector<VkBuffer> visibilityBuffer;
+    std::vector<VkDeviceMemory> visibilityBufferMemory;
+    std::vector<std::vector<uint32_t>> visibilityCountIndices; //Per image, count of each mesh draw (NO_COUNT if not GPU culled)
+    static const uint32_t NO_COUNT = UINT32_MAX;
+
+    //- Depth pyramid
+    //Farthest depth of every 2x2 block of the level above, built from the depth buffer at the end of each frame
+    //so the next frame can cull meshes hidden behind what was drawn
+    VkImage depthPyramidImage;
+    VkDeviceMemory depthPyramidImageMemory;
+    VkImageView depthPyramidImageView;
+    std::vector<VkImageView> depthPyramidMipViews;
+    uint32_t depthPyramidWidth;
+    uint32_t depthPyramidHeight;
+    uint32_t depthPyramidLevels;
+    VkSampler depthPyramidSampler;
+    bool depthPyramidBuilt;
+
+    VkDescriptorSetLayout depthReduceSetLayout;
+    VkPipelineLayout depthReducePipelineLayout;
+    VkPipeline depthReducePipeline;
+    VkDescriptorPool depthReduceDescriptorPool;
+    std::vector<VkDescriptorSet> depthReduceDescriptorSets; //One for each level
+
+    //- Frame stats
+    FrameStats frameStats; //Of the last recorded frame
+    FrameStats recordingStats;
+    bool pipelineStatisticsSupported;
+    VkQueryPool pipelineStatisticsQueryPool; //One query for each command buffer, null without the feature
+    std::vector<bool> pipelineStatisticsRecorded; //Queries that have been recorded, so have results to read
+
     //- Pipeline
     VkPipeline graphicsPipeline;
+    VkPipeline depthPrePassPipeline; //Null when there is no pre-pass
     VkPipelineLayout pipelineLayout;
+    bool reverseDepth;
+    bool depthPrePass;
     VkRenderPass renderPass;
+    //Loads what renderPass drew instead of clearing it, for the meshes the second culling pass finds (null with MSAA)
+    VkRenderPass secondCullingRenderPass;
 
     // -Pools
     VkCommandPool graphicsCommandPool;
@@ -109,7 +417,12 @@ private:
     //- Synchronisation
     std::vector<VkSemaphore> imageAvailable;
     std::vector<VkSemaphore> renderFinished;
-    std::vector<VkFence> drawFences;
+    //Every graphics queue submission signals the next value, each frame slot keeps the value of its last one
+    QueueTimeline graphicsTimeline;
+    std::vector<uint64_t> frameTimelineValues;
+    bool timelineSemaphoreSupported;
+    //Rebuilt every frame, passes and barriers of the command buffer being recorded
+    RenderGraph frameGraph;
     
     
 
@@ -118,17 +431,44 @@ private:
     void CreateInstance();
     void CreateLogicalDevice();
     void CreateSurface();
-    void CreateSwapChain();
+    //Replacing oldSwapchain if there is one, which the caller destroys
+    void CreateSwapChain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
+    void ChooseRenderTargetFormats();
     void CreateRenderPass();
     void CreateDescriptorSetLayout();
     void CreatePushConstantRange();
     void CreateGraphicsPipeline();
+    void CreateCullingPipeline();
+    void CreateCullingBuffers();
+    void CreateCullingDescriptorSets();
+    void CreateMeshletDescriptorSet(Mesh* mesh);
     void CreateDepthBufferImage();
+    void CreateDepthPyramid();
+    void CreateDepthReducePipeline();
+    void CreateDepthReduceDescriptorSets();
+    void WriteDepthReduceDescriptor(uint32_t level);
+    void WriteCullingDepthPyramidDescriptors();
+    void DestroyDepthPyramid();
     void CreateFramebuffers();
+    //Replaces the framebuffer of a swapchain image, which no submission may still be using
+    void CreateFramebuffer(uint32_t imageIndex, VkImageView colourView);
     void CreateCommandPool();
     void CreateCommandBuffers();
+    void CreatePipelineStatisticsQueryPool();
     void CreateSynchronisation();
     void CreateTextureSampler();    
+    void CreateVertexColourBuffer();
+    //Render pass, pipelines and the attachments that depend on the sample count
+    void DestroyRenderTargets();
+    void RecreateRenderTargets();
+    //Attachments and framebuffers, which depend on the swapchain size
+    void CreateFramebufferAttachments();
+    void DestroyFramebufferAttachments();
+    //After a resize, everything sized like the window is rebuilt but pipelines are kept
+    void RecreateSwapChain();
+    void UpdateProjection();
+
+    static void FramebufferResizeCallback(GLFWwindow* window, int width, int height);
     
     void CreateUniformBuffers();
     void CreateDescriptorPool();
@@ -137,6 +477,19 @@ private:
     void UpdateUniformBuffer(uint32_t imageIndex);
     //- Record functions
     void RecordCommands(uint32_t currentImage);
+    void RecordCulling(uint32_t currentImage, ArenaVector<MeshDraw>& meshDraws, const glm::vec3& cameraPosition);
+    //Meshes the first pass hid behind last frame's depth, tested again against the pyramid built from this frame's
+    void RecordSecondCulling(uint32_t currentImage);
+    void RecordCulledDraw(uint32_t currentImage, const MeshDraw& meshDraw, bool secondPass);
+    //Every visible mesh, only their depth (pre-pass) or fully shaded. The second pass only draws what the second culling pass found
+    void RecordMeshDraws(uint32_t currentImage, const ArenaVector<MeshDraw>& meshDraws, const glm::vec3& cameraPosition, bool depthOnly,
+        bool secondPass);
+    //Which meshes the GPU drew the last time this image's commands ran, into textureUsed
+    void ReadVisibility(uint32_t currentImage, ArenaVector<MeshDraw>& meshDraws);
+    void RecordVisibilityReadback(uint32_t currentImage, bool secondPass);
+    void RecordDepthPyramid(uint32_t currentImage);
+    //GPU counts of the last time this command buffer ran, if they're there yet
+    void ReadPipelineStatistics(uint32_t currentImage);
     
     //- Get Functions
     void GetPhysicalDevice();
@@ -148,12 +501,23 @@ private:
     // -- Checker Functions
     bool CheckInstanceExtensionSupport(const std::vector<const char*>& checkExtensions)const;
     bool CheckDeviceExtensionSupport(const VkPhysicalDevice& device) const;
+    bool IsDeviceExtensionSupported(const VkPhysicalDevice& device, const char* extensionName) const;
+    bool IsInstanceExtensionSupported(const char* extensionName) const;
+    //Fills in a chain of extension feature structs, left as they are (all off) without VK_KHR_get_physical_device_properties2
+    void GetPhysicalDeviceFeatures2(void* featureChain) const;
     bool CheckDeviceSuitable(const VkPhysicalDevice& device) const;
+    //Higher is better: device type first, then video memory, optional features and queue families
+    uint64_t RateDevice(const VkPhysicalDevice& device) const;
+    //Empty without VK_KHR_external_memory_capabilities
+    std::string GetDeviceUuid(const VkPhysicalDevice& device) const;
+    static bool MatchesDevice(const std::string& deviceName, const std::string& uuid, const std::string& requested);
+    static const char* GetDeviceTypeName(VkPhysicalDeviceType deviceType);
     bool CheckValidationLayerSupport() const;
+    void CheckVertexLayoutSupport();
     void PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
 
     //-- Getter Functions
-    QueueFamilyIndices& GetQueueFamilies(const VkPhysicalDevice& device) const;
+    QueueFamilyIndices GetQueueFamilies(const VkPhysicalDevice& device) const;
     SwapChainDetails GetSwapChainDetails(const VkPhysicalDevice& device) const;
 
     //--Choose functions
@@ -161,21 +525,53 @@ private:
     VkPresentModeKHR ChooseBestPresentationMode(const std::vector<VkPresentModeKHR>& presentationModes) const;
     VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities) const;
     VkFormat ChooseSupportedFormat(const std::vector<VkFormat> &formats,VkImageTiling tiling, VkFormatFeatureFlags featureFlags)const;
+    VkSampleCountFlagBits ChooseMsaaSamples(VkSampleCountFlagBits requested) const;
     
     //--Create functions
     VkImage CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
-                        VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory);
-    VkImageView CreateImageView(VkImage image, VkFormat format,VkImageAspectFlags aspectFlags) const;
+                        VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory,
+                        uint32_t mipLevels = 1, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
+    VkImageView CreateImageView(VkImage image, VkFormat format,VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1,
+                                uint32_t baseMipLevel = 0) const;
     VkShaderModule CreateShaderModule(const std::vector<char>& code);
+    //Null if the shader hasn't been compiled
+    VkPipeline CreateComputePipeline(const std::string& shaderFile, VkPipelineLayout layout,
+        const VkSpecializationInfo* specializationInfo = nullptr);
 
-    int CreateTextureImage(const std::string& fileName);
     int CreateTexture(const std::string& fileName);
-    int CreateTextureDescriptor(VkImageView textureImage);
+    //readFiles are the files' contents if they've been read already (they're moved out)
+    std::vector<int> CreateTextures(const std::vector<std::string>& fileNames, std::vector<TextureFile>* readFiles = nullptr);
+    static TextureFile ReadTextureFile(const std::string& fileName);
+    VkDescriptorSet CreateTextureDescriptor(VkImageView textureImage);
+    int AllocateTextureSlot();
+    void ReleaseTexture(int textureId);
+
+    // - Model loading
+    //Each mesh is processed as its own job on jobPool (at priority), a worker of the pool calling it runs them too while it waits
+    static ModelData LoadModelData(const std::string& modelFile, ThreadPool& jobPool, float priority = 0.0f);
+    //Creates the textures and buffers, the buffers' data goes into stagingBatch.
+    //If it throws, whatever it had created is gone again and stagingBatch is released
+    MeshModel CreateModelFromData(ModelData& data, StagingBatch& stagingBatch);
+    //False if the model has no node of that name
+    static bool SetNodeTransform(MeshModel& model, const std::string& nodeName, const glm::mat4& newTransform);
+    void DestroyModelResources(MeshModel& model);
+    //Starts the uploads of loaded models and hands over the ones the GPU has finished
+    void UpdateModelLoads();
+
+    // - Texture streaming
+    void CreatePlaceholderTexture();
+    void UpdateTextureStreaming();
+    void ChangeTextureResidency(int textureId, uint32_t newResidentMip);
+    void RecordTextureUploads(VkCommandBuffer commandBuffer);
+    //Destroys retired textures whose last submission is at or below completedValue on the graphics timeline,
+    //the rest may still be used by the GPU and are kept
+    void DestroyRetiredTextures(uint64_t completedValue);
+    //Level of detail of the mesh to draw, based on how many pixels its simplification error would cover
+    size_t GetLodLevel(const glm::mat4& model, const Mesh* mesh, const glm::vec3& cameraPosition) const;
+    float GetProjectedSize(const glm::mat4& model, const Mesh* mesh, const glm::vec3& cameraPosition) const;
+    float GetLodPixelScale() const;
 
 
-    // - Loader functions
-    stbi_uc*  LoadTextureFile(const std::string& fileName, int* width, int* height, VkDeviceSize* imageSize) const;
-    
     //- Destroy functions
     void Cleanup();
 